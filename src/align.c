@@ -0,0 +1,99 @@
+#include "align.h"
+
+static int8_t negate(int8_t x);
+
+/* Rotate $count I/Q pairs by $rot*90 degrees counterclockwise */
+void
+soft_rotate(int8_t *syms, size_t count, int rot)
+{
+	size_t i;
+	int8_t tmp;
+
+	rot &= 3;
+	if (!rot) {
+		return;
+	}
+
+	for (i=0; i<count; i++) {
+		switch (rot) {
+		case 1:
+			tmp = syms[2*i];
+			syms[2*i] = negate(syms[2*i+1]);
+			syms[2*i+1] = tmp;
+			break;
+		case 2:
+			syms[2*i] = negate(syms[2*i]);
+			syms[2*i+1] = negate(syms[2*i+1]);
+			break;
+		case 3:
+			tmp = syms[2*i];
+			syms[2*i] = syms[2*i+1];
+			syms[2*i+1] = negate(tmp);
+			break;
+		}
+	}
+}
+
+/* Mirror $count I/Q pairs around the I axis, i.e. conjugate them */
+void
+soft_mirror(int8_t *syms, size_t count)
+{
+	size_t i;
+
+	for (i=0; i<count; i++) {
+		syms[2*i+1] = negate(syms[2*i+1]);
+	}
+}
+
+/* Look for the $ref_len symbols in $ref inside $buf, trying every window
+ * ending between symbol $lo and $hi (inclusive) and every rotation. Symbols are
+ * compared by their hard decisions only */
+void
+align_find(const int8_t *ref, size_t ref_len, const int8_t *buf, size_t lo, size_t hi, AlignResult *res)
+{
+	size_t end, i;
+	unsigned agree[4];
+	int ri, rq, bi, bq;
+	int rot;
+
+	res->end = lo;
+	res->rot = 0;
+	res->score = 0;
+
+	if (lo < ref_len) {
+		lo = ref_len;
+	}
+
+	for (end=lo; end<=hi; end++) {
+		agree[0] = agree[1] = agree[2] = agree[3] = 0;
+		for (i=0; i<ref_len; i++) {
+			ri = ref[2*i] >= 0;
+			rq = ref[2*i+1] >= 0;
+			bi = buf[2*(end-ref_len+i)] >= 0;
+			bq = buf[2*(end-ref_len+i)+1] >= 0;
+
+			/* Rotating (I, Q) by 90 degrees gives (-Q, I) */
+			agree[0] += (ri == bi) + (rq == bq);
+			agree[1] += (ri != bq) + (rq == bi);
+			agree[2] += (ri != bi) + (rq != bq);
+			agree[3] += (ri == bq) + (rq != bi);
+		}
+
+		for (rot=0; rot<4; rot++) {
+			if (agree[rot] > res->score * 2 * ref_len) {
+				res->score = agree[rot] / (2.0 * ref_len);
+				res->end = end;
+				res->rot = rot;
+			}
+		}
+	}
+}
+
+/* Static functions {{{ */
+/* Negate a soft symbol, without overflowing on -128 */
+int8_t
+negate(int8_t x)
+{
+	return x == -128 ? 127 : -x;
+}
+/*}}}*/
@@ -0,0 +1,489 @@
+#include <complex.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "autotune.h"
+#include "utils.h"
+
+/* Samplerate used when none is given, the usual one for LRPT recordings */
+#define AUTOTUNE_SAMPLERATE 140000
+
+/* Each setting is run for a few chunks to warm up, then timed over a few
+ * windows of this length, and the best one is kept */
+#define AUTOTUNE_WARMUP 4
+#define AUTOTUNE_REPS 3
+#define AUTOTUNE_WINDOW_NS 100000000ULL
+
+/* A setting other than the default must be at least this much faster to be
+ * picked, so that measurement noise doesn't decide */
+#define AUTOTUNE_MIN_GAIN 1.05
+
+/* Seconds of synthetic signal, played in a loop */
+#define AUTOTUNE_SIGNAL_SECS 1
+
+typedef struct {
+	float complex *buf;
+	size_t len, pos;
+	uint64_t samples_read;
+} LoopState;
+
+static double   autotune_measure(const DemodParams *params, Source *src);
+static void     autotune_discard(const int8_t *syms, size_t len, void *ctx);
+static Source*  loopsrc_init(unsigned samplerate, unsigned sym_rate);
+static int      loopsrc_read(Source *self, size_t count);
+static int      loopsrc_close(Source *self);
+static uint64_t loopsrc_get_size(const Source *self);
+static uint32_t loopsrc_rand(uint64_t *rng);
+static uint64_t loopsrc_get_done(const Source *self);
+static int      wisdom_better(const WisdomRate *a, const WisdomRate *b);
+static int      mkdir_parents(const char *fname);
+
+static const unsigned chunk_sizes[] = {4096, 8192, 16384, 32768, 65536, 0};
+static const unsigned orders[] = {16, 24, 32, 48, 64, 96, 128, 0};
+static const unsigned factors[] = {2, 3, 4, 6, 8, 0};
+
+/* Benchmark this machine: first the chunk size, then the number of pipeline
+ * stages and filter threads, using the RRC order and oversampling factor in
+ * $params. Then measure the throughput of every filter configuration with the
+ * settings picked */
+void
+autotune_run(Wisdom *self, const DemodParams *params, unsigned samplerate, int (*log)(const char *msg, ...))
+{
+	DemodParams p;
+	Source *src;
+	WisdomRate *r;
+	double rate, best;
+	unsigned i, j, ncpus, nthreads, fir_threads;
+	char line[128];
+	int len;
+
+	if (!samplerate) {
+		samplerate = AUTOTUNE_SAMPLERATE;
+	}
+	src = loopsrc_init(samplerate, params->sym_rate);
+
+	if (gethostname(self->host, sizeof(self->host))) {
+		strcpy(self->host, "unknown");
+	}
+	self->host[sizeof(self->host)-1] = '\0';
+	get_cpu_model(self->cpu, sizeof(self->cpu));
+	log("Tuning for %s (%s), RRC order %u, oversampling %u\n", self->host, self->cpu,
+	    params->rrc_order, params->interp_factor);
+
+	/* Chunk size, on a single thread */
+	p = *params;
+	p.nthreads = 1;
+	p.fir_threads = 1;
+	p.chunk_size = CHUNKSIZE;
+	best = autotune_measure(&p, src);
+	self->chunk_size = CHUNKSIZE;
+	log("Chunk size %5u: %6.2f Msamples/s\n", CHUNKSIZE, best/1e6);
+	for (i=0; chunk_sizes[i]; i++) {
+		if (chunk_sizes[i] == CHUNKSIZE) {
+			continue;
+		}
+		p.chunk_size = chunk_sizes[i];
+		rate = autotune_measure(&p, src);
+		log("Chunk size %5u: %6.2f Msamples/s\n", chunk_sizes[i], rate/1e6);
+		if (rate > best * AUTOTUNE_MIN_GAIN) {
+			best = rate;
+			self->chunk_size = chunk_sizes[i];
+		}
+	}
+	p.chunk_size = self->chunk_size;
+
+	/* Pipeline stages and filter threads, without using more threads than
+	 * there are cores */
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	self->nthreads = 1;
+	self->fir_threads = 1;
+	for (nthreads=1; nthreads<=DEMOD_MAX_STAGES && nthreads<=ncpus; nthreads++) {
+		for (fir_threads=1; nthreads+fir_threads-1 <= ncpus; fir_threads *= 2) {
+			if (nthreads == 1 && fir_threads == 1) {
+				continue;
+			}
+			p.nthreads = nthreads;
+			p.fir_threads = fir_threads;
+			rate = autotune_measure(&p, src);
+			log("%u threads, %u filter threads: %6.2f Msamples/s\n", nthreads, fir_threads, rate/1e6);
+			if (rate > best * AUTOTUNE_MIN_GAIN) {
+				best = rate;
+				self->nthreads = nthreads;
+				self->fir_threads = fir_threads;
+			}
+		}
+	}
+	p.nthreads = self->nthreads;
+	p.fir_threads = self->fir_threads;
+	log("Picked chunk size %u, %u threads, %u filter threads\n", self->chunk_size, self->nthreads, self->fir_threads);
+
+	/* Throughput of each filter configuration */
+	self->nrates = 0;
+	len = snprintf(line, sizeof(line), "Real time factor at %u samples/s, oversampling", samplerate);
+	for (j=0; factors[j]; j++) {
+		len += snprintf(line+len, sizeof(line)-len, " %6u", factors[j]);
+	}
+	log("%s\n", line);
+	for (i=0; orders[i]; i++) {
+		len = snprintf(line, sizeof(line), "RRC order %3u:", orders[i]);
+		for (j=0; factors[j] && self->nrates < WISDOM_MAX_RATES; j++) {
+			p.rrc_order = orders[i];
+			p.interp_factor = factors[j];
+			r = &self->rates[self->nrates++];
+			r->order = orders[i];
+			r->factor = factors[j];
+			r->rate = autotune_measure(&p, src);
+			len += snprintf(line+len, sizeof(line)-len, " %6.1f", r->rate/samplerate);
+		}
+		log("%s\n", line);
+	}
+
+	src->close(src);
+}
+
+/* Get the default location of the wisdom file for this host:
+ * $XDG_CACHE_HOME/meteor_demod/wisdom-<hostname>, or the same under
+ * ~/.cache */
+int
+wisdom_path(char *buf, size_t len)
+{
+	const char *dir;
+	char host[64];
+	int n;
+
+	if (gethostname(host, sizeof(host))) {
+		return -1;
+	}
+	host[sizeof(host)-1] = '\0';
+
+	if ((dir = getenv("XDG_CACHE_HOME")) && *dir) {
+		n = snprintf(buf, len, "%s/meteor_demod/wisdom-%s", dir, host);
+	} else if ((dir = getenv("HOME")) && *dir) {
+		n = snprintf(buf, len, "%s/.cache/meteor_demod/wisdom-%s", dir, host);
+	} else {
+		return -1;
+	}
+
+	return (n < 0 || (size_t)n >= len) ? -1 : 0;
+}
+
+/* Load the results of a previous autotune run. Fails if the file is missing or
+ * malformed, or if it was written on another machine, e.g. one sharing the same
+ * home directory */
+int
+wisdom_load(Wisdom *self, const char *fname)
+{
+	FILE *fd;
+	WisdomRate *r;
+	char line[256], host[64], cpu[128];
+	int err;
+
+	if (!(fd = fopen(fname, "r"))) {
+		return -1;
+	}
+
+	memset(self, 0, sizeof(*self));
+	err = 0;
+	while (!err && fgets(line, sizeof(line), fd)) {
+		line[strcspn(line, "\n")] = '\0';
+		if (line[0] == '#' || line[0] == '\0') {
+			continue;
+		}
+
+		if (!strncmp(line, "host ", 5)) {
+			snprintf(self->host, sizeof(self->host), "%s", line+5);
+		} else if (!strncmp(line, "cpu ", 4)) {
+			snprintf(self->cpu, sizeof(self->cpu), "%s", line+4);
+		} else if (!strncmp(line, "chunk ", 6)) {
+			self->chunk_size = atoi(line+6);
+		} else if (!strncmp(line, "threads ", 8)) {
+			self->nthreads = atoi(line+8);
+		} else if (!strncmp(line, "fir-threads ", 12)) {
+			self->fir_threads = atoi(line+12);
+		} else if (!strncmp(line, "rate ", 5) && self->nrates < WISDOM_MAX_RATES) {
+			r = &self->rates[self->nrates];
+			err = sscanf(line, "rate %u %u %lf", &r->order, &r->factor, &r->rate) != 3;
+			self->nrates++;
+		}
+	}
+	fclose(fd);
+
+	if (gethostname(host, sizeof(host))) {
+		strcpy(host, "unknown");
+	}
+	host[sizeof(host)-1] = '\0';
+	get_cpu_model(cpu, sizeof(cpu));
+
+	if (err || strcmp(self->host, host) || strcmp(self->cpu, cpu)) {
+		return -1;
+	}
+	if (!self->chunk_size || self->nthreads < 1 || self->nthreads > DEMOD_MAX_STAGES || self->fir_threads < 1) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Save the results of an autotune run, creating the parent directories if
+ * needed. Like checkpoints, the file is written under a temporary name and then
+ * renamed into place */
+int
+wisdom_save(const Wisdom *self, const char *fname)
+{
+	FILE *fd;
+	char *tmp_fname;
+	unsigned i;
+	int err;
+
+	if (mkdir_parents(fname)) {
+		return -1;
+	}
+
+	tmp_fname = safealloc(strlen(fname) + sizeof(".tmp"));
+	sprintf(tmp_fname, "%s.tmp", fname);
+
+	if (!(fd = fopen(tmp_fname, "w"))) {
+		free(tmp_fname);
+		return -1;
+	}
+
+	fprintf(fd, "# meteor_demod wisdom, written by --autotune\n");
+	fprintf(fd, "host %s\n", self->host);
+	fprintf(fd, "cpu %s\n", self->cpu);
+	fprintf(fd, "chunk %u\n", self->chunk_size);
+	fprintf(fd, "threads %u\n", self->nthreads);
+	fprintf(fd, "fir-threads %u\n", self->fir_threads);
+	fprintf(fd, "# RRC order, oversampling, input samples per second\n");
+	for (i=0; i<self->nrates; i++) {
+		fprintf(fd, "rate %u %u %.0f\n", self->rates[i].order, self->rates[i].factor, self->rates[i].rate);
+	}
+	err = ferror(fd);
+	err |= fclose(fd) != 0;
+
+	if (!err) {
+		err = rename(tmp_fname, fname);
+	}
+	if (err) {
+		remove(tmp_fname);
+	}
+
+	free(tmp_fname);
+	return err ? -1 : 0;
+}
+
+/* Find the most expensive filter configuration that can process at least
+ * $min_rate input samples per second. A non-zero $order or $factor restricts
+ * the search to that RRC order or oversampling factor. If nothing is fast
+ * enough, returns the fastest candidate, and NULL if there are no candidates */
+const WisdomRate*
+wisdom_pick(const Wisdom *self, double min_rate, unsigned order, unsigned factor)
+{
+	const WisdomRate *r, *best, *fastest;
+	unsigned i;
+
+	best = NULL;
+	fastest = NULL;
+	for (i=0; i<self->nrates; i++) {
+		r = &self->rates[i];
+		if ((order && r->order != order) || (factor && r->factor != factor)) {
+			continue;
+		}
+		if (!fastest || r->rate > fastest->rate) {
+			fastest = r;
+		}
+		if (r->rate >= min_rate && (!best || wisdom_better(r, best))) {
+			best = r;
+		}
+	}
+
+	return best ? best : fastest;
+}
+
+/* Static functions {{{ */
+/* Time a demodulator with the given settings, and return the number of input
+ * samples it processed per second */
+double
+autotune_measure(const DemodParams *params, Source *src)
+{
+	Demod *demod;
+	uint64_t start, now, count;
+	double rate, best;
+	unsigned i;
+
+	demod = demod_init(src, params);
+	demod_set_sink(demod, autotune_discard, NULL);
+
+	for (i=0; i<AUTOTUNE_WARMUP; i++) {
+		demod_step(demod);
+	}
+
+	best = 0;
+	for (i=0; i<AUTOTUNE_REPS; i++) {
+		count = 0;
+		start = get_time_ns();
+		do {
+			count += demod_step(demod);
+			now = get_time_ns();
+		} while (now - start < AUTOTUNE_WINDOW_NS);
+
+		rate = count / (double)params->interp_factor / ((now - start) * 1e-9);
+		if (rate > best) {
+			best = rate;
+		}
+	}
+
+	demod_free(demod);
+	return best;
+}
+
+void
+autotune_discard(const int8_t *syms, size_t len, void *ctx)
+{
+	(void)syms;
+	(void)len;
+	(void)ctx;
+}
+
+/* A QPSK signal with some noise, repeated forever */
+Source*
+loopsrc_init(unsigned samplerate, unsigned sym_rate)
+{
+	Source *src;
+	LoopState *state;
+	float complex sym;
+	uint64_t rng;
+	size_t i;
+
+	src = safealloc(sizeof(*src));
+
+	src->count = 0;
+	src->bps = sizeof(*src->data);
+	src->samplerate = samplerate;
+	src->data = NULL;
+	src->read = loopsrc_read;
+	src->close = loopsrc_close;
+	src->size = loopsrc_get_size;
+	src->done = loopsrc_get_done;
+	src->seek = NULL;
+
+	src->_backend = safealloc(sizeof(LoopState));
+	state = (LoopState*)src->_backend;
+	state->len = (size_t)samplerate * AUTOTUNE_SIGNAL_SECS;
+	state->buf = safealloc(sizeof(*state->buf) * state->len);
+	state->pos = 0;
+	state->samples_read = 0;
+
+	rng = 1;
+	sym = 0;
+	for (i=0; i<state->len; i++) {
+		if (i == 0 || (i * sym_rate / samplerate) != ((i-1) * sym_rate / samplerate)) {
+			sym = ((loopsrc_rand(&rng) & 1) ? 1 : -1) + ((loopsrc_rand(&rng) & 1) ? I : -I);
+		}
+		state->buf[i] = 64 * sym + 16 * ((loopsrc_rand(&rng) / 4294967296.0 - 0.5) +
+		                                 I * (loopsrc_rand(&rng) / 4294967296.0 - 0.5));
+	}
+
+	return src;
+}
+
+int
+loopsrc_read(Source *self, size_t count)
+{
+	LoopState *state;
+	size_t i, n;
+
+	state = (LoopState*)self->_backend;
+
+	if (!self->data) {
+		self->data = safealloc(sizeof(*self->data) * count);
+	} else if (self->count < count) {
+		free(self->data);
+		self->data = safealloc(sizeof(*self->data) * count);
+	}
+	self->count = count;
+
+	for (i=0; i<count; i += n) {
+		n = state->len - state->pos;
+		n = (n < count - i) ? n : count - i;
+		memcpy(self->data + i, state->buf + state->pos, sizeof(*self->data) * n);
+		state->pos = (state->pos + n) % state->len;
+	}
+	state->samples_read += count;
+
+	return count;
+}
+
+uint64_t
+loopsrc_get_size(const Source *self)
+{
+	(void)self;
+	return 0;
+}
+
+/* xorshift64*, so that the signal doesn't depend on (or disturb) the state of
+ * rand() */
+uint32_t
+loopsrc_rand(uint64_t *rng)
+{
+	*rng ^= *rng >> 12;
+	*rng ^= *rng << 25;
+	*rng ^= *rng >> 27;
+	return (*rng * 0x2545F4914F6CDD1DULL) >> 32;
+}
+
+uint64_t
+loopsrc_get_done(const Source *self)
+{
+	const LoopState *state = self->_backend;
+	return state->samples_read;
+}
+
+int
+loopsrc_close(Source *self)
+{
+	LoopState *state;
+
+	state = (LoopState*)self->_backend;
+	free(state->buf);
+	free(state);
+	free(self->data);
+	free(self);
+	return 0;
+}
+
+/* The filter does about order*factor multiply-adds per input sample: that's
+ * what better settings cost. On a tie, prefer the longer filter */
+int
+wisdom_better(const WisdomRate *a, const WisdomRate *b)
+{
+	unsigned cost_a, cost_b;
+
+	cost_a = a->order * a->factor;
+	cost_b = b->order * b->factor;
+	return cost_a > cost_b || (cost_a == cost_b && a->order > b->order);
+}
+
+/* Create the directories leading to $fname */
+int
+mkdir_parents(const char *fname)
+{
+	char *path, *sep;
+	int err;
+
+	path = safealloc(strlen(fname) + 1);
+	strcpy(path, fname);
+
+	err = 0;
+	for (sep = strchr(path+1, '/'); sep && !err; sep = strchr(sep+1, '/')) {
+		*sep = '\0';
+		err = mkdir(path, 0755) && errno != EEXIST;
+		*sep = '/';
+	}
+
+	free(path);
+	return err ? -1 : 0;
+}
+/*}}}*/
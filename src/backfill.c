@@ -0,0 +1,359 @@
+#include <string.h>
+#include "align.h"
+#include "backfill.h"
+#include "utils.h"
+
+/* Size of the window used to line up the two passes, and how far from the end
+ * of the history it is taken. The forward pass can gain or lose symbols while
+ * acquiring, so the window is looked for within a fraction of the expected
+ * position (ALIGN_SLACK_DIV), but never less than ALIGN_SLACK symbols */
+#define ALIGN_WINSIZE 1024
+#define ALIGN_MARGIN 4096
+#define ALIGN_SLACK 512
+#define ALIGN_SLACK_DIV 64
+#define ALIGN_MIN_SCORE 0.9
+
+static int      tee_read(Source *self, size_t count);
+static int      tee_close(Source *self);
+static uint64_t tee_get_size(const Source *self);
+static uint64_t tee_get_done(const Source *self);
+static void     backfill_sink(const int8_t *syms, size_t len, void *ctx);
+static void     backfill_start(Backfill *self);
+static void*    backfill_thr_run(void *x);
+static void     backfill_splice(Backfill *self);
+static size_t   backward_pass(Backfill *self, int8_t **out);
+static size_t   expected_syms(const Backfill *self, size_t samples);
+
+/* Wrap $src, keeping its first $secs seconds in memory. The demodulator must
+ * read from self->tee */
+Backfill*
+backfill_init(Source *src, const DemodParams *params, float secs)
+{
+	Backfill *ret;
+	Source *tee;
+
+	ret = safealloc(sizeof(*ret));
+	ret->src = src;
+	ret->params = *params;
+	ret->fwd = NULL;
+	ret->out = NULL;
+	ret->out_ctx = NULL;
+	ret->started = 0;
+	ret->ready = 0;
+	ret->done = 0;
+	ret->skipped = 0;
+	ret->recovered = 0;
+	ret->score = 0;
+
+	ret->hist_size = secs * src->samplerate;
+	ret->hist_len = 0;
+	ret->hist = safealloc(sizeof(*ret->hist) * (ret->hist_size ? ret->hist_size : 1));
+
+	ret->hold_size = 2 * (expected_syms(ret, ret->hist_size) + ALIGN_SLACK + SYM_CHUNKSIZE);
+	ret->hold_len = 0;
+	ret->hold = safealloc(ret->hold_size);
+
+	ret->chunk = safealloc(sizeof(*ret->chunk) * CHUNKSIZE);
+	ret->ref = safealloc(2 * ALIGN_WINSIZE);
+	ret->back = NULL;
+	ret->back_len = 0;
+
+	tee = safealloc(sizeof(*tee));
+	tee->count = 0;
+	tee->samplerate = src->samplerate;
+	tee->bps = src->bps;
+	tee->data = NULL;
+	tee->read = tee_read;
+	tee->close = tee_close;
+	tee->size = tee_get_size;
+	tee->done = tee_get_done;
+	tee->seek = NULL;
+	tee->_backend = ret;
+	ret->tee = tee;
+
+	return ret;
+}
+
+/* Intercept the output of $fwd, which must be reading from self->tee. The
+ * symbols are passed on to $out once the beginning has been recovered */
+void
+backfill_attach(Backfill *self, Demod *fwd, DemodSink out, void *out_ctx)
+{
+	self->fwd = fwd;
+	self->out = out;
+	self->out_ctx = out_ctx;
+	self->agc = *fwd->agc;
+	self->cst = *fwd->cst;
+	demod_set_sink(fwd, backfill_sink, self);
+}
+
+/* Write out whatever is still held back, running the backward pass first if
+ * the input ended before the history window was full. Must be called once the
+ * forward demodulator has stopped. Returns 0 if the two passes were spliced
+ * together, -1 if there were too few symbols to run the backward pass, and 1
+ * if the two passes could not be lined up */
+int
+backfill_finish(Backfill *self)
+{
+	if (!self->started) {
+		backfill_start(self);
+	}
+	if (!self->done) {
+		backfill_splice(self);
+	}
+	if (self->skipped) {
+		return -1;
+	}
+	return self->recovered ? 0 : 1;
+}
+
+/* Free the backfill state. Note that this function does not close the
+ * wrapped source */
+void
+backfill_free(Backfill *self)
+{
+	if (self->started && !self->done) {
+		pthread_join(self->t, NULL);
+	}
+	free(self->tee);
+	free(self->hist);
+	free(self->hold);
+	free(self->chunk);
+	free(self->ref);
+	free(self->back);
+	free(self);
+}
+
+/* Static functions {{{ */
+int
+tee_read(Source *self, size_t count)
+{
+	Backfill *state;
+	Source *src;
+	size_t i, n, len;
+	int ret;
+
+	state = (Backfill*)self->_backend;
+	src = state->src;
+
+	ret = src->read(src, count);
+	self->data = src->data;
+	self->count = src->count;
+
+	/* Record the samples while there's room in the history */
+	len = state->hist_len;
+	n = (ret > 0) ? (size_t)ret : 0;
+	if (n > state->hist_size - len) {
+		n = state->hist_size - len;
+	}
+	for (i=0; i<n; i++) {
+		state->hist[len+i] = src->data[i];
+	}
+	__atomic_store_n(&state->hist_len, len+n, __ATOMIC_RELEASE);
+
+	return ret;
+}
+
+uint64_t
+tee_get_size(const Source *self)
+{
+	const Backfill *state = self->_backend;
+	return state->src->size(state->src);
+}
+
+uint64_t
+tee_get_done(const Source *self)
+{
+	const Backfill *state = self->_backend;
+	return state->src->done(state->src);
+}
+
+/* The wrapper is freed by backfill_free() */
+int
+tee_close(Source *self)
+{
+	(void)self;
+	return 0;
+}
+
+/* Hold the forward symbols back until the forward pass has gone past the end
+ * of the history window, then splice in the backward pass */
+void
+backfill_sink(const int8_t *syms, size_t len, void *ctx)
+{
+	Backfill *self;
+	size_t hist_len;
+
+	self = (Backfill*)ctx;
+	if (self->done) {
+		self->out(syms, len, self->out_ctx);
+		return;
+	}
+
+	if (self->hold_len + len > self->hold_size) {
+		self->hold_size = 2 * (self->hold_len + len);
+		self->hold = realloc(self->hold, self->hold_size);
+		if (!self->hold) {
+			fatal("Failed to allocate memory");
+		}
+	}
+	memcpy(self->hold + self->hold_len, syms, len);
+	self->hold_len += len;
+
+	if (!self->started) {
+		/* Keep track of the most recent loop state, to seed the backward
+		 * pass */
+		self->agc = *self->fwd->agc;
+		self->cst = *self->fwd->cst;
+
+		hist_len = __atomic_load_n(&self->hist_len, __ATOMIC_ACQUIRE);
+		if (hist_len == self->hist_size &&
+		    self->hold_len/2 >= expected_syms(self, hist_len) + ALIGN_SLACK) {
+			backfill_start(self);
+		}
+	} else if (__atomic_load_n(&self->ready, __ATOMIC_ACQUIRE)) {
+		backfill_splice(self);
+	}
+}
+
+/* Take the reference window from the forward symbols, and start the backward
+ * pass. The history is complete at this point, and the loop state is no longer
+ * updated, so the thread can read both without locking */
+void
+backfill_start(Backfill *self)
+{
+	size_t expected;
+
+	self->started = 1;
+
+	/* Take the window some distance before the end of the history, so that
+	 * the backward pass has settled */
+	expected = expected_syms(self, self->hist_len);
+	if (expected > self->hold_len/2) {
+		expected = self->hold_len/2;
+	}
+	if (expected < ALIGN_MARGIN + ALIGN_WINSIZE) {
+		self->done = 1;
+		self->skipped = 1;
+		self->out(self->hold, self->hold_len, self->out_ctx);
+		self->hold_len = 0;
+		return;
+	}
+	self->ref_end = expected - ALIGN_MARGIN;
+	memcpy(self->ref, self->hold + 2*(self->ref_end - ALIGN_WINSIZE), 2*ALIGN_WINSIZE);
+
+	self->slack = expected / ALIGN_SLACK_DIV;
+	if (self->slack < ALIGN_SLACK) {
+		self->slack = ALIGN_SLACK;
+	}
+
+	pthread_create(&self->t, NULL, backfill_thr_run, self);
+}
+
+/* Demodulate the history backwards, and line the result up with the reference
+ * window */
+void*
+backfill_thr_run(void *x)
+{
+	Backfill *self;
+	size_t expected, lo, hi;
+
+	self = (Backfill*)x;
+	self->back_len = backward_pass(self, &self->back);
+
+	/* Both passes end at the end of the history window */
+	expected = (self->back_len > ALIGN_MARGIN) ? self->back_len - ALIGN_MARGIN : 0;
+	lo = (expected > self->slack) ? expected - self->slack : 0;
+	hi = (expected + self->slack < self->back_len) ? expected + self->slack : self->back_len;
+	align_find(self->ref, ALIGN_WINSIZE, self->back, lo, hi, &self->res);
+	if (self->res.score >= ALIGN_MIN_SCORE) {
+		soft_rotate(self->back, self->res.end, self->res.rot);
+	}
+
+	__atomic_store_n(&self->ready, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/* Wait for the backward pass, then write out the backward symbols up to the
+ * seam, followed by the forward ones after it */
+void
+backfill_splice(Backfill *self)
+{
+	pthread_join(self->t, NULL);
+	self->done = 1;
+	self->score = self->res.score;
+
+	if (self->res.score >= ALIGN_MIN_SCORE) {
+		self->out(self->back, 2*self->res.end, self->out_ctx);
+		self->out(self->hold + 2*self->ref_end, self->hold_len - 2*self->ref_end, self->out_ctx);
+		self->recovered = self->res.end;
+	} else {
+		self->out(self->hold, self->hold_len, self->out_ctx);
+	}
+
+	free(self->back);
+	self->back = NULL;
+	free(self->hold);
+	self->hold = NULL;
+	self->hold_len = self->hold_size = 0;
+}
+
+/* Run a second demodulator over the time-reversed, conjugated history,
+ * starting from the forward loop state. Conjugating keeps the carrier offset
+ * the same sign, so the Costas loop starts out locked. The output is put back
+ * in forward order and orientation (up to a 90 degrees rotation) in $out */
+size_t
+backward_pass(Backfill *self, int8_t **out)
+{
+	DemodParams params;
+	Demod *back;
+	float complex *chunk;
+	size_t i, n, pos, out_size, out_len;
+	int8_t tmp;
+
+	params = self->params;
+	params.nthreads = 1;
+	back = demod_init_push(self->src->samplerate, &params);
+	*back->agc = self->agc;
+	back->agc->bias = conjf(self->agc.bias);
+	*back->cst = self->cst;
+
+	chunk = self->chunk;
+	out_size = demod_max_output(back, self->hist_len);
+	*out = safealloc(out_size);
+	out_len = 0;
+
+	for (pos=self->hist_len; pos>0; pos-=n) {
+		n = (pos < CHUNKSIZE) ? pos : CHUNKSIZE;
+		for (i=0; i<n; i++) {
+			chunk[i] = conjf(self->hist[pos-1-i]);
+		}
+		out_len += demod_push(back, chunk, n, *out + out_len, out_size - out_len);
+	}
+	demod_free(back);
+
+	/* Reverse the symbol order, and undo the conjugation */
+	out_len /= 2;
+	for (i=0; i<out_len/2; i++) {
+		tmp = (*out)[2*i];
+		(*out)[2*i] = (*out)[2*(out_len-1-i)];
+		(*out)[2*(out_len-1-i)] = tmp;
+		tmp = (*out)[2*i+1];
+		(*out)[2*i+1] = (*out)[2*(out_len-1-i)+1];
+		(*out)[2*(out_len-1-i)+1] = tmp;
+	}
+	soft_mirror(*out, out_len);
+
+	return out_len;
+}
+
+/* Number of symbols the forward pass outputs for the first $samples samples */
+size_t
+expected_syms(const Backfill *self, size_t samples)
+{
+	if (samples < self->params.rrc_order) {
+		return 0;
+	}
+	return (double)(samples - self->params.rrc_order) * self->params.sym_rate / self->src->samplerate;
+}
+/*}}}*/
@@ -0,0 +1,422 @@
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "batch.h"
+#include "utils.h"
+#include "wavfile.h"
+
+typedef struct {
+	pthread_mutex_t mutex;  /* Guards demod, so the UI never reads a freed one */
+	Demod *demod;
+	unsigned file_idx;
+	uint64_t size;
+	unsigned samplerate;
+} BatchSlot;
+
+typedef struct {
+	char **files;
+	char **out_fnames;
+	unsigned count;
+	const char *out_dir;
+	unsigned samplerate;
+	DemodParams params;
+
+	unsigned next;          /* Index of the next file to process */
+	unsigned finished;
+	unsigned failed;
+	double secs_done;       /* Seconds of signal in the completed files */
+	uint64_t samps_done;
+
+	BatchSlot *slots;
+	pthread_t *threads;
+	unsigned nslots;
+
+	pthread_mutex_t mutex;  /* Guards logging and the completion counters */
+	pthread_cond_t file_done;
+	int quiet;
+	int (*log)(const char *msg, ...);
+} Batch;
+
+typedef struct {
+	Batch *batch;
+	BatchSlot *slot;
+} BatchArgs;
+
+static void* batch_worker_run(void *x);
+static void  batch_log(Batch *self, const char *msg, ...);
+static void  batch_print_status(Batch *self, uint64_t elapsed_ns);
+static void  batch_skip(Batch *self, unsigned idx, const char *reason);
+static void  batch_done(Batch *self);
+static char* batch_out_fname(const Batch *self, unsigned idx);
+static void  add_file(Batch *self, const char *fname);
+static void  add_dir(Batch *self, const char *dirname);
+static int   cmp_str(const void *a, const void *b);
+
+/* Demodulate all the files in $inputs (directories are expanded to the files
+ * they contain), writing one output per file into $out_dir. Returns the number
+ * of files that couldn't be processed */
+int
+batch_run(char *const *inputs, unsigned ninputs, const char *out_dir, unsigned samplerate,
+          const DemodParams *params, unsigned jobs, int upd_interval, int quiet,
+          int (*log)(const char *msg, ...))
+{
+	Batch self;
+	BatchArgs *args;
+	pthread_condattr_t attr;
+	struct stat st;
+	struct timespec deadline;
+	uint64_t start_ns, next_ns;
+	unsigned i;
+
+	self.files = NULL;
+	self.count = 0;
+	self.out_dir = out_dir;
+	self.samplerate = samplerate;
+	self.params = *params;
+	self.params.nthreads = 1;
+	self.params.fir_threads = 1;
+	self.next = 0;
+	self.finished = 0;
+	self.failed = 0;
+	self.secs_done = 0;
+	self.samps_done = 0;
+	self.quiet = quiet;
+	self.log = log;
+	pthread_mutex_init(&self.mutex, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&self.file_done, &attr);
+	pthread_condattr_destroy(&attr);
+
+	if (stat(out_dir, &st) || !S_ISDIR(st.st_mode)) {
+		fatal("Output directory does not exist");
+	}
+
+	/* Build the list of files to process */
+	for (i=0; i<ninputs; i++) {
+		if (!stat(inputs[i], &st) && S_ISDIR(st.st_mode)) {
+			add_dir(&self, inputs[i]);
+		} else {
+			add_file(&self, inputs[i]);
+		}
+	}
+	if (!self.count) {
+		fatal("No input files found");
+	}
+
+	if (!jobs) {
+		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	self.nslots = (jobs < self.count) ? jobs : self.count;
+
+	if (!quiet) {
+		splash();
+		batch_log(&self, "Processing %u files with %u workers, output to %s\n", self.count, self.nslots, out_dir);
+	}
+
+	/* Pick the output names upfront, so that two inputs with the same
+	 * basename don't end up writing to the same file */
+	self.out_fnames = safealloc(sizeof(*self.out_fnames) * self.count);
+	for (i=0; i<self.count; i++) {
+		self.out_fnames[i] = batch_out_fname(&self, i);
+	}
+
+	/* Spawn the workers */
+	start_ns = get_time_ns();
+	self.slots = safealloc(sizeof(*self.slots) * self.nslots);
+	self.threads = safealloc(sizeof(*self.threads) * self.nslots);
+	for (i=0; i<self.nslots; i++) {
+		pthread_mutex_init(&self.slots[i].mutex, NULL);
+		self.slots[i].demod = NULL;
+
+		args = safealloc(sizeof(*args));
+		args->batch = &self;
+		args->slot = &self.slots[i];
+		pthread_create(&self.threads[i], NULL, batch_worker_run, args);
+	}
+
+	/* Status update loop, woken up early when the last file is done */
+	next_ns = start_ns;
+	pthread_mutex_lock(&self.mutex);
+	while (self.finished < self.count) {
+		next_ns += upd_interval*1000000ULL;
+		deadline.tv_sec = next_ns / 1000000000ULL;
+		deadline.tv_nsec = next_ns % 1000000000ULL;
+		while (self.finished < self.count &&
+		       pthread_cond_timedwait(&self.file_done, &self.mutex, &deadline) != ETIMEDOUT)
+			;
+		if (!quiet && self.finished < self.count) {
+			pthread_mutex_unlock(&self.mutex);
+			batch_print_status(&self, get_time_ns() - start_ns);
+			pthread_mutex_lock(&self.mutex);
+		}
+	}
+	pthread_mutex_unlock(&self.mutex);
+
+	for (i=0; i<self.nslots; i++) {
+		pthread_join(self.threads[i], NULL);
+		pthread_mutex_destroy(&self.slots[i].mutex);
+	}
+
+	if (!quiet) {
+		batch_print_status(&self, get_time_ns() - start_ns);
+		batch_log(&self, "Batch completed, %u/%u files processed\n", self.count - self.failed, self.count);
+	}
+
+	for (i=0; i<self.count; i++) {
+		free(self.files[i]);
+		free(self.out_fnames[i]);
+	}
+	free(self.files);
+	free(self.out_fnames);
+	free(self.slots);
+	free(self.threads);
+	pthread_cond_destroy(&self.file_done);
+	pthread_mutex_destroy(&self.mutex);
+
+	return self.failed;
+}
+
+/* Static functions {{{ */
+/* Worker thread: keep grabbing files from the list until there are none left */
+void*
+batch_worker_run(void *x)
+{
+	BatchArgs *args;
+	Batch *self;
+	BatchSlot *slot;
+	Source *src;
+	Demod *demod;
+	DemodStats stats;
+	FILE *out_fd;
+	const char *out_fname, *err;
+	unsigned idx;
+	uint64_t start_ns;
+	float elapsed;
+
+	args = (BatchArgs*)x;
+	self = args->batch;
+	slot = args->slot;
+	free(args);
+
+	while ((idx = __atomic_fetch_add(&self->next, 1, __ATOMIC_RELAXED)) < self->count) {
+		/* A bad input only costs its own output */
+		if (!(src = try_open_samples_file(self->files[idx], self->samplerate, &err))) {
+			batch_skip(self, idx, err);
+			continue;
+		}
+		out_fname = self->out_fnames[idx];
+		if (!(out_fd = fopen(out_fname, "w"))) {
+			src->close(src);
+			batch_skip(self, idx, "Could not open the output file");
+			continue;
+		}
+
+		demod = demod_init(src, &self->params);
+		demod_set_sink(demod, demod_file_sink, out_fd);
+
+		pthread_mutex_lock(&slot->mutex);
+		slot->demod = demod;
+		slot->file_idx = idx;
+		slot->size = demod_get_size(demod);
+		slot->samplerate = src->samplerate;
+		pthread_mutex_unlock(&slot->mutex);
+
+		start_ns = get_time_ns();
+		demod_run(demod, NULL);
+		elapsed = (get_time_ns() - start_ns) / 1e9;
+		demod_get_stats(demod, &stats);
+
+		pthread_mutex_lock(&slot->mutex);
+		slot->demod = NULL;
+		pthread_mutex_unlock(&slot->mutex);
+
+		demod_free(demod);
+		src->close(src);
+		if (fclose(out_fd)) {
+			batch_skip(self, idx, "Could not write the output file");
+			continue;
+		}
+
+		pthread_mutex_lock(&self->mutex);
+		self->secs_done += (double)stats.in_done / slot->samplerate;
+		self->samps_done += stats.in_done;
+		pthread_mutex_unlock(&self->mutex);
+
+		if (!self->quiet) {
+			batch_log(self, "[%u/%u] %s -> %s done in %.1fs (%.1fx real time)\n",
+			          idx+1, self->count, self->files[idx], out_fname, elapsed,
+			          elapsed > 0 ? stats.in_done / (float)slot->samplerate / elapsed : 0);
+		}
+
+		batch_done(self);
+	}
+
+	return NULL;
+}
+
+/* Print the progress of each worker, and the aggregate throughput */
+void
+batch_print_status(Batch *self, uint64_t elapsed_ns)
+{
+	BatchSlot *slot;
+	DemodStats stats;
+	double secs;
+	uint64_t samps;
+	unsigned i;
+
+	pthread_mutex_lock(&self->mutex);
+	secs = self->secs_done;
+	samps = self->samps_done;
+	pthread_mutex_unlock(&self->mutex);
+
+	for (i=0; i<self->nslots; i++) {
+		slot = &self->slots[i];
+		pthread_mutex_lock(&slot->mutex);
+		if (slot->demod) {
+			demod_get_stats(slot->demod, &stats);
+			secs += (double)stats.in_done / slot->samplerate;
+			samps += stats.in_done;
+			batch_log(self, "[%u/%u] %s: %5.1f%%, Carrier: %+7.1f Hz, Locked: %s\n",
+			          slot->file_idx+1, self->count, self->files[slot->file_idx],
+			          slot->size ? (float)stats.in_done/slot->size*100 : 0,
+			          stats.freq, stats.pll_locked ? "Yes" : "No");
+		}
+		pthread_mutex_unlock(&slot->mutex);
+	}
+
+	batch_log(self, "%u/%u files done, throughput: %.2f Msamples/s (%.1fx real time)\n",
+	          __atomic_load_n(&self->finished, __ATOMIC_ACQUIRE), self->count,
+	          samps / (elapsed_ns / 1e3), secs / (elapsed_ns / 1e9));
+}
+
+/* Thread-safe wrapper around the log function */
+void
+batch_log(Batch *self, const char *msg, ...)
+{
+	char buf[512];
+	va_list ap;
+
+	va_start(ap, msg);
+	vsnprintf(buf, sizeof(buf), msg, ap);
+	va_end(ap);
+
+	pthread_mutex_lock(&self->mutex);
+	self->log("%s", buf);
+	pthread_mutex_unlock(&self->mutex);
+}
+
+/* Count a file as failed, and move on to the next one */
+void
+batch_skip(Batch *self, unsigned idx, const char *reason)
+{
+	batch_log(self, "[%u/%u] Skipping %s: %s\n", idx+1, self->count, self->files[idx], reason);
+	pthread_mutex_lock(&self->mutex);
+	self->failed++;
+	pthread_mutex_unlock(&self->mutex);
+	batch_done(self);
+}
+
+/* Count a file as finished, and wake up the status loop */
+void
+batch_done(Batch *self)
+{
+	pthread_mutex_lock(&self->mutex);
+	__atomic_add_fetch(&self->finished, 1, __ATOMIC_RELEASE);
+	pthread_cond_signal(&self->file_done);
+	pthread_mutex_unlock(&self->mutex);
+}
+
+/* Build the output filename of the $idx-th file: the input basename, with a .s
+ * extension, inside the output directory. If one of the previous files already
+ * got that name, a _2, _3... suffix is added */
+char*
+batch_out_fname(const Batch *self, unsigned idx)
+{
+	const char *base, *ext;
+	char *ret;
+	size_t len, base_len;
+	unsigned i, n;
+
+	base = strrchr(self->files[idx], '/');
+	base = base ? base+1 : self->files[idx];
+	ext = strrchr(base, '.');
+	base_len = (ext && ext != base) ? (size_t)(ext - base) : strlen(base);
+
+	len = strlen(self->out_dir) + 1 + base_len + sizeof("_4294967295.s");
+	ret = safealloc(len);
+	snprintf(ret, len, "%s/%.*s.s", self->out_dir, (int)base_len, base);
+
+	for (n=2; ; n++) {
+		for (i=0; i<idx && strcmp(ret, self->out_fnames[i]); i++)
+			;
+		if (i == idx) {
+			break;
+		}
+		snprintf(ret, len, "%s/%.*s_%u.s", self->out_dir, (int)base_len, base, n);
+	}
+	if (n > 2 && !self->quiet) {
+		self->log("%s would overwrite another output, writing to %s instead\n", self->files[idx], ret);
+	}
+
+	return ret;
+}
+
+void
+add_file(Batch *self, const char *fname)
+{
+	self->files = realloc(self->files, sizeof(*self->files) * (self->count+1));
+	if (!self->files) {
+		fatal("Failed to allocate block");
+	}
+	self->files[self->count] = safealloc(strlen(fname)+1);
+	strcpy(self->files[self->count], fname);
+	self->count++;
+}
+
+/* Add all the regular files inside a directory, sorted by name */
+void
+add_dir(Batch *self, const char *dirname)
+{
+	DIR *dir;
+	struct dirent *entry;
+	struct stat st;
+	char *path;
+	unsigned first;
+	size_t len;
+
+	if (!(dir = opendir(dirname))) {
+		return;
+	}
+
+	first = self->count;
+	while ((entry = readdir(dir))) {
+		if (entry->d_name[0] == '.') {
+			continue;
+		}
+
+		len = strlen(dirname) + strlen(entry->d_name) + 2;
+		path = safealloc(len);
+		snprintf(path, len, "%s/%s", dirname, entry->d_name);
+		if (!stat(path, &st) && S_ISREG(st.st_mode)) {
+			add_file(self, path);
+		}
+		free(path);
+	}
+	closedir(dir);
+
+	qsort(self->files + first, self->count - first, sizeof(*self->files), cmp_str);
+}
+
+int
+cmp_str(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+/*}}}*/
@@ -0,0 +1,234 @@
+#include <string.h>
+#include "cadu.h"
+#include "rs.h"
+#include "utils.h"
+
+/* Symbols decoded past the end of each frame to settle the Viterbi traceback */
+#define TAIL_SYMS 256
+
+#define RS_DEPTH 4
+
+static void cadu_process(CaduDecoder *self);
+static void cadu_decode_frame(CaduDecoder *self);
+static void cadu_discard(CaduDecoder *self, size_t nsyms);
+static void cadu_count(uint64_t *counter, uint64_t value);
+
+/* Initialize a decoder writing verified CADUs to $out_fd. The soft symbols are
+ * passed on unchanged to $next, if not NULL */
+CaduDecoder*
+cadu_init(FILE *out_fd, DemodSink next, void *next_ctx)
+{
+	CaduDecoder *ret;
+
+	ret = safealloc(sizeof(*ret));
+	ret->out_fd = out_fd;
+	ret->next = next;
+	ret->next_ctx = next_ctx;
+
+	correlator_init(&ret->corr);
+	ret->vit = viterbi_init(CADU_SYMS + TAIL_SYMS);
+
+	ret->size = 2 * 2 * (CADU_SYMS + TAIL_SYMS);
+	ret->len = 0;
+	ret->buf = safealloc(ret->size);
+	ret->frame_syms = safealloc(2 * (CADU_SYMS + TAIL_SYMS));
+
+	cadu_gen_pn(ret->pn, sizeof(ret->pn));
+
+	ret->locked = 0;
+	ret->state = 0;
+	ret->misses = 0;
+	memset(&ret->stats, 0, sizeof(ret->stats));
+
+	return ret;
+}
+
+/* DemodSink: consume $len bytes of soft symbols */
+void
+cadu_sink(const int8_t *syms, size_t len, void *ctx)
+{
+	CaduDecoder *self;
+	size_t n;
+
+	self = (CaduDecoder*)ctx;
+	if (self->next) {
+		self->next(syms, len, self->next_ctx);
+	}
+
+	while (len > 0) {
+		n = self->size - self->len;
+		if (n > len) {
+			n = len;
+		}
+		memcpy(self->buf + self->len, syms, n);
+		self->len += n;
+		syms += n;
+		len -= n;
+
+		cadu_process(self);
+	}
+}
+
+/* Get a snapshot of the counters. Can be called from any thread */
+void
+cadu_get_stats(const CaduDecoder *self, CaduStats *stats)
+{
+	stats->frames = __atomic_load_n(&self->stats.frames, __ATOMIC_RELAXED);
+	stats->ok = __atomic_load_n(&self->stats.ok, __ATOMIC_RELAXED);
+	stats->rs_fixed = __atomic_load_n(&self->stats.rs_fixed, __ATOMIC_RELAXED);
+	stats->slips = __atomic_load_n(&self->stats.slips, __ATOMIC_RELAXED);
+	stats->sync_lost = __atomic_load_n(&self->stats.sync_lost, __ATOMIC_RELAXED);
+}
+
+/* Generate $len bytes of the CCSDS pseudo-random sequence,
+ * h(x) = x^8 + x^7 + x^5 + x^3 + 1 */
+void
+cadu_gen_pn(uint8_t *pn, size_t len)
+{
+	unsigned sr, j;
+	size_t i;
+	int bit;
+
+	sr = 0xFF;
+	for (i=0; i<len; i++) {
+		pn[i] = 0;
+		for (j=0; j<8; j++) {
+			bit = sr & 1;
+			pn[i] = (pn[i] << 1) | bit;
+			sr = (sr >> 1) | ((bit ^ (sr >> 3) ^ (sr >> 5) ^ (sr >> 7)) & 1) << 7;
+		}
+	}
+}
+
+/* Free the decoder. Symbols belonging to an incomplete frame are dropped */
+void
+cadu_free(CaduDecoder *self)
+{
+	viterbi_free(self->vit);
+	free(self->buf);
+	free(self->frame_syms);
+	free(self);
+}
+
+/* Static functions {{{ */
+/* Look for the sync marker, and decode every complete frame in the buffer */
+void
+cadu_process(CaduDecoder *self)
+{
+	size_t nsyms, i;
+	int err, state;
+
+	for (;;) {
+		nsyms = self->len / 2;
+
+		/* Look for the marker in every state */
+		if (!self->locked) {
+			for (i=0; i+ASM_SYMS <= nsyms; i++) {
+				if (correlator_best(&self->corr, self->buf + 2*i, &state) <= ASM_SEARCH_ERRORS) {
+					self->locked = 1;
+					self->state = state;
+					self->misses = 0;
+					break;
+				}
+			}
+			cadu_discard(self, i);
+			if (!self->locked) {
+				return;
+			}
+			nsyms = self->len / 2;
+		}
+
+		if (nsyms < CADU_SYMS + TAIL_SYMS) {
+			return;
+		}
+
+		/* Check that the marker is still where it should be. If it shows
+		 * up in a different state, the carrier loop has slipped */
+		err = correlator_match(&self->corr, self->buf, self->state);
+		if (err > ASM_TRACK_ERRORS) {
+			if (correlator_best(&self->corr, self->buf, &state) <= ASM_SEARCH_ERRORS) {
+				self->state = state;
+				self->misses = 0;
+				cadu_count(&self->stats.slips, 1);
+			} else if (++self->misses > ASM_MAX_MISSES) {
+				self->locked = 0;
+				cadu_count(&self->stats.sync_lost, 1);
+				cadu_discard(self, 1);
+				continue;
+			}
+		} else {
+			self->misses = 0;
+		}
+
+		/* Decode the frame even if the marker is missing: the RS check
+		 * will tell whether it was worth it */
+		cadu_decode_frame(self);
+		cadu_discard(self, CADU_SYMS);
+	}
+}
+
+/* Decode the frame at the beginning of the buffer, and write it out if it
+ * passes the RS check */
+void
+cadu_decode_frame(CaduDecoder *self)
+{
+	uint8_t *frame;
+	unsigned i;
+	int ret, fixed, ok;
+
+	memcpy(self->frame_syms, self->buf, 2 * (CADU_SYMS + TAIL_SYMS));
+	correlator_fix(self->frame_syms, CADU_SYMS + TAIL_SYMS, self->state);
+
+	frame = self->frame;
+	viterbi_decode(self->vit, self->frame_syms, CADU_SYMS + TAIL_SYMS, frame, 8*CADU_LEN);
+
+	/* The first few bits of the marker depend on the previous frame, so
+	 * just put back the known value */
+	frame[0] = (ASM_WORD >> 24) & 0xFF;
+	frame[1] = (ASM_WORD >> 16) & 0xFF;
+	frame[2] = (ASM_WORD >> 8) & 0xFF;
+	frame[3] = ASM_WORD & 0xFF;
+
+	for (i=0; i<sizeof(self->pn); i++) {
+		frame[4+i] ^= self->pn[i];
+	}
+
+	/* The RS codewords are interleaved byte by byte */
+	ok = 1;
+	fixed = 0;
+	for (i=0; i<RS_DEPTH; i++) {
+		ret = rs_decode(frame + 4 + i, RS_DEPTH);
+		if (ret < 0) {
+			ok = 0;
+			break;
+		}
+		fixed += ret;
+	}
+
+	cadu_count(&self->stats.frames, 1);
+	if (ok) {
+		fwrite(frame, CADU_LEN, 1, self->out_fd);
+		cadu_count(&self->stats.ok, 1);
+		cadu_count(&self->stats.rs_fixed, fixed);
+	}
+}
+
+/* Drop the first $nsyms symbols from the buffer */
+void
+cadu_discard(CaduDecoder *self, size_t nsyms)
+{
+	if (!nsyms) {
+		return;
+	}
+	self->len -= 2*nsyms;
+	memmove(self->buf, self->buf + 2*nsyms, self->len);
+}
+
+/* The counters are only written by the decoding thread, but may be read by
+ * another one */
+void
+cadu_count(uint64_t *counter, uint64_t value)
+{
+	__atomic_store_n(counter, *counter + value, __ATOMIC_RELAXED);
+}
+/*}}}*/
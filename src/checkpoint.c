@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "checkpoint.h"
+#include "utils.h"
+
+#define CHECKPOINT_MAGIC "MDCK"
+#define CHECKPOINT_VERSION 1
+
+typedef struct {
+	char magic[4];
+	uint32_t version;
+	uint32_t state_size;
+} CheckpointHeader;
+
+static void checkpoint_header(CheckpointHeader *hdr);
+
+/* Save a demodulator state to $fname. The checkpoint is written to a temporary
+ * file first and then renamed, so that a crash while saving never leaves a
+ * truncated checkpoint behind */
+int
+checkpoint_write(const char *fname, const DemodState *state)
+{
+	CheckpointHeader hdr;
+	FILE *fd;
+	char *tmp_fname;
+	int err;
+
+	tmp_fname = safealloc(strlen(fname) + sizeof(".tmp"));
+	sprintf(tmp_fname, "%s.tmp", fname);
+
+	if (!(fd = fopen(tmp_fname, "w"))) {
+		free(tmp_fname);
+		return -1;
+	}
+
+	checkpoint_header(&hdr);
+	err = fwrite(&hdr, sizeof(hdr), 1, fd) != 1;
+	err |= fwrite(state, sizeof(*state), 1, fd) != 1;
+	err |= fwrite(state->filter_mem, sizeof(*state->filter_mem), state->filter_len, fd) != state->filter_len;
+	err |= fclose(fd) != 0;
+
+	if (!err) {
+		err = rename(tmp_fname, fname);
+	}
+	if (err) {
+		remove(tmp_fname);
+	}
+
+	free(tmp_fname);
+	return err ? -1 : 0;
+}
+
+/* Load a demodulator state from $fname. On success, state->filter_mem is
+ * allocated and must be freed by the caller */
+int
+checkpoint_read(const char *fname, DemodState *state)
+{
+	CheckpointHeader hdr, expected;
+	FILE *fd;
+
+	if (!(fd = fopen(fname, "r"))) {
+		return -1;
+	}
+
+	checkpoint_header(&expected);
+	if (fread(&hdr, sizeof(hdr), 1, fd) != 1 || memcmp(&hdr, &expected, sizeof(hdr)) ||
+	    fread(state, sizeof(*state), 1, fd) != 1) {
+		fclose(fd);
+		return -1;
+	}
+
+	state->filter_mem = safealloc(sizeof(*state->filter_mem) * state->filter_len);
+	if (fread(state->filter_mem, sizeof(*state->filter_mem), state->filter_len, fd) != state->filter_len) {
+		free(state->filter_mem);
+		fclose(fd);
+		return -1;
+	}
+
+	fclose(fd);
+	return 0;
+}
+
+/* Static functions {{{ */
+void
+checkpoint_header(CheckpointHeader *hdr)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, CHECKPOINT_MAGIC, sizeof(hdr->magic));
+	hdr->version = CHECKPOINT_VERSION;
+	hdr->state_size = sizeof(DemodState);
+}
+/*}}}*/
@@ -0,0 +1,99 @@
+#include <assert.h>
+#include "align.h"
+#include "correlator.h"
+#include "viterbi.h"
+
+/* The first encoder outputs of the marker also depend on the last bits of the
+ * previous frame, so they are left out of the comparison */
+#define ASM_UNKNOWN_SYMS (VITERBI_K-1)
+
+static uint64_t pack(const int8_t *syms);
+
+/* Encode the sync marker, and precompute how it looks in each state */
+void
+correlator_init(Correlator *self)
+{
+	int8_t syms[2*ASM_SYMS], tmp[2*ASM_SYMS];
+	uint64_t enc;
+	unsigned reg;
+	int i, k, out;
+
+	reg = 0;
+	enc = 0;
+	for (i=0; i<ASM_SYMS; i++) {
+		out = conv_encode(&reg, (ASM_WORD >> (ASM_SYMS-1-i)) & 1);
+		enc = (enc << 2) | out;
+		syms[2*i] = (out & 2) ? -1 : 1;
+		syms[2*i+1] = (out & 1) ? -1 : 1;
+	}
+	assert(enc == ~ASM_ENCODED);
+
+	for (k=0; k<ASM_STATES; k++) {
+		for (i=0; i<2*ASM_SYMS; i++) {
+			tmp[i] = syms[i];
+		}
+		if (k >= 4) {
+			soft_mirror(tmp, ASM_SYMS);
+		}
+		soft_rotate(tmp, ASM_SYMS, k);
+		self->pattern[k] = pack(tmp);
+	}
+	assert(self->pattern[0] == ASM_ENCODED);
+
+	self->mask = ~0ULL >> (2*ASM_UNKNOWN_SYMS);
+}
+
+/* Count the bits that differ between the marker in state $state and the
+ * $ASM_SYMS symbols starting at $syms */
+int
+correlator_match(const Correlator *self, const int8_t *syms, int state)
+{
+	return __builtin_popcountll((pack(syms) ^ self->pattern[state]) & self->mask);
+}
+
+/* Find the state in which the symbols starting at $syms are the closest to the
+ * marker. Returns the number of differing bits */
+int
+correlator_best(const Correlator *self, const int8_t *syms, int *state)
+{
+	uint64_t word;
+	int k, err, best;
+
+	word = pack(syms);
+	best = 2*ASM_SYMS + 1;
+	for (k=0; k<ASM_STATES; k++) {
+		err = __builtin_popcountll((word ^ self->pattern[k]) & self->mask);
+		if (err < best) {
+			best = err;
+			*state = k;
+		}
+	}
+
+	return best;
+}
+
+/* Bring symbols received in state $state back to the canonical orientation */
+void
+correlator_fix(int8_t *syms, size_t count, int state)
+{
+	soft_rotate(syms, count, 4 - (state & 3));
+	if (state >= 4) {
+		soft_mirror(syms, count);
+	}
+}
+
+/* Static functions {{{ */
+/* Hard decisions of $ASM_SYMS symbols, first symbol in the MSBs */
+uint64_t
+pack(const int8_t *syms)
+{
+	uint64_t word;
+	int i;
+
+	word = 0;
+	for (i=0; i<2*ASM_SYMS; i++) {
+		word = (word << 1) | (syms[i] > 0);
+	}
+	return word;
+}
+/*}}}*/
@@ -2,50 +2,438 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "checkpoint.h"
 #include "demod.h"
 #include "interpolator.h"
+#include "memsrc.h"
+#include "pipe.h"
+#include "probes.h"
 #include "utils.h"
 #include "wavfile.h"
 
+/* Range of the SNR estimate, in dB */
+#define SNR_MIN_DB -10
+#define SNR_MAX_DB 40
+
+/* Lag monitor: time to wait after a step down before taking another one, time
+ * spent caught up before stepping back up, and the smallest RRC order used */
+#define LAG_DOWN_HOLD_NS 2000000000ULL
+#define LAG_UP_HOLD_NS 30000000000ULL
+#define LAG_MIN_ORDER 8
+
 typedef struct {
 	Demod *self;
 	const char *out_fname;
 } ThrArgs;
 
+typedef struct {
+	int8_t *buf;
+	size_t size, len;
+	size_t dropped;
+	DemodSink fallback;
+	void *fallback_ctx;
+} BufSink;
+
 static void* demod_thr_run(void* args);
+static void  demod_process(Demod *self, const float complex *data, int count);
+static void  demod_track(Demod *self, int count, float *evm_abs, float *evm_pow);
+static void  demod_measure(Demod *self, const int8_t *syms, const uint8_t *locked, unsigned count);
+static void  demod_update_snr(Demod *self);
+static void  demod_monitor_lag(Demod *self);
+static void  demod_set_level(Demod *self, unsigned level);
+static void  demod_level_params(const Demod *self, unsigned level, unsigned *order, unsigned *factor);
+static void  buf_sink(const int8_t *syms, size_t len, void *ctx);
+static void  demod_checkpoint(Demod *self);
+static void  demod_notify(Demod *self, unsigned events);
+static void  demod_publish_stats(Demod *self, const DemodStats *stats);
+static void  demod_update_util(const Demod *self, DemodStats *stats, uint64_t wall_ns);
+static void  demod_update_prof(const Demod *self, DemodStats *stats);
 
+/* Initialize the demodulator. With nthreads > 1 the processing is split into
+ * stages (input, filter, sync) running on separate threads, each one pinned to
+ * its own core */
 Demod*
-demod_init(Source *src, unsigned interp_mult, unsigned rrc_order, float rrc_alpha, float pll_bw, unsigned sym_rate)
+demod_init(Source *src, const DemodParams *params)
 {
 	Demod *ret;
+	unsigned i;
+	unsigned interp_mult, rrc_order, sym_rate;
+	float pll_bw;
+
+	interp_mult = params->interp_factor;
+	rrc_order = params->rrc_order;
+	sym_rate = params->sym_rate;
 
 	ret = safealloc(sizeof(*ret));
 
 	ret->src = src;
+	ret->params = *params;
+	ret->nstages = params->nthreads;
+	if (ret->nstages < 1) {
+		ret->nstages = 1;
+	} else if (ret->nstages > DEMOD_MAX_STAGES) {
+		ret->nstages = DEMOD_MAX_STAGES;
+	}
+	for (i=0; i<DEMOD_MAX_STAGES-1; i++) {
+		ret->pipes[i] = NULL;
+	}
+
+	/* Chunks hold a whole number of input samples */
+	ret->chunk_size = params->chunk_size ? params->chunk_size : CHUNKSIZE;
+	ret->chunk_size -= ret->chunk_size % interp_mult;
+	if (ret->chunk_size < interp_mult) {
+		ret->chunk_size = interp_mult;
+	}
 
 	/* Initialize the AGC */
 	ret->agc = agc_init();
 
-	/* Initialize the interpolator, associating raw_samp to it */
-	ret->interp = interp_init(src, rrc_alpha, rrc_order, interp_mult, sym_rate);
+	/* Initialize the interpolator, associating raw_samp to it. If there are
+	 * enough threads, read and convert the raw samples on a separate one */
+	if (ret->nstages > 1) {
+		ret->pipes[0] = pipe_init(src, ret->chunk_size/interp_mult, 0);
+		ret->interp = interp_init(ret->pipes[0], params->rrc_alpha, rrc_order, interp_mult, sym_rate, params->fir_threads);
+	} else {
+		ret->interp = interp_init(src, params->rrc_alpha, rrc_order, interp_mult, sym_rate, params->fir_threads);
+	}
+
+	/* Move the filter to its own thread as well, if requested */
+	if (ret->nstages > 2) {
+		ret->pipes[1] = pipe_init(ret->interp, ret->chunk_size, 1);
+		ret->sync_src = ret->pipes[1];
+	} else {
+		ret->sync_src = ret->interp;
+	}
+
 	/* Discard the first null samples */
-	ret->interp->read(ret->interp, rrc_order*interp_mult);
+	ret->skip = rrc_order*interp_mult;
 
 	/* Initialize Costas loop */
-	pll_bw = 2*M_PI*pll_bw/sym_rate;
+	pll_bw = 2*M_PI*params->pll_bw/sym_rate;
 	ret->cst = costas_init(pll_bw);
 
 	/* Initialize the timing recovery variables */
 	ret->sym_rate = sym_rate;
 	ret->sym_period = ret->interp->samplerate/(float)sym_rate;
-	pthread_mutex_init(&ret->mutex, NULL);
-	ret->bytes_out_count = 0;
+	ret->resync_offset = 0;
+	ret->before = 0;
+	ret->mid = 0;
+	ret->timing_drift = 0;
+
+	/* Measure the SNR once per second of symbols */
+	ret->snr_period = sym_rate;
+	ret->snr_count = 0;
+	ret->snr_locked = 0;
+	ret->snr_m2 = 0;
+	ret->snr_m4 = 0;
+	ret->snr_secs = 0;
+	ret->snr_good_secs = 0;
+	ret->snr_sum = 0;
+	ret->quality_fd = NULL;
+
+	ret->max_lag = 0;
+	ret->level = 0;
+	ret->max_level = 0;
+	ret->lag_origin_ns = 0;
+	ret->level_ns = 0;
+	ret->caught_up_ns = 0;
+	ret->interp_read_ns = 0;
+	ret->interp_filter_ns = 0;
+
+	ret->sink = NULL;
+	ret->sink_ctx = NULL;
+	ret->out_fd = NULL;
+	ret->out_resume = -1;
+	ret->resumed = 0;
+	ret->out_offset = 0;
+	ret->constell_offset = 0;
+	ret->push_src = NULL;
+	ret->start_ns = get_time_ns();
+	ret->ckpt_fname = NULL;
+	ret->ckpt_interval_ns = 0;
+	ret->ckpt_last_ns = ret->start_ns;
+
+	ret->stats_seq = 0;
+	ret->stats.symbols_out = 0;
+	ret->stats.symbols_locked = 0;
+	ret->stats.in_done = 0;
+	ret->stats.evm = 0;
+	ret->stats.snr = 0;
+	ret->stats.snr_avg = 0;
+	ret->stats.lag = 0;
+	ret->stats.level = 0;
+	ret->stats.level_changes = 0;
+	ret->stats.level_lag = 0;
+	ret->stats.rrc_order = rrc_order;
+	ret->stats.interp_factor = interp_mult;
+	ret->stats.freq = 0;
+	ret->stats.gain = 1;
+	ret->stats.timing_err = 0;
+	ret->stats.pll_locked = 0;
+	ret->stats.stages = ret->nstages;
+	ret->stats.wall_ns = 0;
+	ret->stats.push_dropped = 0;
+	for (i=0; i<DEMOD_MAX_STAGES; i++) {
+		ret->stats.stage_util[i] = 0;
+	}
+	for (i=0; i<DEMOD_PROF_COUNT; i++) {
+		ret->stats.prof_ns[i] = 0;
+		ret->stats.prof_items[i] = 0;
+	}
+	ret->local_stats = ret->stats;
+	ret->evm_abs = 0;
+	ret->evm_pow = 0;
+	ret->constell = triplebuf_init(sizeof(int8_t) * 2 * CONSTELL_SAMPLES);
 	ret->thr_is_running = 1;
 
+	ret->events = 0;
+	ret->stats_watched = 0;
+	if ((ret->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+		fatal("Could not create the event notifier");
+	}
+
 	return ret;
 }
 
+/* Initialize a demodulator that doesn't read from a Source, but gets its
+ * samples through demod_push() instead. It never spawns any threads besides
+ * the optional filter workers */
+Demod*
+demod_init_push(unsigned samplerate, const DemodParams *params)
+{
+	DemodParams push_params;
+	Source *src;
+	Demod *ret;
+
+	push_params = *params;
+	push_params.nthreads = 1;
+
+	src = memsrc_init(samplerate);
+	ret = demod_init(src, &push_params);
+	ret->push_src = src;
+
+	return ret;
+}
+
+/* Set the function that will receive the demodulated symbols, as interleaved
+ * I/Q int8_t pairs */
+void
+demod_set_sink(Demod *self, DemodSink sink, void *ctx)
+{
+	self->sink = sink;
+	self->sink_ctx = ctx;
+}
+
+/* Threadless step mode: read and process one chunk of samples from the
+ * Source. Returns the number of samples processed, 0 once the input is over.
+ * Symbols are handed to the sink in blocks of SYM_CHUNKSIZE bytes, call
+ * demod_flush() to get the rest */
+int
+demod_step(Demod *self)
+{
+	int count;
+
+	count = self->sync_src->read(self->sync_src, self->chunk_size);
+	if (count > 0) {
+		demod_process(self, self->sync_src->data, count);
+	}
+
+	return count;
+}
+
+/* Push mode: process $count samples on the calling thread. If $out is not
+ * NULL, the resulting symbols are copied there (up to $out_size bytes, see
+ * demod_max_output()), otherwise they are handed to the sink. Symbols that
+ * don't fit in $out go to the sink if one is set, and are dropped and counted
+ * in push_dropped otherwise. Returns the number of bytes written to $out */
+size_t
+demod_push(Demod *self, const float complex *samples, size_t count, int8_t *out, size_t out_size)
+{
+	BufSink buf;
+	DemodSink prev_sink;
+	void *prev_ctx;
+
+	prev_sink = self->sink;
+	prev_ctx = self->sink_ctx;
+	if (out) {
+		buf.buf = out;
+		buf.size = out_size;
+		buf.len = 0;
+		buf.dropped = 0;
+		buf.fallback = prev_sink;
+		buf.fallback_ctx = prev_ctx;
+		demod_set_sink(self, buf_sink, &buf);
+	}
+
+	memsrc_feed(self->push_src, samples, count);
+	while (demod_step(self))
+		;
+	demod_flush(self);
+
+	demod_set_sink(self, prev_sink, prev_ctx);
+	if (out && buf.dropped) {
+		self->local_stats.push_dropped += buf.dropped;
+		demod_publish_stats(self, &self->local_stats);
+	}
+	return out ? buf.len : 0;
+}
+
+/* Upper bound on the number of output bytes demod_push() can produce for
+ * $count input samples */
+size_t
+demod_max_output(const Demod *self, size_t count)
+{
+	float interp_count;
+
+	/* The timing loop can shorten a symbol by a fraction of a sample */
+	interp_count = (float)count * self->interp->samplerate / self->src->samplerate;
+	return 2 * ((size_t)(interp_count / (self->sym_period * 0.9)) + 2);
+}
+
+/* Send the buffered symbols to the sink */
+void
+demod_flush(Demod *self)
+{
+	uint64_t t0;
+
+	demod_measure(self, self->out_buf, self->lock_buf, self->out_offset/2);
+	if (self->out_offset && self->sink) {
+		PROBE2(output_flush, self->out_offset, self->local_stats.symbols_out);
+		t0 = get_time_ns();
+		self->sink(self->out_buf, self->out_offset, self->sink_ctx);
+		self->local_stats.prof_ns[DEMOD_PROF_OUTPUT] += get_time_ns() - t0;
+		self->local_stats.prof_items[DEMOD_PROF_OUTPUT] += self->out_offset/2;
+	}
+	self->out_offset = 0;
+}
+
+/* Take a snapshot of the demodulator state. This is only consistent between
+ * two chunks, and when the filter runs on the same thread as the rest of the
+ * demodulator (nthreads <= 2). state->filter_mem must be freed by the caller */
+void
+demod_get_state(Demod *self, DemodState *state)
+{
+	Filter *rrc;
+	unsigned i;
+
+	memset(state, 0, sizeof(*state));
+	rrc = interp_get_filter(self->interp);
+
+	state->samplerate = self->src->samplerate;
+	state->sym_rate = self->sym_rate;
+	state->interp_factor = self->interp->samplerate / self->src->samplerate;
+	state->rrc_order = rrc->fwd_count / 2;
+	state->in_pos = self->sync_src->done(self->sync_src);
+	state->symbols_out = self->local_stats.symbols_out;
+
+	state->agc = *self->agc;
+	state->cst = *self->cst;
+	state->skip = self->skip;
+	state->resync_offset = self->resync_offset;
+	state->before = self->before;
+	state->mid = self->mid;
+
+	state->filter_len = rrc->fwd_count;
+	state->filter_mem = safealloc(sizeof(*state->filter_mem) * rrc->fwd_count);
+	for (i=0; i<rrc->fwd_count; i++) {
+		state->filter_mem[i] = rrc->mem[i];
+	}
+}
+
+/* Restore a state saved by demod_get_state(). The caller is responsible for
+ * seeking the input to state->in_pos beforehand: if that was possible ($exact),
+ * the output file is truncated to the matching symbol and the run picks up
+ * exactly where the old one stopped; otherwise, the symbols are appended to
+ * the existing output. Returns -1 if the state was saved with different
+ * parameters */
+int
+demod_set_state(Demod *self, const DemodState *state, int exact)
+{
+	Filter *rrc;
+	unsigned i;
+
+	rrc = interp_get_filter(self->interp);
+	if (state->samplerate != self->src->samplerate || state->sym_rate != self->sym_rate ||
+	    state->interp_factor != self->interp->samplerate / self->src->samplerate ||
+	    state->filter_len != rrc->fwd_count) {
+		return -1;
+	}
+
+	*self->agc = state->agc;
+	*self->cst = state->cst;
+	self->skip = state->skip;
+	self->resync_offset = state->resync_offset;
+	self->before = state->before;
+	self->mid = state->mid;
+	for (i=0; i<rrc->fwd_count; i++) {
+		rrc->mem[i] = state->filter_mem[i];
+	}
+
+	self->local_stats.symbols_out = state->symbols_out;
+	self->stats.symbols_out = state->symbols_out;
+	self->resumed = 1;
+	self->out_resume = exact ? (int64_t)state->symbols_out * 2 : -1;
+
+	return 0;
+}
+
+/* Save the demodulator state to $fname every $interval_ms. The checkpoint is
+ * deleted once the input has been fully processed */
+void
+demod_set_checkpoint(Demod *self, const char *fname, unsigned interval_ms)
+{
+	self->ckpt_fname = fname;
+	self->ckpt_interval_ns = interval_ms * 1000000ULL;
+}
+
+/* Write the signal quality measured over each second of symbols to $fd, as
+ * CSV. The file is written from the processing thread, and the header is only
+ * added if it's empty, so that a resumed run can append to it */
+void
+demod_set_quality_log(Demod *self, FILE *fd)
+{
+	self->quality_fd = fd;
+	if (!fseeko(fd, 0, SEEK_END) && !ftello(fd)) {
+		fprintf(fd, "time,snr_db,evm,locked,carrier_hz\n");
+	}
+}
+
+/* Watch how far behind the input the demodulator is, assuming the input comes
+ * in at its nominal samplerate, as when reading from a receiver. Past $secs,
+ * switch to a cheaper configuration (smaller RRC order, less oversampling),
+ * one step at a time, and go back up once caught up. Not supported when the
+ * filter runs on its own thread. Returns 0 on success */
+int
+demod_set_max_lag(Demod *self, float secs)
+{
+	unsigned order, factor, prev_order, prev_factor;
+
+	if (self->pipes[1]) {
+		return -1;
+	}
+
+	/* Stop at the first level that wouldn't make any difference */
+	self->max_lag = secs;
+	self->max_level = 0;
+	demod_level_params(self, 0, &prev_order, &prev_factor);
+	while (self->max_level < DEMOD_MAX_LEVEL) {
+		demod_level_params(self, self->max_level+1, &order, &factor);
+		if (order == prev_order && factor == prev_factor) {
+			break;
+		}
+		prev_order = order;
+		prev_factor = factor;
+		self->max_level++;
+	}
+
+	return 0;
+}
+
+/* Run the demodulator on a background thread, writing the symbols to $fname */
 void
 demod_start(Demod *self, const char *fname)
 {
@@ -57,6 +445,23 @@ demod_start(Demod *self, const char *fname)
 	args->self = self;
 
 	pthread_create(&self->t, NULL, demod_thr_run, (void*)args);
+	if (self->nstages > 1) {
+		pin_thread(self->t, self->nstages-1);
+	}
+}
+
+/* Run the demodulator on the calling thread until the input is exhausted */
+void
+demod_run(Demod *self, const char *fname)
+{
+	ThrArgs *args;
+
+	args = safealloc(sizeof(*args));
+
+	args->out_fname = fname;
+	args->self = self;
+
+	demod_thr_run(args);
 }
 
 int
@@ -65,55 +470,95 @@ demod_status(const Demod *self)
 	return self->thr_is_running;
 }
 
-int
-demod_is_pll_locked(const Demod *self)
+/* Read a consistent snapshot of the demodulator status. This is a seqlock
+ * reader: it retries if the worker published new stats while we were copying */
+void
+demod_get_stats(const Demod *self, DemodStats *stats)
 {
-	return self->cst->locked;
+	unsigned seq;
+
+	do {
+		seq = __atomic_load_n(&self->stats_seq, __ATOMIC_ACQUIRE);
+		*stats = self->stats;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) || seq != __atomic_load_n(&self->stats_seq, __ATOMIC_RELAXED));
 }
 
-unsigned
-demod_get_bytes_out(Demod *self)
+uint64_t
+demod_get_size(const Demod *self)
 {
-	unsigned ret;
+	return self->src->size(self->src);
+}
 
-	pthread_mutex_lock(&self->mutex);
-	ret = self->bytes_out_count;
-	pthread_mutex_unlock(&self->mutex);
+/* Get a human-readable name for a pipeline stage */
+const char*
+demod_get_stage_name(const Demod *self, unsigned stage)
+{
+	static const char *names[DEMOD_MAX_STAGES][DEMOD_MAX_STAGES] = {
+		{ "all" },
+		{ "input", "filter+sync" },
+		{ "input", "filter", "sync" }
+	};
 
-	return ret;
+	if (stage >= self->nstages) {
+		return NULL;
+	}
+	return names[self->nstages-1][stage];
 }
 
-uint64_t
-demod_get_done(const Demod *self)
+/* Get a human-readable name for a profiled processing step */
+const char*
+demod_get_prof_name(unsigned step)
 {
-	return self->src->done(self->src);
+	static const char *names[DEMOD_PROF_COUNT] = {
+		"input", "filter", "agc+timing", "costas", "output"
+	};
+
+	return (step < DEMOD_PROF_COUNT) ? names[step] : NULL;
 }
 
-uint64_t
-demod_get_size(const Demod *self)
+/* Get the latest constellation snapshot, CONSTELL_SAMPLES I/Q pairs. Must only
+ * be called from a single thread, since reading swaps the UI-side buffer */
+const int8_t*
+demod_get_buf(Demod *self)
 {
-	return self->src->size(self->src);
+	return triplebuf_read(self->constell);
 }
 
-float
-demod_get_freq(const Demod *self)
+/* Get a file descriptor that becomes readable when something happens: the
+ * worker thread stops, the PLL lock or the lag monitor level changes, or new
+ * stats are published after a demod_watch_stats() call. It's meant for
+ * poll(), call demod_get_events() to find out what happened */
+int
+demod_get_event_fd(const Demod *self)
 {
-	return self->cst->nco_freq*self->sym_rate/(2*M_PI);
+	return self->event_fd;
 }
 
-float
-demod_get_gain(const Demod *self)
+/* Clear the event fd, and return the events it signalled as a combination of
+ * DEMOD_EVENT_* flags */
+unsigned
+demod_get_events(Demod *self)
 {
-	return self->agc->gain;
+	uint64_t count;
+
+	/* The flags are set before the fd is written to, so reading them after
+	 * draining it never loses one */
+	read(self->event_fd, &count, sizeof(count));
+	return __atomic_exchange_n(&self->events, 0, __ATOMIC_ACQ_REL);
 }
 
-/* XXX not thread-safe */
-const int8_t*
-demod_get_buf(const Demod *self)
+/* Ask to be notified the next time the stats are published. This happens once
+ * per chunk, so the notification is one-shot: call again once the stats have
+ * been read to get the next one */
+void
+demod_watch_stats(Demod *self)
 {
-	return self->out_buf;
+	__atomic_store_n(&self->stats_watched, 1, __ATOMIC_RELEASE);
 }
 
+/* Stop the background thread started by demod_start(), and free the
+ * demodulator */
 void
 demod_join(Demod *self)
 {
@@ -121,89 +566,567 @@ demod_join(Demod *self)
 
 	self->thr_is_running = 0;
 	pthread_join(self->t, &retval);
-	pthread_mutex_destroy(&self->mutex);
+
+	demod_free(self);
+}
+
+/* Free a demodulator that isn't running */
+void
+demod_free(Demod *self)
+{
+	/* Stop the pipeline stages, starting from the most downstream one */
+	if (self->pipes[1]) {
+		self->pipes[1]->close(self->pipes[1]);
+	}
+	self->interp->close(self->interp);
+	if (self->pipes[0]) {
+		self->pipes[0]->close(self->pipes[0]);
+	}
+
+	if (self->push_src) {
+		self->push_src->close(self->push_src);
+	}
 
 	agc_free(self->agc);
 	costas_free(self->cst);
-	self->interp->close(self->interp);
+	triplebuf_free(self->constell);
+	close(self->event_fd);
 
 	free(self);
 }
 
+/* Sink writing the symbols to a FILE* */
+void
+demod_file_sink(const int8_t *syms, size_t len, void *ctx)
+{
+	fwrite(syms, len, 1, (FILE*)ctx);
+}
+
 /* Static functions {{{ */
 void*
 demod_thr_run(void* x)
 {
 	FILE *out_fd;
-	int i, count, buf_offset;
-	float complex before, mid, cur;
-	float resync_offset, resync_error, resync_period;
-	int8_t *out_buf;
 
 	const ThrArgs *args = (ThrArgs*)x;
 	Demod *self = args->self;
-	out_buf = self->out_buf;
-
-	resync_period = self->sym_period;
 
+	/* Write to the requested file, or to the user-supplied sink */
+	out_fd = NULL;
 	if (args->out_fname) {
-		if (!(out_fd = fopen(args->out_fname, "w"))) {
+		/* When resuming, drop the symbols produced after the checkpoint
+		 * and continue from there */
+		out_fd = fopen(args->out_fname, self->resumed ? "a" : "w");
+		if (!out_fd || (self->out_resume >= 0 && ftruncate(fileno(out_fd), self->out_resume))) {
 			fatal("Could not open file for writing");
 			/* Not reached */
 			return NULL;
 		}
-	} else {
+		self->out_fd = out_fd;
+		demod_set_sink(self, demod_file_sink, out_fd);
+	} else if (!self->sink) {
 		fatal("No output filename specified");
 		/* Not reached */
 		return NULL;
 	}
 
 	/* Main processing loop */
-	buf_offset = 0;
-	resync_offset = 0;
-	before = 0;
-	mid = 0;
-	cur = 0;
-	while (self->thr_is_running && (count = self->interp->read(self->interp, CHUNKSIZE))) {
-		for (i=0; i<count; i++) {
-			/* Symbol resampling */
-			if (resync_offset >= resync_period/2 && resync_offset < resync_period/2+1) {
-				mid = agc_apply(self->agc, self->interp->data[i]);
-			} else if (resync_offset >= resync_period) {
-				cur = agc_apply(self->agc, self->interp->data[i]);
-				/* The current sample is in the correct time slot: process it */
-				/* Calculate the symbol timing error (Gardner algorithm) */
-				resync_offset -= resync_period;
-				resync_error = (cimagf(cur) - cimagf(before)) * cimagf(mid);
-				resync_offset += (resync_error*resync_period/2000000.0);
-				before = cur;
-
-				/* Fine frequency/phase tuning */
-				cur = costas_resync(self->cst, cur);
-
-				/* Append the new samples to the output buffer */
-				out_buf[buf_offset++] = clamp(crealf(cur)/2);
-				out_buf[buf_offset++] = clamp(cimagf(cur)/2);
-
-				/* Write binary stream to file and/or to socket */
-				if (buf_offset >= SYM_CHUNKSIZE - 1) {
-					fwrite(out_buf, buf_offset, 1, out_fd);
-					buf_offset = 0;
-				}
-				pthread_mutex_lock(&self->mutex);
-				self->bytes_out_count += 2;
-				pthread_mutex_unlock(&self->mutex);
-			}
-			resync_offset++;
-		}
-	}
+	while (self->thr_is_running && demod_step(self))
+		;
 
 	/* Write the remaining bytes */
-	fwrite(out_buf, buf_offset, 1, out_fd);
-	fclose(out_fd);
+	demod_flush(self);
+	if (out_fd) {
+		fclose(out_fd);
+		self->out_fd = NULL;
+	}
+
+	/* The checkpoint is only useful if the run was interrupted */
+	if (self->ckpt_fname) {
+		if (self->thr_is_running) {
+			remove(self->ckpt_fname);
+		} else {
+			demod_checkpoint(self);
+		}
+	}
 
 	free(x);
 	self->thr_is_running = 0;
+	demod_notify(self, DEMOD_EVENT_DONE);
 	return NULL;
 }
+
+/* Run a chunk of interpolated samples through the AGC, the timing recovery and
+ * the Costas loop, and send the resulting symbols to the sink. The Costas loop
+ * doesn't feed back into the timing recovery, so the symbols are collected
+ * first and tracked in batches, which also lets each step be timed on its own */
+void
+demod_process(Demod *self, const float complex *data, int count)
+{
+	int i, nsyms;
+	float complex cur;
+	float resync_error, resync_period;
+	float timing_err_acc, evm_abs, evm_pow, ref;
+	int chunk_syms, was_locked;
+	unsigned was_level;
+	uint64_t t0, tracked_ns;
+	DemodStats *stats;
+
+	stats = &self->local_stats;
+	resync_period = self->sym_period;
+	t0 = get_time_ns();
+	tracked_ns = stats->prof_ns[DEMOD_PROF_COSTAS] + stats->prof_ns[DEMOD_PROF_OUTPUT];
+	PROBE1(sync_start, count);
+
+	/* Discard the null samples at the beginning of the stream */
+	if (self->skip) {
+		i = (self->skip < (unsigned)count) ? (int)self->skip : count;
+		self->skip -= i;
+		data += i;
+		count -= i;
+	}
+
+	timing_err_acc = 0;
+	evm_abs = evm_pow = 0;
+	chunk_syms = 0;
+	nsyms = 0;
+	for (i=0; i<count; i++) {
+		/* Symbol resampling */
+		if (self->resync_offset >= resync_period/2 && self->resync_offset < resync_period/2+1) {
+			self->mid = agc_apply(self->agc, data[i]);
+		} else if (self->resync_offset >= resync_period) {
+			cur = agc_apply(self->agc, data[i]);
+			/* The current sample is in the correct time slot: process it */
+			/* Calculate the symbol timing error (Gardner algorithm) */
+			self->resync_offset -= resync_period;
+			resync_error = (cimagf(cur) - cimagf(self->before)) * cimagf(self->mid);
+			self->resync_offset += (resync_error*resync_period/2000000.0);
+			timing_err_acc += fabsf(resync_error);
+			/* Report every time the corrections add up to a whole sample */
+			self->timing_drift += resync_error*resync_period/2000000.0;
+			if (fabsf(self->timing_drift) >= 1) {
+				PROBE2(timing_slip, self->timing_drift > 0 ? 1 : -1, stats->symbols_out + nsyms);
+				self->timing_drift -= self->timing_drift > 0 ? 1 : -1;
+			}
+			chunk_syms++;
+			self->before = cur;
+
+			self->sym_buf[nsyms++] = cur;
+			if (nsyms == SYM_CHUNKSIZE) {
+				demod_track(self, nsyms, &evm_abs, &evm_pow);
+				nsyms = 0;
+			}
+		}
+		self->resync_offset++;
+	}
+	demod_track(self, nsyms, &evm_abs, &evm_pow);
+	PROBE2(sync_done, count, chunk_syms);
+
+	/* Whatever wasn't spent in the Costas loop or in the sink went to the
+	 * AGC and the timing recovery */
+	tracked_ns = stats->prof_ns[DEMOD_PROF_COSTAS] + stats->prof_ns[DEMOD_PROF_OUTPUT] - tracked_ns;
+	stats->prof_ns[DEMOD_PROF_TIMING] += get_time_ns() - t0 - tracked_ns;
+	stats->prof_items[DEMOD_PROF_TIMING] += count;
+
+	/* Publish the updated status once per chunk */
+	stats->in_done = self->sync_src->done(self->sync_src);
+	stats->freq = self->cst->nco_freq*self->sym_rate/(2*M_PI);
+	stats->gain = self->agc->gain;
+	/* Average timing correction per symbol, in samples */
+	if (chunk_syms) {
+		stats->timing_err = timing_err_acc*resync_period/2000000.0/chunk_syms;
+	}
+	was_locked = stats->pll_locked;
+	was_level = stats->level;
+	stats->pll_locked = self->cst->locked;
+	/* Blind EVM: the ideal constellation points are taken to be at the mean
+	 * absolute value of I and Q, and the error is the spread around them */
+	self->evm_abs += evm_abs;
+	self->evm_pow += evm_pow;
+	if (stats->symbols_locked) {
+		ref = self->evm_abs / (2*stats->symbols_locked);
+		evm_pow = self->evm_pow/stats->symbols_locked - 2*ref*ref;
+		stats->evm = evm_pow > 0 ? sqrtf(evm_pow / (2*ref*ref)) : 0;
+	}
+	if (self->max_lag > 0) {
+		demod_monitor_lag(self);
+	}
+	stats->wall_ns = get_time_ns() - self->start_ns;
+	demod_update_util(self, stats, stats->wall_ns);
+	demod_update_prof(self, stats);
+	demod_publish_stats(self, stats);
+	demod_notify(self, DEMOD_EVENT_STATS |
+	             ((stats->pll_locked != was_locked || stats->level != was_level) ? DEMOD_EVENT_STATE : 0));
+
+	if (self->ckpt_fname && get_time_ns() - self->ckpt_last_ns >= self->ckpt_interval_ns) {
+		demod_checkpoint(self);
+	}
+}
+
+/* Run the first $count symbols of sym_buf through the Costas loop, and append
+ * them to the output buffer and to the constellation snapshot */
+void
+demod_track(Demod *self, int count, float *evm_abs, float *evm_pow)
+{
+	int i;
+	float complex cur;
+	int8_t *out_buf, *constell_buf;
+	uint64_t t0, output_ns;
+	DemodStats *stats;
+
+	out_buf = self->out_buf;
+	constell_buf = triplebuf_back(self->constell);
+	stats = &self->local_stats;
+	t0 = get_time_ns();
+	output_ns = stats->prof_ns[DEMOD_PROF_OUTPUT];
+
+	for (i=0; i<count; i++) {
+		/* Fine frequency/phase tuning */
+		cur = costas_resync(self->cst, self->sym_buf[i]);
+		if (self->cst->locked) {
+			*evm_abs += fabsf(crealf(cur)) + fabsf(cimagf(cur));
+			*evm_pow += crealf(cur)*crealf(cur) + cimagf(cur)*cimagf(cur);
+			stats->symbols_locked++;
+		}
+
+		/* Append the new samples to the output buffer */
+		self->lock_buf[self->out_offset/2] = self->cst->locked;
+		out_buf[self->out_offset++] = clamp(crealf(cur)/2);
+		out_buf[self->out_offset++] = clamp(cimagf(cur)/2);
+
+		/* Decimate the symbols into the constellation snapshot, and
+		 * hand it over to the UI once it's full */
+		if (!(stats->symbols_out % CONSTELL_DECIM)) {
+			constell_buf[self->constell_offset++] = out_buf[self->out_offset-2];
+			constell_buf[self->constell_offset++] = out_buf[self->out_offset-1];
+			if (self->constell_offset >= 2*CONSTELL_SAMPLES) {
+				triplebuf_publish(self->constell);
+				constell_buf = triplebuf_back(self->constell);
+				self->constell_offset = 0;
+			}
+		}
+
+		/* Hand the symbols over to the sink */
+		if (self->out_offset >= SYM_CHUNKSIZE - 1) {
+			demod_flush(self);
+		}
+		stats->symbols_out++;
+	}
+
+	/* The time spent in the sink is accounted for separately */
+	output_ns = stats->prof_ns[DEMOD_PROF_OUTPUT] - output_ns;
+	stats->prof_ns[DEMOD_PROF_COSTAS] += get_time_ns() - t0 - output_ns;
+	stats->prof_items[DEMOD_PROF_COSTAS] += count;
+}
+
+/* Accumulate the moments of a block of $count output symbols, closing the
+ * measurement window every second of symbols. The soft symbols sit well within
+ * the int8_t range, so they are measured as written, with integer sums that
+ * the compiler vectorizes */
+void
+demod_measure(Demod *self, const int8_t *syms, const uint8_t *locked, unsigned count)
+{
+	uint64_t m4;
+	uint32_t m2, p;
+	unsigned i, j, n, nlocked;
+
+	for (i=0; i<count; i+=n) {
+		n = self->snr_period - self->snr_count;
+		if (n > count - i) {
+			n = count - i;
+		}
+
+		m2 = 0;
+		m4 = 0;
+		nlocked = 0;
+		for (j=i; j<i+n; j++) {
+			p = syms[2*j]*syms[2*j] + syms[2*j+1]*syms[2*j+1];
+			m2 += p;
+			m4 += p*p;
+			nlocked += locked[j];
+		}
+
+		self->snr_m2 += m2;
+		self->snr_m4 += m4;
+		self->snr_locked += nlocked;
+		self->snr_count += n;
+		if (self->snr_count >= self->snr_period) {
+			demod_update_snr(self);
+		}
+	}
+}
+
+/* M2M4 estimator: for a constant modulus constellation such as QPSK in complex
+ * Gaussian noise, M2 = S + N and M4 = S^2 + 4SN + 2N^2, so the signal and noise
+ * powers can be told apart without deciding on the symbols, which keeps the
+ * estimate meaningful even while the PLL is unlocked */
+void
+demod_update_snr(Demod *self)
+{
+	DemodStats *stats;
+	double m2, m4, sig, noise;
+	float snr, evm, locked;
+
+	stats = &self->local_stats;
+	m2 = (double)self->snr_m2 / self->snr_count;
+	m4 = (double)self->snr_m4 / self->snr_count;
+	sig = 2*m2*m2 - m4;
+	sig = sig > 0 ? sqrt(sig) : 0;
+	noise = m2 - sig;
+
+	snr = (sig <= 0) ? SNR_MIN_DB : (noise <= 0) ? SNR_MAX_DB : 10*log10(sig/noise);
+	if (snr < SNR_MIN_DB) {
+		snr = SNR_MIN_DB;
+	} else if (snr > SNR_MAX_DB) {
+		snr = SNR_MAX_DB;
+	}
+	evm = powf(10, -snr/20);
+	locked = (float)self->snr_locked / self->snr_count;
+
+	/* Seconds spent mostly locked give an idea of the overall quality of the
+	 * pass, regardless of how long the satellite was below the horizon */
+	stats->snr = snr;
+	if (locked >= 0.5) {
+		self->snr_sum += snr;
+		self->snr_good_secs++;
+		stats->snr_avg = self->snr_sum / self->snr_good_secs;
+	}
+
+	self->snr_secs++;
+	if (self->quality_fd) {
+		fprintf(self->quality_fd, "%u,%.2f,%.4f,%.3f,%.1f\n", self->snr_secs, snr, evm, locked,
+		        self->cst->nco_freq*self->sym_rate/(2*M_PI));
+	}
+
+	self->snr_m2 = 0;
+	self->snr_m4 = 0;
+	self->snr_locked = 0;
+	self->snr_count = 0;
+}
+
+/* Write the current state to the checkpoint file. All the symbols up to this
+ * point must be on disk first, or a resumed run would leave a hole in the
+ * output */
+void
+demod_checkpoint(Demod *self)
+{
+	DemodState state;
+
+	demod_flush(self);
+	if (self->out_fd) {
+		fflush(self->out_fd);
+	}
+
+	demod_get_state(self, &state);
+	checkpoint_write(self->ckpt_fname, &state);
+	free(state.filter_mem);
+
+	self->ckpt_last_ns = get_time_ns();
+}
+
+/* Sink copying the symbols into a caller-supplied buffer */
+void
+buf_sink(const int8_t *syms, size_t len, void *ctx)
+{
+	BufSink *buf;
+	size_t n;
+
+	buf = (BufSink*)ctx;
+	n = (len < buf->size - buf->len) ? len : buf->size - buf->len;
+	memcpy(buf->buf + buf->len, syms, n);
+	buf->len += n;
+
+	/* Whatever doesn't fit goes to the regular sink, if any, and is counted
+	 * as dropped otherwise */
+	if (n < len && buf->fallback) {
+		buf->fallback(syms + n, len - n, buf->fallback_ctx);
+	} else if (n < len) {
+		buf->dropped += len - n;
+	}
+}
+
+/* Compute the fraction of time each stage spent doing useful work. A stage's
+ * busy time is the time it spent reading from upstream, minus the time it
+ * spent waiting for the stage before it */
+void
+demod_update_util(const Demod *self, DemodStats *stats, uint64_t wall_ns)
+{
+	PipeStats ps[DEMOD_MAX_STAGES-1];
+	unsigned i, last;
+	uint64_t busy;
+
+	if (!wall_ns) {
+		return;
+	}
+
+	last = self->nstages - 1;
+	for (i=0; i<last; i++) {
+		pipe_get_stats(self->pipes[i], &ps[i]);
+	}
+
+	for (i=0; i<=last; i++) {
+		busy = (i < last) ? ps[i].work_ns : wall_ns;
+		if (i > 0) {
+			busy -= MIN(busy, ps[i-1].starve_ns);
+		}
+		stats->stage_util[i] = (float)busy / wall_ns;
+	}
+}
+
+/* Fill in the input and filter times, which are measured by the stages
+ * upstream of the sync loop. With a separate input thread, the time the
+ * interpolator spends reading from it is mostly spent waiting, so the input
+ * thread's own work time is used instead */
+void
+demod_update_prof(const Demod *self, DemodStats *stats)
+{
+	PipeStats ps;
+	uint64_t read_ns, filter_ns;
+
+	interp_get_times(self->interp, &read_ns, &filter_ns);
+	read_ns += self->interp_read_ns;
+	filter_ns += self->interp_filter_ns;
+	if (self->pipes[0]) {
+		pipe_get_stats(self->pipes[0], &ps);
+		read_ns = ps.work_ns;
+	}
+
+	stats->prof_ns[DEMOD_PROF_INPUT] = read_ns;
+	stats->prof_ns[DEMOD_PROF_FILTER] = filter_ns;
+	stats->prof_items[DEMOD_PROF_INPUT] = stats->in_done;
+	stats->prof_items[DEMOD_PROF_FILTER] = stats->in_done * (self->interp->samplerate / self->src->samplerate);
+}
+
+/* Compare the input consumed so far with the time elapsed. Whenever the
+ * demodulator is caught up, reads block until new samples arrive, so that's
+ * taken as the new reference: this way startup delays and gaps in the input
+ * don't count as lag */
+void
+demod_monitor_lag(Demod *self)
+{
+	DemodStats *stats;
+	uint64_t now, done_ns;
+
+	stats = &self->local_stats;
+	now = get_time_ns();
+	done_ns = stats->in_done * 1e9 / self->src->samplerate;
+	if (!self->lag_origin_ns || now - self->lag_origin_ns < done_ns) {
+		self->lag_origin_ns = now - done_ns;
+	}
+	stats->lag = (now - self->lag_origin_ns - done_ns) / 1e9;
+
+	if (stats->lag > self->max_lag) {
+		/* Give each step the time to make a difference */
+		if (self->level < self->max_level && now - self->level_ns >= LAG_DOWN_HOLD_NS) {
+			demod_set_level(self, self->level + 1);
+			self->level_ns = now;
+		}
+		self->caught_up_ns = 0;
+	} else if (stats->lag < self->max_lag/4) {
+		/* Only step up after keeping up for a while, and one step at a time */
+		if (!self->caught_up_ns) {
+			self->caught_up_ns = now;
+		} else if (self->level > 0 && now - self->caught_up_ns >= LAG_UP_HOLD_NS) {
+			demod_set_level(self, self->level - 1);
+			self->level_ns = now;
+			self->caught_up_ns = now;
+		}
+	} else {
+		self->caught_up_ns = 0;
+	}
+}
+
+/* Replace the interpolator with one using the parameters of $level, between
+ * two chunks. The filter memory and the timing recovery state are converted to
+ * the new oversampling factor, so that the switch doesn't cause a glitch */
+void
+demod_set_level(Demod *self, unsigned level)
+{
+	Source *interp, *upstream;
+	Filter *old_rrc, *new_rrc;
+	unsigned order, factor, old_factor, i, j;
+	uint64_t read_ns, filter_ns;
+	DemodStats *stats;
+
+	stats = &self->local_stats;
+	demod_level_params(self, level, &order, &factor);
+	old_factor = self->interp->samplerate / self->src->samplerate;
+	upstream = self->pipes[0] ? self->pipes[0] : self->src;
+
+	interp = interp_init(upstream, self->params.rrc_alpha, order, factor, self->sym_rate, self->params.fir_threads);
+
+	/* The filter memory holds the upsampled input, newest first */
+	old_rrc = interp_get_filter(self->interp);
+	new_rrc = interp_get_filter(interp);
+	for (i=0; i<new_rrc->fwd_count; i++) {
+		j = i * old_factor / factor;
+		new_rrc->mem[i] = (j < old_rrc->fwd_count) ? old_rrc->mem[j] : 0;
+	}
+
+	/* Keep the time spent in the old interpolator in the profile */
+	interp_get_times(self->interp, &read_ns, &filter_ns);
+	self->interp_read_ns += read_ns;
+	self->interp_filter_ns += filter_ns;
+
+	self->interp->close(self->interp);
+	self->interp = interp;
+	self->sync_src = interp;
+
+	self->sym_period = interp->samplerate/(float)self->sym_rate;
+	self->resync_offset = self->resync_offset * factor / old_factor;
+	self->level = level;
+
+	stats->level = level;
+	stats->rrc_order = order;
+	stats->interp_factor = factor;
+	stats->level_changes++;
+	stats->level_lag = stats->lag;
+}
+
+/* RRC order and oversampling factor of each level: first halve both, which
+ * keeps the filter span the same, then keep halving the order */
+void
+demod_level_params(const Demod *self, unsigned level, unsigned *order, unsigned *factor)
+{
+	*order = self->params.rrc_order >> level;
+	if (*order < LAG_MIN_ORDER) {
+		*order = (self->params.rrc_order < LAG_MIN_ORDER) ? self->params.rrc_order : LAG_MIN_ORDER;
+	}
+
+	*factor = self->params.interp_factor;
+	if (level > 0 && *factor >= 4) {
+		*factor /= 2;
+	}
+}
+
+/* Raise some DEMOD_EVENT_* flags, and wake up whoever polls the event fd */
+void
+demod_notify(Demod *self, unsigned events)
+{
+	uint64_t one = 1;
+
+	/* Stats notifications are only sent when someone is waiting for them */
+	if ((events & DEMOD_EVENT_STATS) && !__atomic_exchange_n(&self->stats_watched, 0, __ATOMIC_ACQ_REL)) {
+		events &= ~DEMOD_EVENT_STATS;
+	}
+	if (!events) {
+		return;
+	}
+
+	__atomic_fetch_or(&self->events, events, __ATOMIC_RELEASE);
+	write(self->event_fd, &one, sizeof(one));
+}
+
+/* Seqlock writer: an odd sequence number marks an update in progress */
+void
+demod_publish_stats(Demod *self, const DemodStats *stats)
+{
+	unsigned seq;
+
+	seq = self->stats_seq;
+	__atomic_store_n(&self->stats_seq, seq+1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	self->stats = *stats;
+	__atomic_store_n(&self->stats_seq, seq+2, __ATOMIC_RELEASE);
+}
 /*}}}*/
@@ -0,0 +1,247 @@
+#include <string.h>
+#include "fanout.h"
+#include "pipe.h"
+#include "utils.h"
+
+#define FANOUT_NBLOCKS 8
+
+static int      branch_read(Source *self, size_t count);
+static int      branch_close(Source *self);
+static uint64_t branch_get_size(const Source *self);
+static uint64_t branch_get_done(const Source *self);
+static void*    fanout_thr_run(void *x);
+static unsigned fanout_min_tail(const Fanout *self);
+
+typedef struct {
+	Fanout *fan;
+	unsigned idx;
+	RingBlock *cur;
+	size_t cur_offset;
+	uint64_t done;
+} BranchState;
+
+/* Split $upstream into $count branches, reading $chunk_size samples at a time.
+ * The reader thread starts right away */
+Fanout*
+fanout_init(Source *upstream, unsigned count, size_t chunk_size)
+{
+	Fanout *ret;
+	Source *branch;
+	BranchState *state;
+	unsigned i;
+
+	ret = safealloc(sizeof(*ret));
+	ret->upstream = upstream;
+	ret->nblocks = FANOUT_NBLOCKS;
+	ret->chunk_size = chunk_size;
+	ret->blocks = safealloc(sizeof(*ret->blocks) * ret->nblocks);
+	for (i=0; i<ret->nblocks; i++) {
+		ret->blocks[i].data = safealloc(sizeof(*ret->blocks[i].data) * chunk_size);
+		ret->blocks[i].count = 0;
+		ret->blocks[i].done = 0;
+	}
+	ret->head = 0;
+	ret->stop = 0;
+	ret->eof = 0;
+
+	ret->count = count;
+	ret->tails = safealloc(sizeof(*ret->tails) * count);
+	ret->detached = safealloc(sizeof(*ret->detached) * count);
+	ret->branches = safealloc(sizeof(*ret->branches) * count);
+	for (i=0; i<count; i++) {
+		ret->tails[i] = 0;
+		ret->detached[i] = 0;
+
+		branch = safealloc(sizeof(*branch));
+		branch->count = 0;
+		branch->samplerate = upstream->samplerate;
+		branch->bps = upstream->bps;
+		branch->data = NULL;
+		branch->read = branch_read;
+		branch->close = branch_close;
+		branch->size = branch_get_size;
+		branch->done = branch_get_done;
+		branch->seek = NULL;
+
+		branch->_backend = state = safealloc(sizeof(BranchState));
+		state->fan = ret;
+		state->idx = i;
+		state->cur = NULL;
+		state->cur_offset = 0;
+		state->done = 0;
+
+		ret->branches[i] = branch;
+	}
+
+	pthread_create(&ret->t, NULL, fanout_thr_run, ret);
+
+	return ret;
+}
+
+/* Get the Source for branch $idx */
+Source*
+fanout_branch(Fanout *self, unsigned idx)
+{
+	return self->branches[idx];
+}
+
+/* Stop the reader thread and free the fan-out. All the branches must have
+ * been closed already. The upstream source is not closed */
+void
+fanout_free(Fanout *self)
+{
+	unsigned i;
+
+	self->stop = 1;
+	pthread_join(self->t, NULL);
+
+	for (i=0; i<self->nblocks; i++) {
+		free(self->blocks[i].data);
+	}
+	free(self->blocks);
+	free(self->tails);
+	free(self->detached);
+	free(self->branches);
+	free(self);
+}
+
+/* Static functions {{{ */
+/* Copy $count samples out of the shared blocks, waiting for the reader thread
+ * if necessary. Returns less than $count samples only at end of stream */
+int
+branch_read(Source *self, size_t count)
+{
+	BranchState *state;
+	Fanout *fan;
+	unsigned spins, *tail;
+	size_t n, copied;
+
+	state = (BranchState*)self->_backend;
+	fan = state->fan;
+	tail = &fan->tails[state->idx];
+
+	if (!self->data) {
+		self->data = safealloc(sizeof(*self->data) * count);
+	} else if (self->count < count) {
+		free(self->data);
+		self->data = safealloc(sizeof(*self->data) * count);
+	}
+	self->count = count;
+
+	copied = 0;
+	while (copied < count) {
+		if (!state->cur) {
+			spins = 0;
+			while (__atomic_load_n(&fan->head, __ATOMIC_ACQUIRE) == *tail) {
+				if (__atomic_load_n(&fan->eof, __ATOMIC_ACQUIRE) &&
+				    __atomic_load_n(&fan->head, __ATOMIC_ACQUIRE) == *tail) {
+					return copied;
+				}
+				backoff(&spins);
+			}
+			state->cur = &fan->blocks[*tail % fan->nblocks];
+			state->cur_offset = 0;
+		}
+
+		n = MIN(count - copied, state->cur->count - state->cur_offset);
+		memcpy(self->data + copied, state->cur->data + state->cur_offset, sizeof(*self->data) * n);
+		copied += n;
+		state->cur_offset += n;
+
+		if (state->cur_offset >= state->cur->count) {
+			state->done = state->cur->done;
+			state->cur = NULL;
+			__atomic_store_n(tail, *tail + 1, __ATOMIC_RELEASE);
+		}
+	}
+
+	return copied;
+}
+
+/* Detach a branch, so that it no longer holds the others back */
+int
+branch_close(Source *self)
+{
+	BranchState *state;
+
+	state = (BranchState*)self->_backend;
+	__atomic_store_n(&state->fan->detached[state->idx], 1, __ATOMIC_RELEASE);
+
+	free(state);
+	free(self->data);
+	free(self);
+	return 0;
+}
+
+uint64_t
+branch_get_size(const Source *self)
+{
+	const BranchState *state = self->_backend;
+	return state->fan->upstream->size(state->fan->upstream);
+}
+
+uint64_t
+branch_get_done(const Source *self)
+{
+	const BranchState *state = self->_backend;
+	return state->done;
+}
+
+/* Reader thread: fill the blocks as soon as every branch is done with them */
+void*
+fanout_thr_run(void *x)
+{
+	Fanout *self;
+	Source *upstream;
+	RingBlock *block;
+	unsigned spins;
+	int count;
+
+	self = (Fanout*)x;
+	upstream = self->upstream;
+
+	while (!self->stop) {
+		spins = 0;
+		while (self->head - fanout_min_tail(self) >= self->nblocks && !self->stop) {
+			backoff(&spins);
+		}
+		if (self->stop) {
+			break;
+		}
+
+		block = &self->blocks[self->head % self->nblocks];
+		count = upstream->read(upstream, self->chunk_size);
+		if (count <= 0) {
+			break;
+		}
+		memcpy(block->data, upstream->data, sizeof(*block->data) * count);
+		block->count = count;
+		block->done = upstream->done(upstream);
+
+		__atomic_store_n(&self->head, self->head + 1, __ATOMIC_RELEASE);
+	}
+
+	__atomic_store_n(&self->eof, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/* Position of the slowest branch still attached */
+unsigned
+fanout_min_tail(const Fanout *self)
+{
+	unsigned i, tail, max_lag;
+
+	max_lag = 0;
+	for (i=0; i<self->count; i++) {
+		if (__atomic_load_n(&self->detached[i], __ATOMIC_ACQUIRE)) {
+			continue;
+		}
+		tail = __atomic_load_n(&self->tails[i], __ATOMIC_ACQUIRE);
+		if (self->head - tail > max_lag) {
+			max_lag = self->head - tail;
+		}
+	}
+
+	return self->head - max_lag;
+}
+/*}}}*/
@@ -128,6 +128,26 @@ filter_fwd(Filter *const self, float complex in)
 	return out;
 }
 
+/* Feed a block of samples through a FIR filter, without touching its memory.
+ * $in must be preceded by fwd_count-1 samples of history, i.e. in[-1] is the
+ * sample right before in[0]. Since no state is updated, disjoint slices of a
+ * signal can be filtered in parallel */
+void
+filter_fwd_block(const Filter *self, const float complex *in, float complex *out, size_t count)
+{
+	size_t j;
+	int i;
+	float complex acc;
+
+	for (j=0; j<count; j++) {
+		acc = 0;
+		for (i=self->fwd_count-1; i>=0; i--) {
+			acc += in[(long)j - i] * self->fwd_coeff[i];
+		}
+		out[j] = acc;
+	}
+}
+
 /* Free a filter object */
 void
 filter_free(Filter *self)
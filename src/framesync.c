@@ -0,0 +1,181 @@
+#include <string.h>
+#include "framesync.h"
+#include "utils.h"
+
+static void framesync_process(FrameSync *self);
+static void framesync_emit(FrameSync *self, size_t nsyms);
+static void framesync_set(int *field, int value);
+static void framesync_count(uint64_t *counter);
+
+/* Initialize the phase resolver. The fixed symbols are passed on to $next */
+FrameSync*
+framesync_init(DemodSink next, void *next_ctx)
+{
+	FrameSync *ret;
+
+	ret = safealloc(sizeof(*ret));
+	correlator_init(&ret->corr);
+	ret->next = next;
+	ret->next_ctx = next_ctx;
+
+	ret->size = 2 * (SYM_CHUNKSIZE + ASM_SYMS);
+	ret->len = 0;
+	ret->buf = safealloc(ret->size);
+
+	ret->next_asm = 0;
+	ret->checked = 0;
+	ret->misses = 0;
+	memset(&ret->stats, 0, sizeof(ret->stats));
+
+	return ret;
+}
+
+/* DemodSink: consume $len bytes of soft symbols */
+void
+framesync_sink(const int8_t *syms, size_t len, void *ctx)
+{
+	FrameSync *self;
+	size_t n;
+
+	self = (FrameSync*)ctx;
+	while (len > 0) {
+		n = self->size - self->len;
+		if (n > len) {
+			n = len;
+		}
+		memcpy(self->buf + self->len, syms, n);
+		self->len += n;
+		syms += n;
+		len -= n;
+
+		framesync_process(self);
+	}
+}
+
+/* Pass on the symbols still held back. Must be called once the input is over */
+void
+framesync_flush(FrameSync *self)
+{
+	framesync_emit(self, self->len/2);
+}
+
+/* Get a snapshot of the counters. Can be called from any thread */
+void
+framesync_get_stats(const FrameSync *self, FrameSyncStats *stats)
+{
+	stats->markers = __atomic_load_n(&self->stats.markers, __ATOMIC_RELAXED);
+	stats->slips = __atomic_load_n(&self->stats.slips, __ATOMIC_RELAXED);
+	stats->sync_lost = __atomic_load_n(&self->stats.sync_lost, __ATOMIC_RELAXED);
+	stats->locked = __atomic_load_n(&self->stats.locked, __ATOMIC_RELAXED);
+	stats->state = __atomic_load_n(&self->stats.state, __ATOMIC_RELAXED);
+}
+
+void
+framesync_free(FrameSync *self)
+{
+	free(self->buf);
+	free(self);
+}
+
+/* Static functions {{{ */
+/* Check the markers, and pass on every symbol that is known not to be part of
+ * the next marker */
+void
+framesync_process(FrameSync *self)
+{
+	size_t nsyms, i;
+	int err, state;
+
+	for (;;) {
+		nsyms = self->len / 2;
+
+		/* Look for the marker in every state. Until it shows up, the
+		 * symbols go out in the last known orientation */
+		if (!self->stats.locked) {
+			for (i=0; i+ASM_SYMS <= nsyms; i++) {
+				if (correlator_best(&self->corr, self->buf + 2*i, &state) <= ASM_SEARCH_ERRORS) {
+					framesync_set(&self->stats.locked, 1);
+					framesync_set(&self->stats.state, state);
+					self->next_asm = 0;
+					self->checked = 0;
+					self->misses = 0;
+					break;
+				}
+			}
+			framesync_emit(self, i);
+			if (!self->stats.locked) {
+				return;
+			}
+			nsyms = self->len / 2;
+		}
+
+		/* Check the marker where it's expected. If it shows up in a
+		 * different state, the carrier loop has slipped */
+		if (!self->next_asm && !self->checked) {
+			if (nsyms < ASM_SYMS) {
+				return;
+			}
+
+			err = correlator_match(&self->corr, self->buf, self->stats.state);
+			if (err <= ASM_TRACK_ERRORS) {
+				self->misses = 0;
+				framesync_count(&self->stats.markers);
+			} else if (correlator_best(&self->corr, self->buf, &state) <= ASM_SEARCH_ERRORS) {
+				self->misses = 0;
+				framesync_set(&self->stats.state, state);
+				framesync_count(&self->stats.markers);
+				framesync_count(&self->stats.slips);
+			} else if (++self->misses > ASM_MAX_MISSES) {
+				framesync_set(&self->stats.locked, 0);
+				framesync_count(&self->stats.sync_lost);
+				continue;
+			}
+
+			self->checked = 1;
+			self->next_asm = CADU_SYMS;
+		}
+
+		/* Pass on the symbols up to the next marker */
+		if (!nsyms) {
+			return;
+		}
+		i = (nsyms < self->next_asm) ? nsyms : self->next_asm;
+		framesync_emit(self, i);
+		self->next_asm -= i;
+		if (!self->next_asm) {
+			self->checked = 0;
+		}
+	}
+}
+
+/* Rotate the first $nsyms symbols in the buffer to the canonical orientation,
+ * and pass them on */
+void
+framesync_emit(FrameSync *self, size_t nsyms)
+{
+	if (!nsyms) {
+		return;
+	}
+
+	correlator_fix(self->buf, nsyms, self->stats.state);
+	if (self->next) {
+		self->next(self->buf, 2*nsyms, self->next_ctx);
+	}
+
+	self->len -= 2*nsyms;
+	memmove(self->buf, self->buf + 2*nsyms, self->len);
+}
+
+/* Fields only written by the demodulator thread, but read by others */
+void
+framesync_set(int *field, int value)
+{
+	__atomic_store_n(field, value, __ATOMIC_RELAXED);
+}
+
+void
+framesync_count(uint64_t *counter)
+{
+	__atomic_store_n(counter, *counter + 1, __ATOMIC_RELAXED);
+}
+/*}}}*/
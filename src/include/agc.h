@@ -6,6 +6,12 @@
 
 #include <complex.h>
 
+/* AGC default parameters */
+#define AGC_WINSIZE 1024*64
+#define AGC_TARGET 180
+#define AGC_MAX_GAIN 20
+#define AGC_BIAS_WINSIZE 1024*1024
+
 typedef struct {
 	unsigned window_size;
 	float avg;
@@ -0,0 +1,23 @@
+/**
+ * Helpers to line up two soft-symbol streams covering the same stretch of
+ * signal, e.g. the outputs of two demodulators that ran on overlapping
+ * portions of a recording. The streams may be offset by a few symbols and
+ * rotated by a multiple of 90 degrees relative to each other.
+ */
+#ifndef METEOR_ALIGN_H
+#define METEOR_ALIGN_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef struct {
+	size_t end;         /* Index in buf right after the matching window */
+	int rot;            /* Rotation to apply to buf to match the reference */
+	float score;        /* Fraction of bits that agree, 0 to 1 */
+} AlignResult;
+
+void soft_rotate(int8_t *syms, size_t count, int rot);
+void soft_mirror(int8_t *syms, size_t count);
+void align_find(const int8_t *ref, size_t ref_len, const int8_t *buf, size_t lo, size_t hi, AlignResult *res);
+
+#endif
@@ -0,0 +1,37 @@
+/**
+ * Startup auto-tuning. The chunk size and thread layout that run fastest, and
+ * how fast each RRC order and oversampling factor can go, depend on the
+ * machine. autotune_run() measures them on a synthetic signal, and the results
+ * are kept in a per-host wisdom file that later runs load at startup.
+ */
+#ifndef METEOR_AUTOTUNE_H
+#define METEOR_AUTOTUNE_H
+
+#include <stddef.h>
+#include "demod.h"
+
+#define WISDOM_MAX_RATES 64
+
+/* Throughput of one filter configuration */
+typedef struct {
+	unsigned order, factor;
+	double rate;            /* Input samples per second */
+} WisdomRate;
+
+typedef struct {
+	char host[64];
+	char cpu[128];
+	unsigned chunk_size;
+	unsigned nthreads, fir_threads;
+	unsigned nrates;
+	WisdomRate rates[WISDOM_MAX_RATES];
+} Wisdom;
+
+int   wisdom_path(char *buf, size_t len);
+int   wisdom_load(Wisdom *self, const char *fname);
+int   wisdom_save(const Wisdom *self, const char *fname);
+const WisdomRate* wisdom_pick(const Wisdom *self, double min_rate, unsigned order, unsigned factor);
+
+void  autotune_run(Wisdom *self, const DemodParams *params, unsigned samplerate, int (*log)(const char *msg, ...));
+
+#endif
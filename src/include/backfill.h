@@ -0,0 +1,58 @@
+/**
+ * Forward/backward two-pass demodulation of the beginning of a recording.
+ * Whatever the demodulator outputs before its loops have converged is noise,
+ * so the first few seconds of input are kept in memory: once the forward pass
+ * has locked, they are demodulated again backwards in time, starting from the
+ * locked state, and the recovered symbols replace the forward ones up to a
+ * point where the two streams line up. Memory usage is bounded by the length
+ * of the history window, and the input is only read once. The backward pass
+ * runs on a thread of its own, so the forward pass keeps reading the input in
+ * the meantime.
+ */
+#ifndef METEOR_BACKFILL_H
+#define METEOR_BACKFILL_H
+
+#include <pthread.h>
+#include "agc.h"
+#include "align.h"
+#include "demod.h"
+#include "pll.h"
+#include "source.h"
+
+typedef struct {
+	Source *src, *tee;              /* Input, and wrapper recording its history */
+	Demod *fwd;
+	DemodParams params;
+	DemodSink out;
+	void *out_ctx;
+
+	float complex *hist;
+	size_t hist_len, hist_size;
+
+	int8_t *hold;                   /* Forward symbols not written yet */
+	size_t hold_len, hold_size;
+
+	Agc agc;                        /* Latest forward loop state */
+	Costas cst;
+
+	/* Backward pass, and where it lines up with the forward one */
+	pthread_t t;
+	float complex *chunk;
+	int8_t *ref;                    /* Forward symbols to look for */
+	size_t ref_end;
+	int8_t *back;
+	size_t back_len, slack;
+	AlignResult res;
+
+	int started, ready, done;
+	int skipped;                    /* Too little input for a backward pass */
+	size_t recovered;               /* Symbols taken from the backward pass */
+	float score;
+} Backfill;
+
+Backfill* backfill_init(Source *src, const DemodParams *params, float secs);
+void      backfill_attach(Backfill *self, Demod *fwd, DemodSink out, void *out_ctx);
+int       backfill_finish(Backfill *self);
+void      backfill_free(Backfill *self);
+
+#endif
@@ -0,0 +1,14 @@
+/**
+ * Archive reprocessing: demodulate a list of recordings, or every file in a
+ * directory, on a bounded pool of worker threads with one Demod per worker.
+ */
+#ifndef METEOR_BATCH_H
+#define METEOR_BATCH_H
+
+#include "demod.h"
+
+int batch_run(char *const *inputs, unsigned ninputs, const char *out_dir, unsigned samplerate,
+              const DemodParams *params, unsigned jobs, int upd_interval, int quiet,
+              int (*log)(const char *msg, ...));
+
+#endif
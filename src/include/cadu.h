@@ -0,0 +1,54 @@
+/**
+ * LRPT channel decoder, to be used as a demodulator sink: finds the sync
+ * marker in the soft-symbol stream, Viterbi-decodes each frame, derandomizes
+ * it and corrects it with the Reed-Solomon code. Only the CADUs that pass the
+ * RS check are written out, so the output can be fed straight to an image
+ * decoder instead of going through the soft symbols a second time.
+ */
+#ifndef METEOR_CADU_H
+#define METEOR_CADU_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "correlator.h"
+#include "demod.h"
+#include "viterbi.h"
+
+#define CADU_LEN 1024
+#define CADU_SYMS (CADU_LEN*8)  /* One encoded bit pair per symbol */
+
+/* Per-frame counters */
+typedef struct {
+	uint64_t frames;        /* Frames found */
+	uint64_t ok;            /* Frames that passed the RS check */
+	uint64_t rs_fixed;      /* Bytes corrected by the RS decoder */
+	uint64_t slips;         /* Phase changes detected by the correlator */
+	uint64_t sync_lost;
+} CaduStats;
+
+typedef struct {
+	Correlator corr;
+	Viterbi *vit;
+	FILE *out_fd;
+	DemodSink next;
+	void *next_ctx;
+
+	int8_t *buf;            /* Soft symbols not processed yet */
+	size_t len, size;
+	int8_t *frame_syms;
+	uint8_t frame[CADU_LEN];
+	uint8_t pn[CADU_LEN-4];
+
+	int locked, state;
+	unsigned misses;
+	CaduStats stats;
+} CaduDecoder;
+
+CaduDecoder* cadu_init(FILE *out_fd, DemodSink next, void *next_ctx);
+void         cadu_sink(const int8_t *syms, size_t len, void *ctx);
+void         cadu_get_stats(const CaduDecoder *self, CaduStats *stats);
+void         cadu_free(CaduDecoder *self);
+
+void         cadu_gen_pn(uint8_t *pn, size_t len);
+
+#endif
@@ -0,0 +1,16 @@
+/**
+ * Demodulator checkpoints. The state saved by demod_get_state() is written to
+ * disk periodically, so that a restarted run can resume from the same input
+ * sample (or, for live inputs, at least with the gain, timing and carrier
+ * already locked). The format is the in-memory layout of DemodState: a
+ * checkpoint is only meant to be resumed by the same build that wrote it.
+ */
+#ifndef METEOR_CHECKPOINT_H
+#define METEOR_CHECKPOINT_H
+
+#include "demod.h"
+
+int checkpoint_write(const char *fname, const DemodState *state);
+int checkpoint_read(const char *fname, DemodState *state);
+
+#endif
@@ -0,0 +1,43 @@
+/**
+ * Correlator for the LRPT attached sync marker (0x1ACFFC1D) as it appears in
+ * the soft-symbol stream, i.e. after convolutional encoding. The Costas loop
+ * can lock in any of four phases and the I/Q branches may be swapped, so the
+ * marker is looked for in all 8 rotation/mirror states of the constellation.
+ * State k means the symbols were mirrored (Q negated) if k >= 4, then rotated
+ * counterclockwise by (k%4)*90 degrees. In state 0, the marker reads as
+ * ASM_ENCODED.
+ */
+#ifndef METEOR_CORRELATOR_H
+#define METEOR_CORRELATOR_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define ASM_WORD 0x1ACFFC1D
+#define ASM_SYMS 32             /* Length of the encoded marker, in symbols */
+
+/* The encoded marker as other LRPT decoders look for it (meteor_decoder,
+ * SatDump), one bit per soft bit, first symbol in the MSBs. It is the
+ * complement of what conv_encode() outputs, since on air a 1 is sent as a
+ * negative value */
+#define ASM_ENCODED 0xFCA2B63DB00D9794ULL
+#define ASM_STATES 8
+
+/* Maximum number of wrong bits in the marker when looking for it, and when
+ * checking it at the expected position. After ASM_MAX_MISSES frames in a row
+ * without a marker, the lock is considered lost */
+#define ASM_SEARCH_ERRORS 4
+#define ASM_TRACK_ERRORS 12
+#define ASM_MAX_MISSES 4
+
+typedef struct {
+	uint64_t pattern[ASM_STATES];
+	uint64_t mask;
+} Correlator;
+
+void correlator_init(Correlator *self);
+int  correlator_match(const Correlator *self, const int8_t *syms, int state);
+int  correlator_best(const Correlator *self, const int8_t *syms, int *state);
+void correlator_fix(int8_t *syms, size_t count, int state);
+
+#endif
@@ -2,44 +2,201 @@
  * Main demodulator object. This will launch a thread in the background to
  * process the incoming samples, so it'll interpolate and resample them,
  * normalize their amplitude, recover the carrier, and write the decoded symbols
- * to disk */
+ * to disk. It can also be driven without any background thread, either by
+ * stepping through its Source or by pushing samples to it, and the symbols can
+ * be sent to a user-supplied sink instead of a file */
 #ifndef METEOR_DEMOD_H
 #define METEOR_DEMOD_H
 
 #include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
 #include "agc.h"
 #include "pll.h"
 #include "source.h"
+#include "triplebuf.h"
 
-/* I/O chunk sizes */
+/* I/O chunk sizes. The input chunk size can be changed at runtime, see
+ * DemodParams */
 #define CHUNKSIZE 32768
 #define SYM_CHUNKSIZE 1024
 
+/* Maximum number of pipeline stages, each running on its own thread */
+#define DEMOD_MAX_STAGES 3
+
+/* Cheaper configurations the lag monitor can fall back to */
+#define DEMOD_MAX_LEVEL 3
+
+/* Constellation snapshot size and decimation factor */
+#define CONSTELL_SAMPLES 128
+#define CONSTELL_DECIM 8
+
+/* Processing steps timed by the built-in profiler. AGC and timing recovery are
+ * interleaved sample by sample, so they are accounted for together */
+enum {
+	DEMOD_PROF_INPUT = 0,
+	DEMOD_PROF_FILTER,
+	DEMOD_PROF_TIMING,
+	DEMOD_PROF_COSTAS,
+	DEMOD_PROF_OUTPUT,
+	DEMOD_PROF_COUNT
+};
+
+/* What happened since the last demod_get_events() call */
+enum {
+	DEMOD_EVENT_STATS = 1,          /* New stats were published, see demod_watch_stats() */
+	DEMOD_EVENT_STATE = 2,          /* The PLL lock or the lag monitor level changed */
+	DEMOD_EVENT_DONE = 4            /* The worker thread stopped */
+};
+
+/* Demodulator configuration */
+typedef struct {
+	unsigned sym_rate;
+	unsigned interp_factor;
+	unsigned rrc_order;
+	float rrc_alpha;
+	float pll_bw;
+	unsigned nthreads;
+	unsigned fir_threads;
+	unsigned chunk_size;            /* Interpolated samples per chunk, 0 for CHUNKSIZE */
+} DemodParams;
+
+/* Receives the demodulated symbols, as interleaved I/Q int8_t pairs */
+typedef void (*DemodSink)(const int8_t *syms, size_t len, void *ctx);
+
+/* Snapshot of the demodulator status, published by the worker thread once per
+ * chunk and read by the UI without ever blocking the worker */
+typedef struct {
+	uint64_t symbols_out;
+	uint64_t symbols_locked;        /* Symbols output while the PLL was locked */
+	uint64_t in_done;
+	uint64_t push_dropped;          /* Bytes demod_push() had no room and no sink for */
+	float evm;                      /* RMS error vector magnitude while locked */
+	float snr;                      /* M2M4 SNR estimate over the last second, in dB */
+	float snr_avg;                  /* Average over the seconds spent mostly locked */
+	float lag;                      /* Seconds behind the input, with the lag monitor on */
+	unsigned level;                 /* 0 at full quality, up to DEMOD_MAX_LEVEL */
+	unsigned level_changes;         /* Number of level switches so far */
+	float level_lag;                /* Lag when the level last changed */
+	unsigned rrc_order, interp_factor;
+	float freq;
+	float gain;
+	float timing_err;
+	int pll_locked;
+	unsigned stages;
+	float stage_util[DEMOD_MAX_STAGES];
+	uint64_t wall_ns;                       /* Time since the demodulator started */
+	uint64_t prof_ns[DEMOD_PROF_COUNT];     /* Time spent in each step */
+	uint64_t prof_items[DEMOD_PROF_COUNT];  /* Samples or symbols through each step */
+} DemodStats;
+
+/* Everything needed to resume demodulation where it left off. The parameters
+ * at the top are only used to reject states saved with different settings */
+typedef struct {
+	unsigned samplerate, sym_rate, interp_factor, rrc_order;
+	uint64_t in_pos;                /* Input samples consumed */
+	uint64_t symbols_out;           /* Symbols handed to the sink */
+	Agc agc;
+	Costas cst;
+	unsigned skip;
+	float resync_offset;
+	float complex before, mid;
+	unsigned filter_len;
+	float complex *filter_mem;      /* Interpolator delay line */
+} DemodState;
+
 typedef struct {
 	Agc *agc;
 	Source *interp, *src;
+	Source *pipes[DEMOD_MAX_STAGES-1];
+	Source *sync_src;
+	unsigned nstages;
 	Costas *cst;
+	Source *push_src;
+	DemodParams params;
 	float sym_period;
 	unsigned sym_rate;
+	unsigned chunk_size;
 	pthread_t t;
 
-	pthread_mutex_t mutex;
-	unsigned bytes_out_count;
-	volatile int thr_is_running;
+	/* Timing recovery state */
+	unsigned skip;
+	float resync_offset;
+	float complex before, mid;
+	float timing_drift;             /* Correction since the last sample slip */
+
+	/* Output */
+	DemodSink sink;
+	void *sink_ctx;
+	FILE *out_fd;
+	int64_t out_resume;             /* Truncate the output here, -1 to append */
+	int resumed;
 	int8_t out_buf[SYM_CHUNKSIZE];
+	float complex sym_buf[SYM_CHUNKSIZE];  /* Symbols waiting for the Costas loop */
+	uint8_t lock_buf[SYM_CHUNKSIZE/2];     /* PLL state for each symbol in out_buf */
+
+	/* Signal quality, measured over one second of symbols at a time */
+	unsigned snr_period, snr_count, snr_locked;
+	uint64_t snr_m2, snr_m4;        /* Sums of |y|^2 and |y|^4 */
+	unsigned snr_secs, snr_good_secs;
+	double snr_sum;                 /* Over the good seconds */
+	FILE *quality_fd;
+	unsigned out_offset;
+	unsigned constell_offset;
+
+	/* Lag monitor */
+	float max_lag;                  /* Seconds, 0 if disabled */
+	unsigned level, max_level;
+	uint64_t lag_origin_ns;         /* When the input started, assuming it's real time */
+	uint64_t level_ns, caught_up_ns;
+	uint64_t interp_read_ns, interp_filter_ns;  /* Times of the replaced interpolators */
+
+	/* Periodic checkpoints */
+	const char *ckpt_fname;
+	uint64_t ckpt_interval_ns, ckpt_last_ns;
+
+	/* Event notifications */
+	int event_fd;                   /* eventfd, readable when events is not 0 */
+	unsigned events;
+	unsigned stats_watched;
+
+	DemodStats local_stats;
+	double evm_abs, evm_pow;        /* Sums of |I|+|Q| and I^2+Q^2 while locked */
+	uint64_t start_ns;
+	unsigned stats_seq;
+	DemodStats stats;
+	TripleBuf *constell;
+	volatile int thr_is_running;
 } Demod;
 
-Demod*        demod_init(Source *src, unsigned interp_factor, unsigned rrc_order, float rrc_alpha, float pll_bw, unsigned sym_rate);
+Demod*        demod_init(Source *src, const DemodParams *params);
+Demod*        demod_init_push(unsigned samplerate, const DemodParams *params);
+void          demod_set_sink(Demod *self, DemodSink sink, void *ctx);
+void          demod_file_sink(const int8_t *syms, size_t len, void *ctx);
 void          demod_start(Demod *self, const char *fname);
+void          demod_run(Demod *self, const char *fname);
 void          demod_join(Demod *self);
+void          demod_free(Demod *self);
+
+int           demod_step(Demod *self);
+size_t        demod_push(Demod *self, const float complex *samples, size_t count, int8_t *out, size_t out_size);
+size_t        demod_max_output(const Demod *self, size_t count);
+void          demod_flush(Demod *self);
+
+void          demod_get_state(Demod *self, DemodState *state);
+int           demod_set_state(Demod *self, const DemodState *state, int exact);
+void          demod_set_checkpoint(Demod *self, const char *fname, unsigned interval_ms);
+void          demod_set_quality_log(Demod *self, FILE *fd);
+int           demod_set_max_lag(Demod *self, float secs);
 
 int           demod_status(const Demod *self);
-int           demod_is_pll_locked(const Demod *self);
-unsigned      demod_get_bytes_out(Demod *self);
-uint64_t      demod_get_done(const Demod *self);
+int           demod_get_event_fd(const Demod *self);
+unsigned      demod_get_events(Demod *self);
+void          demod_watch_stats(Demod *self);
+void          demod_get_stats(const Demod *self, DemodStats *stats);
 uint64_t      demod_get_size(const Demod *self);
-float         demod_get_freq(const Demod *self);
-float         demod_get_gain(const Demod *self);
-const int8_t* demod_get_buf(const Demod *self);
+const char*   demod_get_stage_name(const Demod *self, unsigned stage);
+const char*   demod_get_prof_name(unsigned step);
+const int8_t* demod_get_buf(Demod *self);
 
 #endif
@@ -0,0 +1,36 @@
+/**
+ * One-to-many fan-out of a Source. A reader thread reads the upstream Source
+ * once, and every branch (itself a Source) sees the same sequence of samples.
+ * The blocks are shared between the branches, and a block is only reused
+ * once all of them have consumed it, so the slowest branch sets the pace.
+ */
+#ifndef METEOR_FANOUT_H
+#define METEOR_FANOUT_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include "ring.h"
+#include "source.h"
+
+typedef struct {
+	Source *upstream;
+	RingBlock *blocks;
+	unsigned nblocks;
+	size_t chunk_size;
+	unsigned head;          /* Advanced by the reader thread only */
+
+	Source **branches;
+	unsigned *tails;        /* One per branch, advanced by that branch only */
+	int *detached;          /* Closed branches, that no longer hold blocks back */
+	unsigned count;
+
+	pthread_t t;
+	volatile int stop;
+	int eof;
+} Fanout;
+
+Fanout* fanout_init(Source *upstream, unsigned count, size_t chunk_size);
+Source* fanout_branch(Fanout *self, unsigned idx);
+void    fanout_free(Fanout *self);
+
+#endif
@@ -7,6 +7,7 @@
 #define METEOR_FILTERS_H
 
 #include <complex.h>
+#include <stdlib.h>
 
 typedef struct {
 	float complex *restrict mem;
@@ -22,6 +23,7 @@ Filter*       filter_copy(const Filter *orig);
 Filter*       filter_rrc(unsigned order, unsigned factor, float osf, float alpha);
 
 float complex filter_fwd(Filter *flt, float complex in);
+void          filter_fwd_block(const Filter *flt, const float complex *in, float complex *out, size_t count);
 void          filter_free(Filter *flt);
 
 #endif
@@ -0,0 +1,45 @@
+/**
+ * Phase ambiguity resolution, as a demodulator sink. The Costas loop can lock
+ * in any of four phases (and the I/Q branches may be swapped), so the sync
+ * marker at the start of each frame is used to find out which of the 8
+ * rotation/mirror states the stream is in. The symbols are passed on rotated
+ * back to the canonical orientation, the one the marker is sent in (a negative
+ * soft value is a 1), with a delay of ASM_SYMS symbols, and the state is
+ * tracked at every marker to follow phase slips.
+ */
+#ifndef METEOR_FRAMESYNC_H
+#define METEOR_FRAMESYNC_H
+
+#include <stdint.h>
+#include "cadu.h"
+#include "correlator.h"
+#include "demod.h"
+
+typedef struct {
+	uint64_t markers;       /* Markers found where expected */
+	uint64_t slips;
+	uint64_t sync_lost;
+	int locked;
+	int state;
+} FrameSyncStats;
+
+typedef struct {
+	Correlator corr;
+	DemodSink next;
+	void *next_ctx;
+
+	int8_t *buf;
+	size_t len, size;
+	size_t next_asm;        /* Symbols until the next expected marker */
+	int checked;            /* Whether the marker at next_asm was checked */
+	unsigned misses;
+	FrameSyncStats stats;
+} FrameSync;
+
+FrameSync* framesync_init(DemodSink next, void *next_ctx);
+void       framesync_sink(const int8_t *syms, size_t len, void *ctx);
+void       framesync_flush(FrameSync *self);
+void       framesync_get_stats(const FrameSync *self, FrameSyncStats *stats);
+void       framesync_free(FrameSync *self);
+
+#endif
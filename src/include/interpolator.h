@@ -6,8 +6,12 @@
 #ifndef METEOR_INTERPOLATOR_H
 #define METEOR_INTERPOLATOR_H
 
+#include <stdint.h>
+#include "filters.h"
 #include "source.h"
 
-Source* interp_init(Source *src, float alpha, unsigned order, unsigned factor, int sym_rate);
+Source* interp_init(Source *src, float alpha, unsigned order, unsigned factor, int sym_rate, unsigned nworkers);
+Filter* interp_get_filter(const Source *self);
+void    interp_get_times(const Source *self, uint64_t *read_ns, uint64_t *filter_ns);
 
 #endif
@@ -0,0 +1,77 @@
+/**
+ * Multi-stream demodulator: the AGC, Gardner timing recovery and Costas loop
+ * of up to LANES independent streams are stored as struct-of-arrays, and
+ * advanced together one sample at a time with GCC vector extensions, so that
+ * the feedback loops that can't be vectorized along time are vectorized
+ * across streams instead. Each lane has its own filter/interpolator Source and
+ * its own parameters; the lanes only have to share the input samplerate.
+ * Lanes whose filter settings are the same as an earlier lane's reuse its
+ * filtered samples instead of reading from their own Source.
+ */
+#ifndef METEOR_LANES_H
+#define METEOR_LANES_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include "demod.h"
+#include "pll.h"
+#include "source.h"
+
+/* Streams advanced together: 8 fills an AVX2 register, 16 an AVX-512 one */
+#ifndef LANES
+#define LANES 8
+#endif
+
+typedef float   vlanef __attribute__((vector_size(LANES*sizeof(float))));
+typedef int32_t vlanei __attribute__((vector_size(LANES*sizeof(int32_t))));
+
+typedef struct {
+	unsigned count;                 /* Lanes in use */
+	Source *src[LANES];             /* Filtered and interpolated samples */
+	unsigned filt[LANES];           /* Lane whose src is used */
+	unsigned sym_rate[LANES];
+	unsigned skip[LANES];
+	int eof[LANES];
+	float *soa_re, *soa_im;         /* Current chunk, sample-major */
+
+	/* AGC */
+	vlanef agc_avg, agc_gain, agc_bias_re, agc_bias_im;
+	/* Gardner timing recovery, only the Q branch is needed */
+	vlanef period, offset, before, mid;
+	/* Costas loop */
+	vlanef nco_phase, nco_freq, cst_avg;
+	vlanef alpha, beta;             /* While unlocked */
+	vlanef alpha_locked, beta_locked;
+	vlanei locked;
+	float lut_tanh[COSTAS_LUT_SIZE];
+
+	/* Output */
+	DemodSink sink[LANES];
+	void *sink_ctx[LANES];
+	FILE *out_fd[LANES];
+	int8_t out_buf[LANES][SYM_CHUNKSIZE];
+	unsigned out_offset[LANES];
+
+	double evm_abs[LANES], evm_pow[LANES];
+	DemodStats local_stats[LANES];
+	unsigned stats_seq;
+	DemodStats stats[LANES];
+
+	pthread_t t;
+	volatile int thr_is_running;
+	int event_fd;                   /* eventfd, readable once the thread stops */
+} Lanes;
+
+Lanes* lanes_init(Source *const *srcs, const DemodParams *params, unsigned count);
+int    lanes_shares_filter(const Lanes *self, unsigned lane);
+void   lanes_set_sink(Lanes *self, unsigned lane, DemodSink sink, void *ctx);
+int    lanes_step(Lanes *self);
+void   lanes_flush(Lanes *self);
+void   lanes_start(Lanes *self, const char *const *fnames);
+void   lanes_join(Lanes *self);
+int    lanes_status(const Lanes *self);
+int    lanes_get_event_fd(const Lanes *self);
+void   lanes_get_stats(const Lanes *self, unsigned lane, DemodStats *stats);
+void   lanes_free(Lanes *self);
+
+#endif
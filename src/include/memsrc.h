@@ -0,0 +1,13 @@
+/**
+ * In-memory Source, fed by the caller one block at a time. This is what the
+ * push API uses to run samples through the interpolator.
+ */
+#ifndef METEOR_MEMSRC_H
+#define METEOR_MEMSRC_H
+
+#include "source.h"
+
+Source* memsrc_init(unsigned samplerate);
+void    memsrc_feed(Source *self, const float complex *data, size_t count);
+
+#endif
@@ -0,0 +1,31 @@
+/**
+ * Public interface of libmeteordemod. Programs embedding the demodulator only
+ * need to include this header and link against -lmeteordemod -lm -lpthread.
+ *
+ * Threadless usage:
+ *   d = demod_init_push(samplerate, &params);
+ *   demod_set_sink(d, callback, ctx);      (or pass a buffer to demod_push)
+ *   while (...) demod_push(d, samples, count, NULL, 0);
+ *   demod_free(d);
+ *
+ * A buffer passed to demod_push() should hold demod_max_output() bytes: with no
+ * sink set, the symbols that don't fit are dropped, and counted in the
+ * push_dropped field of demod_get_stats().
+ */
+#ifndef METEOR_METEORDEMOD_H
+#define METEOR_METEORDEMOD_H
+
+#include "source.h"
+#include "wavfile.h"
+#include "demod.h"
+#include "checkpoint.h"
+#include "cadu.h"
+#include "symwriter.h"
+#include "shmring.h"
+#include "fanout.h"
+#include "lanes.h"
+#include "metrics.h"
+#include "autotune.h"
+#include "status.h"
+
+#endif
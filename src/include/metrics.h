@@ -0,0 +1,29 @@
+/**
+ * Embedded metrics server, for Prometheus or any other scraper. A background
+ * thread listens on a Unix socket or on a TCP port and answers every HTTP GET
+ * with the demodulator status in the Prometheus text format. Everything is read
+ * from the lock-free stats snapshot and from counters the stages already keep,
+ * so a scrape never stalls the processing threads.
+ */
+#ifndef METEOR_METRICS_H
+#define METEOR_METRICS_H
+
+#include <pthread.h>
+#include "demod.h"
+#include "shmring.h"
+
+typedef struct {
+	int fd;
+	char *unix_path;        /* Removed on close, NULL for TCP */
+	pthread_t t;
+	volatile int running;
+
+	const Demod *demod;
+	const ShmRing *shm;
+	unsigned samplerate;
+} Metrics;
+
+Metrics* metrics_init(const char *addr, const Demod *demod, const ShmRing *shm);
+void     metrics_close(Metrics *self);
+
+#endif
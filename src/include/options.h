@@ -7,22 +7,45 @@
 #include <getopt.h>
 #include <stdlib.h>
 
-#define SHORTOPTS "a:b:Bf:ho:O:qr:R:s:vw"
+#define SHORTOPTS "Aa:b:Bc:C:d:e:f:F:g:hj:Jl:Lm:M:o:O:p:PqQ:r:R:s:S:t:Tu:U:vwx:z"
 
 struct option longopts[] = {
 	{ "alpha",        1, NULL, 'a' },
+	{ "autotune",     0, NULL, 'A' },
 	{ "pll-bw",       1, NULL, 'b' },
+	{ "backfill",     1, NULL, 'F' },
 	{ "batch",        1, NULL, 'B' },
+	{ "canonical",    0, NULL, 'P' },
+	{ "checkpoint",   1, NULL, 'c' },
+	{ "checkpoint-interval", 1, NULL, 'C' },
+	{ "decode",       1, NULL, 'd' },
+	{ "encoding",     1, NULL, 'e' },
 	{ "fir-order",    1, NULL, 'f' },
+	{ "fir-threads",  1, NULL, 'p' },
 	{ "help",         0, NULL, 'h' },
+	{ "max-lag",      1, NULL, 'g' },
+	{ "margin",       1, NULL, 'x' },
+	{ "jobs",         1, NULL, 'j' },
+	{ "json",         0, NULL, 'J' },
+	{ "lanes",        0, NULL, 'L' },
+	{ "overlap",      1, NULL, 'l' },
+	{ "shm",          1, NULL, 'm' },
+	{ "metrics",      1, NULL, 'M' },
 	{ "output",       1, NULL, 'o' },
 	{ "oversamp",     1, NULL, 'O' },
+	{ "profile",      0, NULL, 'T' },
 	{ "quiet",        0, NULL, 'q' },
+	{ "quality",      1, NULL, 'Q' },
 	{ "refresh-rate", 1, NULL, 'R' },
 	{ "samplerate",   1, NULL, 's' },
+	{ "segments",     1, NULL, 'S' },
+	{ "status-fd",    1, NULL, 'u' },
+	{ "status-interval", 1, NULL, 'U' },
 	{ "symrate",      1, NULL, 'r' },
+	{ "threads",      1, NULL, 't' },
 	{ "version",      0, NULL, 'v' },
 	{ "wait",         0, NULL, 'w' },
+	{ "zstd",         0, NULL, 'z' },
 };
 
 
@@ -0,0 +1,26 @@
+/**
+ * Pipeline stage: a Source that reads from an upstream Source on a dedicated
+ * thread, and hands the samples over through a SPSC ring. Chaining a pipe
+ * after each expensive Source splits the processing across multiple cores.
+ */
+#ifndef METEOR_PIPE_H
+#define METEOR_PIPE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include "source.h"
+
+typedef struct {
+	uint64_t work_ns;   /* Time spent by the stage thread reading upstream */
+	uint64_t stall_ns;  /* Time spent by the stage thread waiting for a free block */
+	uint64_t starve_ns; /* Time spent by the consumer waiting for data */
+	unsigned fill;      /* Blocks currently queued */
+	unsigned nblocks;
+} PipeStats;
+
+Source* pipe_init(Source *upstream, size_t chunk_size, int cpu);
+void    pipe_get_stats(const Source *self, PipeStats *stats);
+int     pin_thread(pthread_t thr, int cpu);
+void    backoff(unsigned *spins);
+
+#endif
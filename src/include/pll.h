@@ -11,6 +11,13 @@
 /* Costas loop default parameters */
 #define COSTAS_DAMP 1/M_SQRT2
 #define COSTAS_INIT_FREQ 0.001
+#define COSTAS_LUT_SIZE 256
+#define COSTAS_FREQ_MAX 0.8
+#define COSTAS_AVG_WINSIZE 40000
+
+/* Lock detector thresholds, on the moving average of the phase error */
+#define COSTAS_LOCK_THRESH 0.3
+#define COSTAS_UNLOCK_THRESH 0.35
 
 typedef struct {
 	float nco_phase, nco_freq;
@@ -18,6 +25,7 @@ typedef struct {
 	float damping, bw;
 	int locked;
 	float moving_avg;
+	float lut_tanh[COSTAS_LUT_SIZE];
 } Costas;
 
 Costas*       costas_init(float bw);
@@ -0,0 +1,29 @@
+/**
+ * Minimal fork-join thread pool: pool_run() calls the same function on every
+ * worker (and on the calling thread), each one getting its own slice index,
+ * and returns once all of them are done.
+ */
+#ifndef METEOR_POOL_H
+#define METEOR_POOL_H
+
+#include <pthread.h>
+
+typedef void (*PoolFn)(void *arg, unsigned idx, unsigned count);
+
+typedef struct {
+	pthread_t *threads;
+	unsigned count;         /* Total parallelism, calling thread included */
+	pthread_mutex_t mutex;
+	pthread_cond_t start, finish;
+	PoolFn fn;
+	void *arg;
+	unsigned generation;
+	unsigned pending;
+	int quit;
+} Pool;
+
+Pool* pool_init(unsigned count);
+void  pool_run(Pool *self, PoolFn fn, void *arg);
+void  pool_free(Pool *self);
+
+#endif
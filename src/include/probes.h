@@ -0,0 +1,38 @@
+/**
+ * USDT static tracepoints, to follow a running demodulator with bpftrace, perf
+ * or systemtap without rebuilding it. They are compiled in by default when
+ * <sys/sdt.h> (systemtap-sdt-dev or systemtap-sdt-devel) is available, and
+ * expand to nothing otherwise or with "make SDT=0". A probe that nothing is
+ * attached to is a single nop in the code, plus a note in the ELF file.
+ *
+ * All the probes belong to the "meteor_demod" provider. Arguments are
+ * integers, so that every tracer can read them:
+ *
+ *   read_start(count)                 a sample source is asked for count samples
+ *   read_done(count, total)           it returned count samples, total so far
+ *   filter_start(count)               the RRC filter starts on count samples
+ *   filter_done(count, ns)            it's done, after ns nanoseconds
+ *   sync_start(count)                 a chunk enters the AGC/timing/Costas loop
+ *   sync_done(count, nsyms)           it's done, producing nsyms symbols
+ *   pll_lock(freq, avg)               the Costas loop locked
+ *   pll_unlock(freq, avg)             the Costas loop lost the lock
+ *   timing_slip(dir, symbol)          the symbol clock moved by a whole sample
+ *   output_flush(len, symbols)        len bytes were handed to the sink
+ *
+ * freq is the NCO frequency in microradians per symbol, avg the lock detector
+ * output times 1e6, dir +1 or -1 and symbol the number of symbols output
+ */
+#ifndef METEOR_PROBES_H
+#define METEOR_PROBES_H
+
+#ifdef HAVE_SDT
+#include <sys/sdt.h>
+
+#define PROBE1(name, a)       DTRACE_PROBE1(meteor_demod, name, a)
+#define PROBE2(name, a, b)    DTRACE_PROBE2(meteor_demod, name, a, b)
+#else
+#define PROBE1(name, a)
+#define PROBE2(name, a, b)
+#endif
+
+#endif
@@ -0,0 +1,34 @@
+/**
+ * Lock-free single-producer/single-consumer ring of preallocated sample
+ * blocks, used to connect the pipeline stages running on different threads
+ */
+#ifndef METEOR_RING_H
+#define METEOR_RING_H
+
+#include <complex.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef struct {
+	float complex *data;
+	size_t count;
+	uint64_t done;      /* Upstream position after this block was read */
+} RingBlock;
+
+typedef struct {
+	RingBlock *blocks;
+	unsigned nblocks;
+	size_t block_size;
+	unsigned head;      /* Advanced by the producer only */
+	unsigned tail;      /* Advanced by the consumer only */
+} Ring;
+
+Ring*      ring_init(unsigned nblocks, size_t block_size);
+RingBlock* ring_write_acquire(Ring *self);
+void       ring_write_commit(Ring *self);
+RingBlock* ring_read_acquire(Ring *self);
+void       ring_read_release(Ring *self);
+unsigned   ring_fill(const Ring *self);
+void       ring_free(Ring *self);
+
+#endif
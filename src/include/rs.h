@@ -0,0 +1,19 @@
+/**
+ * Reed-Solomon (255,223) code with the CCSDS parameters used by LRPT: field
+ * generator 0x187, first consecutive root 112, primitive element 11, and
+ * symbols in the dual basis representation. Codewords can be interleaved with
+ * other data, $stride bytes apart.
+ */
+#ifndef METEOR_RS_H
+#define METEOR_RS_H
+
+#include <stdint.h>
+
+#define RS_N 255
+#define RS_ROOTS 32
+#define RS_K (RS_N - RS_ROOTS)
+
+int  rs_decode(uint8_t *data, unsigned stride);
+void rs_encode(uint8_t *data, unsigned stride);
+
+#endif
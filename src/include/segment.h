@@ -0,0 +1,40 @@
+/**
+ * Segment-parallel offline demodulation. The input recording is split into
+ * overlapping segments, each one processed by an independent Demod on its own
+ * thread. Once all of them are done, their outputs are stitched back together,
+ * using the overlap to align the symbol boundaries and to undo the QPSK phase
+ * ambiguity at each seam.
+ */
+#ifndef METEOR_SEGMENT_H
+#define METEOR_SEGMENT_H
+
+#include <poll.h>
+#include <stdint.h>
+#include "demod.h"
+#include "source.h"
+
+typedef struct {
+	Source *src, *slice;
+	Demod *demod;
+	uint64_t lead_in;       /* Samples of overlap with the previous segment */
+	char *tmp_fname;
+} Segment;
+
+typedef struct {
+	Segment *segs;
+	struct pollfd *fds;     /* Event fds of the segments still running */
+	unsigned count;
+	unsigned samplerate;
+	DemodParams params;
+	uint64_t total;
+} Segmenter;
+
+Segmenter* segmenter_init(const char *fname, unsigned samplerate, const DemodParams *params, unsigned count, float overlap);
+void       segmenter_start(Segmenter *self, const char *out_fname);
+int        segmenter_status(const Segmenter *self);
+void       segmenter_wait(Segmenter *self, int timeout);
+void       segmenter_get_stats(const Segmenter *self, DemodStats *stats);
+uint64_t   segmenter_get_size(const Segmenter *self);
+int        segmenter_join(Segmenter *self, const char *out_fname);
+
+#endif
@@ -0,0 +1,63 @@
+/**
+ * Soft symbol output to a named POSIX shared-memory ring buffer, so that a
+ * decoder running on the same machine can read the symbols in place. The
+ * segment starts with a ShmRingHeader, followed by the data area at offset
+ * header_size. Both sides only ever increase their position counters; the
+ * byte at position p is stored at data[p % size]. The producer never blocks:
+ * if the consumer falls behind, whole chunks are dropped and counted in
+ * overruns. A consumer waiting for data sleeps on the write_seq futex, after
+ * setting the waiting flag so that the producer knows to wake it up.
+ */
+#ifndef METEOR_SHMRING_H
+#define METEOR_SHMRING_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "demod.h"
+
+#define SHMRING_MAGIC "MDSR"
+#define SHMRING_VERSION 1
+
+typedef struct {
+	char magic[4];
+	uint32_t version;
+	uint32_t header_size;       /* Offset of the data area */
+	uint32_t sym_rate;
+	uint64_t size;              /* Size of the data area, a power of two */
+
+	/* Written by the producer */
+	uint64_t write_pos;         /* Total bytes written */
+	uint64_t write_ns;          /* CLOCK_MONOTONIC time of the last write */
+	uint64_t overruns;          /* Bytes dropped because the ring was full */
+	uint32_t write_seq;         /* Futex word, incremented after each write */
+	uint32_t closed;            /* Set once the producer is done */
+
+	/* Written by the consumer */
+	uint64_t read_pos __attribute__((aligned(64)));     /* Total bytes consumed */
+	uint32_t waiting;           /* Set while sleeping on write_seq */
+} ShmRingHeader;
+
+typedef struct {
+	char *name;
+	ShmRingHeader *hdr;
+	int8_t *data;
+	size_t map_size;
+	int owner;
+
+	DemodSink next;
+	void *next_ctx;
+} ShmRing;
+
+/* Producer side */
+ShmRing* shmring_create(const char *name, size_t size, unsigned sym_rate, DemodSink next, void *next_ctx);
+void     shmring_sink(const int8_t *syms, size_t len, void *ctx);
+
+/* Consumer side */
+ShmRing* shmring_open(const char *name);
+size_t   shmring_read_acquire(ShmRing *self, const int8_t **syms, int timeout_ms);
+void     shmring_read_release(ShmRing *self, size_t len);
+int      shmring_eof(const ShmRing *self);
+
+void     shmring_close(ShmRing *self);
+
+#endif
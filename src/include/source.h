@@ -19,6 +19,7 @@ typedef struct sample {
 	int (*close)(struct sample *);
 	uint64_t (*size)(const struct sample *);
 	uint64_t (*done)(const struct sample *);
+	int (*seek)(struct sample *, uint64_t);   /* NULL if not seekable */
 	void *_backend;     /* Opaque pointer to stuff used by read() and close() */
 } Source;
 
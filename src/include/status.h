@@ -0,0 +1,47 @@
+/**
+ * Machine-readable status stream, for supervisors that would otherwise scrape
+ * the log: one JSON object per line, written to a file descriptor. Events are
+ * built from the stats snapshot on the UI thread, and written out by a thread
+ * of their own, so the descriptor is left in the mode it was inherited in and
+ * a slow reader never holds up the program: if it falls behind, events are
+ * dropped (and counted) instead.
+ */
+#ifndef METEOR_STATUS_H
+#define METEOR_STATUS_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include "demod.h"
+
+#define STATUS_BUF_SIZE 65536
+
+typedef struct {
+	int fd;
+	uint64_t interval_ns, next_ns;
+	unsigned samplerate;
+	uint64_t in_size;
+
+	/* Last state reported */
+	int locked;
+	unsigned level_changes;
+	uint64_t prev_in_done, prev_wall_ns;
+
+	/* Events waiting for the writer thread, which swaps the two buffers */
+	pthread_t t;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int closing, failed;
+	unsigned long dropped;
+	char *buf, *wbuf;
+	size_t len;
+} StatusStream;
+
+StatusStream* status_init(int fd, unsigned interval_ms);
+void          status_start(StatusStream *self, const char *in_fname, const char *out_fname,
+                           unsigned samplerate, const DemodParams *params, uint64_t in_size);
+void          status_update(StatusStream *self, const DemodStats *stats);
+void          status_finish(StatusStream *self, const DemodStats *stats, int aborted);
+uint64_t      status_due(const StatusStream *self);
+void          status_close(StatusStream *self);
+
+#endif
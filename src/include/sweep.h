@@ -0,0 +1,28 @@
+/**
+ * Parameter sweep: the input is read once and fanned out to one Demod per
+ * combination of the parameter values being tested, each running on its own
+ * thread and writing its own output. At the end, the fraction of symbols
+ * demodulated while the PLL was locked and the EVM are reported for each one.
+ */
+#ifndef METEOR_SWEEP_H
+#define METEOR_SWEEP_H
+
+#include "demod.h"
+
+/* Hard limit on the number of combinations, to catch typos */
+#define SWEEP_MAX_RUNS 64
+
+/* Parameters that can be swept, each one given as a comma-separated list */
+enum {
+	SWEEP_PLL_BW = 0,
+	SWEEP_ALPHA,
+	SWEEP_FIR_ORDER,
+	SWEEP_OVERSAMP,
+	SWEEP_NPARAMS
+};
+
+int sweep_run(const char *in_fname, const char *out_prefix, unsigned samplerate, const DemodParams *params,
+              char *const lists[SWEEP_NPARAMS], int use_lanes, int upd_interval, int quiet,
+              int (*log)(const char *msg, ...));
+
+#endif
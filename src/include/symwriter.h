@@ -0,0 +1,58 @@
+/**
+ * Compact soft symbol output, as a demodulator sink. The int8_t symbols are
+ * quantized and packed to 4 bits, 3 bits or hard decisions, and the result
+ * is optionally wrapped in a zstd-compressed container whose header records
+ * how to interpret the stream.
+ */
+#ifndef METEOR_SYMWRITER_H
+#define METEOR_SYMWRITER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "demod.h"
+
+/* Symbols quantized and packed at a time */
+#define PACK_BLOCK 64
+
+#define SYMFILE_MAGIC "MDSY"
+#define SYMFILE_VERSION 1
+
+typedef enum {
+	SYMFMT_S8 = 0,      /* Plain int8_t soft symbols */
+	SYMFMT_S4,          /* 4-bit two's complement, two per byte, high nibble first */
+	SYMFMT_S3,          /* 3-bit two's complement, eight per three bytes, MSB first */
+	SYMFMT_HARD         /* One bit per symbol, 1 if non-negative, MSB first */
+} SymFormat;
+
+/* Container header, stored uncompressed at the start of the file */
+typedef struct {
+	char magic[4];
+	uint32_t sym_rate;
+	uint64_t sample_offset;     /* Input sample the first symbol was taken from */
+	uint8_t version;
+	uint8_t format;             /* SymFormat */
+	uint8_t compression;        /* 0: none, 1: zstd */
+	uint8_t reserved[5];
+} SymHeader;
+
+typedef struct {
+	FILE *fd;
+	SymFormat fmt;
+	int8_t pending[PACK_BLOCK];
+	size_t npending;
+	uint8_t *packed;
+	size_t npacked;
+	int compress;
+	void *zstd;                 /* ZSTD_CCtx, if built with zstd support */
+	uint8_t *zbuf;
+	size_t zbuf_size;
+} SymWriter;
+
+SymWriter* symwriter_init(FILE *fd, SymFormat fmt, int compress, unsigned sym_rate, uint64_t sample_offset);
+void       symwriter_sink(const int8_t *syms, size_t len, void *ctx);
+void       symwriter_close(SymWriter *self);
+
+int        symwriter_parse_format(const char *name, SymFormat *fmt);
+size_t     symwriter_pack(SymFormat fmt, const int8_t *in, uint8_t *out);
+
+#endif
@@ -0,0 +1,25 @@
+/**
+ * Wait-free triple buffer, used to hand data from the worker thread to the UI.
+ * The writer fills the back buffer and publishes it, the reader picks up the
+ * most recently published buffer; neither side ever waits for the other.
+ */
+#ifndef METEOR_TRIPLEBUF_H
+#define METEOR_TRIPLEBUF_H
+
+#include <stdlib.h>
+
+typedef struct {
+	void *buf[3];
+	size_t size;
+	unsigned back;      /* Owned by the writer */
+	unsigned front;     /* Owned by the reader */
+	unsigned middle;    /* Shared, index of the spare buffer plus a dirty flag */
+} TripleBuf;
+
+TripleBuf*  triplebuf_init(size_t size);
+void*       triplebuf_back(TripleBuf *self);
+void        triplebuf_publish(TripleBuf *self);
+const void* triplebuf_read(TripleBuf *self);
+void        triplebuf_free(TripleBuf *self);
+
+#endif
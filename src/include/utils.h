@@ -8,6 +8,7 @@
 #define MIN(X, Y) (X < Y) ? X : Y
 
 #include <complex.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 int8_t clamp(float x);
@@ -17,6 +18,8 @@ int    slice(float x);
 void   humanize(size_t count, char *buf);
 char*  gen_fname(void);
 void   seconds_to_str(unsigned secs, char *buf);
+uint64_t get_time_ns(void);
+void   get_cpu_model(char *buf, size_t len);
 
 void   usage(const char *pname);
 void   fatal(const char *msg);
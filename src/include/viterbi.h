@@ -0,0 +1,31 @@
+/**
+ * Soft-decision Viterbi decoder for the K=7, r=1/2 convolutional code used by
+ * LRPT (CCSDS polynomials 0171 and 0133, no inversion). The add-compare-select
+ * step updates all 64 states at once using GCC vector extensions, which turn
+ * into SSE/AVX2 (or NEON) instructions depending on -march.
+ */
+#ifndef METEOR_VITERBI_H
+#define METEOR_VITERBI_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define VITERBI_K 7
+#define VITERBI_STATES (1 << (VITERBI_K-1))
+#define VITERBI_POLY_A 0x4F     /* 0171, newest bit in the LSB */
+#define VITERBI_POLY_B 0x6D     /* 0133 */
+
+typedef int16_t v32s __attribute__((vector_size(VITERBI_STATES/2 * sizeof(int16_t))));
+
+typedef struct {
+	v32s (*decisions)[2];
+	size_t max_len;
+} Viterbi;
+
+Viterbi* viterbi_init(size_t max_len);
+void     viterbi_decode(Viterbi *self, const int8_t *soft, size_t len, uint8_t *out, size_t out_bits);
+void     viterbi_free(Viterbi *self);
+
+int      conv_encode(unsigned *reg, int bit);
+
+#endif
@@ -27,5 +27,6 @@ struct wave_header
 };
 
 Source* open_samples_file(const char *fname, unsigned samplerate);
+Source* try_open_samples_file(const char *fname, unsigned samplerate, const char **err);
 
 #endif
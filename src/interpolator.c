@@ -2,22 +2,36 @@
 #include <stdlib.h>
 #include "filters.h"
 #include "interpolator.h"
+#include "pool.h"
+#include "probes.h"
 #include "utils.h"
 
+/* Don't bother splitting chunks into slices shorter than this */
+#define MIN_SLICE_SIZE 4096
+
 static int      interp_read(Source *self, size_t count);
 static int      interp_free(Source *self);
 static uint64_t interp_get_done(const Source *self);
 static uint64_t interp_get_size(const Source *self);
+static int      interp_seek(Source *self, uint64_t pos);
+static void     interp_filter_slice(void *arg, unsigned idx, unsigned count);
 
 typedef struct {
 	Source *src;
 	Filter *rrc;
 	unsigned factor;
+	Pool *pool;
+	float complex *in;      /* Upsampled input, preceded by the filter history */
+	size_t in_size;
+	size_t count;           /* Number of samples in the current chunk */
+	float complex *out;
+	uint64_t read_ns, filter_ns;    /* Time spent reading and filtering */
 } InterpState;
 
-/* Initialize the interpolator, which will use a RRC filter at its core */
+/* Initialize the interpolator, which will use a RRC filter at its core. With
+ * nworkers > 1, each chunk is split into slices filtered in parallel */
 Source*
-interp_init(Source* src, float alpha, unsigned order, unsigned factor, int sym_rate)
+interp_init(Source* src, float alpha, unsigned order, unsigned factor, int sym_rate, unsigned nworkers)
 {
 	Source *interp;
 	InterpState *status;
@@ -32,6 +46,7 @@ interp_init(Source* src, float alpha, unsigned order, unsigned factor, int sym_r
 	interp->close = interp_free;
 	interp->done = interp_get_done;
 	interp->size = interp_get_size;
+	interp->seek = src->seek ? interp_seek : NULL;
 
 	interp->_backend = safealloc(sizeof(InterpState));
 	status = (InterpState*) interp->_backend;
@@ -39,10 +54,33 @@ interp_init(Source* src, float alpha, unsigned order, unsigned factor, int sym_r
 	status->factor = factor;
 	status->src = src;
 	status->rrc = filter_rrc(order, factor, src->samplerate/(float)sym_rate, alpha);
+	status->pool = (nworkers > 1) ? pool_init(nworkers) : NULL;
+	status->in = NULL;
+	status->in_size = 0;
+	status->read_ns = 0;
+	status->filter_ns = 0;
 
 	return interp;
 }
 
+/* Get the RRC filter of an interpolator, e.g. to save or restore its memory */
+Filter*
+interp_get_filter(const Source *self)
+{
+	return ((InterpState*)self->_backend)->rrc;
+}
+
+/* Get the time spent reading from the underlying source and filtering so far.
+ * Can be called from any thread */
+void
+interp_get_times(const Source *self, uint64_t *read_ns, uint64_t *filter_ns)
+{
+	const InterpState *state = self->_backend;
+
+	*read_ns = __atomic_load_n(&state->read_ns, __ATOMIC_RELAXED);
+	*filter_ns = __atomic_load_n(&state->filter_ns, __ATOMIC_RELAXED);
+}
+
 /* Static functions {{{ */
 /* Wrapper to interpolate the source data and provide a transparent translation
  * layer between the raw samples and the interpolated samples */
@@ -68,9 +106,11 @@ interp_read(Source *const self, size_t count)
 	InterpState *status;
 	Filter *rrc;
 	Source *src;
-	unsigned i;
+	float complex *in;
+	unsigned i, history;
 	int factor;
 	size_t true_samp_count;
+	uint64_t t0, t1;
 
 	/* Retrieve the backend info */
 	status = (InterpState*)self->_backend;
@@ -90,25 +130,102 @@ interp_read(Source *const self, size_t count)
 	true_samp_count = count / factor;
 
 	/* Read the true samples from the associated source */
+	t0 = get_time_ns();
 	true_samp_count = src->read(src, true_samp_count);
+	t1 = get_time_ns();
+	__atomic_store_n(&status->read_ns, status->read_ns + t1 - t0, __ATOMIC_RELAXED);
 	if (!true_samp_count) {
 		return 0;
 	}
 
-	/* Feed through the filter, with zero-order hold interpolation */
+	/* Only output as many samples as the source could provide */
+	count = true_samp_count * factor;
+
+	PROBE1(filter_start, count);
+
+	/* Prepare the filter input: the filter memory, followed by the new
+	 * samples with zero-order hold interpolation */
+	history = rrc->fwd_count - 1;
+	if (status->in_size < history + count) {
+		free(status->in);
+		status->in_size = history + count;
+		status->in = safealloc(sizeof(*status->in) * status->in_size);
+	}
+	in = status->in;
+	for (i=0; i<history; i++) {
+		in[history-1-i] = rrc->mem[i];
+	}
 	for (i=0; i<count; i++) {
-		self->data[i] = filter_fwd(rrc, src->data[i/factor]);
+		in[history+i] = src->data[i/factor];
+	}
+
+	/* Feed through the filter, possibly splitting the chunk across the
+	 * worker pool. Each slice reads the samples before it as history */
+	status->count = count;
+	status->out = self->data;
+	if (status->pool && count >= MIN_SLICE_SIZE * status->pool->count) {
+		pool_run(status->pool, interp_filter_slice, status);
+	} else {
+		interp_filter_slice(status, 0, 1);
 	}
 
+	/* Save the most recent samples as the new filter memory */
+	for (i=0; i<rrc->fwd_count; i++) {
+		rrc->mem[i] = in[history+count-1-i];
+	}
+	t0 = get_time_ns();
+	__atomic_store_n(&status->filter_ns, status->filter_ns + t0 - t1, __ATOMIC_RELAXED);
+	PROBE2(filter_done, count, t0 - t1);
+
 	return count;
 }
 
+/* Seek the underlying source, and flush the filter memory so that no samples
+ * from the old position leak into the new one */
+int
+interp_seek(Source *self, uint64_t pos)
+{
+	InterpState *state;
+	Filter *rrc;
+	unsigned i;
+
+	state = (InterpState*)self->_backend;
+	rrc = state->rrc;
+	for (i=0; i<rrc->fwd_count; i++) {
+		rrc->mem[i] = 0;
+	}
+
+	return state->src->seek(state->src, pos);
+}
+
+/* Filter the $idx-th of $count slices of the current chunk */
+void
+interp_filter_slice(void *arg, unsigned idx, unsigned count)
+{
+	InterpState *state;
+	size_t start, end, history;
+
+	state = (InterpState*)arg;
+	history = state->rrc->fwd_count - 1;
+	start = state->count * idx / count;
+	end = state->count * (idx+1) / count;
+
+	filter_fwd_block(state->rrc, state->in + history + start, state->out + start, end - start);
+}
+
 /* Free the memory related to the interpolator. Note that this function does not
  * try to close the underlying data source (aka self->_backend->src) */
 int
 interp_free(Source *self)
 {
-	filter_free(((InterpState*)(self->_backend))->rrc);
+	InterpState *state;
+
+	state = (InterpState*)self->_backend;
+	if (state->pool) {
+		pool_free(state->pool);
+	}
+	filter_free(state->rrc);
+	free(state->in);
 	free(self->_backend);
 	free(self->data);
 	free(self);
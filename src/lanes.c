@@ -0,0 +1,494 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "agc.h"
+#include "interpolator.h"
+#include "lanes.h"
+#include "utils.h"
+
+static void   lanes_process(Lanes *self, const vlanei start, const vlanei end, int count);
+static void   lanes_emit(Lanes *self, vlanei sym, vlanef re, vlanef im);
+static void   lanes_publish_stats(Lanes *self);
+static void*  lanes_thr_run(void *x);
+static vlanef vblend(vlanei mask, vlanef a, vlanef b);
+static int    vany(vlanei mask);
+static vlanef vsqrt(vlanef x);
+static vlanef vlut_tanh(const float *lut, vlanef x);
+static void   vsincos(vlanef x, vlanef *s, vlanef *c);
+
+/* Initialize $count lanes, each one reading from $srcs[i] with the settings in
+ * $params[i]. Filtering is done by each lane's own interpolator, unless an
+ * earlier lane has the same filter settings */
+Lanes*
+lanes_init(Source *const *srcs, const DemodParams *params, unsigned count)
+{
+	Lanes *ret;
+	Costas *cst;
+	unsigned i, j;
+
+	if (count < 1 || count > LANES) {
+		fatal("Invalid number of lanes");
+	}
+
+	/* The vector members need more than malloc()'s alignment */
+	if (posix_memalign((void**)&ret, sizeof(vlanef), sizeof(*ret))) {
+		fatal("Failed to allocate memory");
+	}
+	memset(ret, 0, sizeof(*ret));
+	ret->count = count;
+	ret->soa_re = safealloc(sizeof(*ret->soa_re) * CHUNKSIZE * LANES);
+	ret->soa_im = safealloc(sizeof(*ret->soa_im) * CHUNKSIZE * LANES);
+
+	for (i=0; i<LANES; i++) {
+		/* Unused lanes are kept running on silence, with the first lane's
+		 * settings, and their output is discarded */
+		const DemodParams *p = &params[i < count ? i : 0];
+
+		ret->eof[i] = i >= count;
+		ret->filt[i] = i;
+		for (j=0; j<i && i<count; j++) {
+			if (params[j].rrc_alpha == p->rrc_alpha && params[j].rrc_order == p->rrc_order &&
+			    params[j].interp_factor == p->interp_factor && params[j].sym_rate == p->sym_rate) {
+				ret->filt[i] = ret->filt[j];
+				break;
+			}
+		}
+		if (i < count) {
+			ret->skip[i] = p->rrc_order * p->interp_factor;
+			if (ret->filt[i] == i) {
+				ret->src[i] = interp_init(srcs[i], p->rrc_alpha, p->rrc_order, p->interp_factor, p->sym_rate, 1);
+			}
+		}
+		ret->sym_rate[i] = p->sym_rate;
+
+		ret->agc_avg[i] = AGC_TARGET;
+		ret->agc_gain[i] = 1;
+		ret->period[i] = srcs[i < count ? i : 0]->samplerate * p->interp_factor / (float)p->sym_rate;
+
+		/* Same coefficients as costas_init(), halving the bandwidth on lock */
+		cst = costas_init(2*M_PI*p->pll_bw/p->sym_rate);
+		ret->nco_freq[i] = cst->nco_freq;
+		ret->cst_avg[i] = cst->moving_avg;
+		ret->alpha[i] = cst->alpha;
+		ret->beta[i] = cst->beta;
+		costas_recompute_coeffs(cst, cst->damping, cst->bw/2);
+		ret->alpha_locked[i] = cst->alpha;
+		ret->beta_locked[i] = cst->beta;
+		if (!i) {
+			memcpy(ret->lut_tanh, cst->lut_tanh, sizeof(ret->lut_tanh));
+		}
+		costas_free(cst);
+
+		ret->local_stats[i].gain = 1;
+		ret->local_stats[i].stages = 1;
+	}
+	memcpy(ret->stats, ret->local_stats, sizeof(ret->stats));
+	ret->thr_is_running = 1;
+	if ((ret->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+		fatal("Could not create the event notifier");
+	}
+
+	return ret;
+}
+
+/* Whether $lane reuses the samples filtered for another lane. If so, its
+ * Source is never read, and the caller can close it right away */
+int
+lanes_shares_filter(const Lanes *self, unsigned lane)
+{
+	return self->filt[lane] != lane;
+}
+
+/* Send the symbols of $lane to a user-supplied sink */
+void
+lanes_set_sink(Lanes *self, unsigned lane, DemodSink sink, void *ctx)
+{
+	self->sink[lane] = sink;
+	self->sink_ctx[lane] = ctx;
+}
+
+/* Read a chunk from every lane and process it. Returns 0 once all the lanes
+ * have run out of samples */
+int
+lanes_step(Lanes *self)
+{
+	vlanei start, end;
+	int count, n, i, k, done;
+	const float complex *data;
+	unsigned f;
+
+	count = 0;
+	done = 1;
+	for (k=0; k<LANES; k++) {
+		/* Lanes sharing a filter come after the lane that owns it, which has
+		 * already been read */
+		f = self->filt[k];
+		if (f != (unsigned)k) {
+			n = end[f];
+		} else {
+			n = self->eof[k] ? 0 : self->src[k]->read(self->src[k], CHUNKSIZE);
+		}
+		if (n <= 0) {
+			self->eof[k] = 1;
+			n = 0;
+		} else {
+			done = 0;
+		}
+
+		/* Transpose the chunk, so that each sample of all the lanes can be
+		 * loaded with a single vector load */
+		data = n ? self->src[f]->data : NULL;
+		for (i=0; i<n; i++) {
+			self->soa_re[i*LANES + k] = crealf(data[i]);
+			self->soa_im[i*LANES + k] = cimagf(data[i]);
+		}
+
+		/* Discard the null samples at the beginning of each stream */
+		start[k] = MIN(self->skip[k], (unsigned)n);
+		self->skip[k] -= start[k];
+		end[k] = n;
+		count = MAX(count, n);
+	}
+	if (done) {
+		return 0;
+	}
+
+	/* Lanes that returned fewer samples are masked off past their end */
+	for (k=0; k<LANES; k++) {
+		for (i=end[k]; i<count; i++) {
+			self->soa_re[i*LANES + k] = 0;
+			self->soa_im[i*LANES + k] = 0;
+		}
+	}
+
+	lanes_process(self, start, end, count);
+	return count;
+}
+
+/* Hand the buffered symbols of all the lanes over to their sinks */
+void
+lanes_flush(Lanes *self)
+{
+	unsigned k;
+
+	for (k=0; k<self->count; k++) {
+		if (self->out_offset[k] && self->sink[k]) {
+			self->sink[k](self->out_buf[k], self->out_offset[k], self->sink_ctx[k]);
+		}
+		self->out_offset[k] = 0;
+	}
+}
+
+/* Start processing on a background thread, writing lane i to $fnames[i] */
+void
+lanes_start(Lanes *self, const char *const *fnames)
+{
+	unsigned k;
+
+	for (k=0; k<self->count; k++) {
+		if (!(self->out_fd[k] = fopen(fnames[k], "w"))) {
+			fatal("Could not open file for writing");
+		}
+		lanes_set_sink(self, k, demod_file_sink, self->out_fd[k]);
+	}
+
+	pthread_create(&self->t, NULL, lanes_thr_run, self);
+}
+
+/* Stop the background thread, and close the output files */
+void
+lanes_join(Lanes *self)
+{
+	unsigned k;
+
+	self->thr_is_running = 0;
+	pthread_join(self->t, NULL);
+
+	for (k=0; k<self->count; k++) {
+		if (self->out_fd[k]) {
+			fclose(self->out_fd[k]);
+			self->out_fd[k] = NULL;
+		}
+	}
+}
+
+int
+lanes_status(const Lanes *self)
+{
+	return self->thr_is_running;
+}
+
+/* Get a file descriptor that becomes readable when the background thread
+ * stops, for poll() */
+int
+lanes_get_event_fd(const Lanes *self)
+{
+	return self->event_fd;
+}
+
+/* Get a consistent snapshot of the status of $lane, without blocking */
+void
+lanes_get_stats(const Lanes *self, unsigned lane, DemodStats *stats)
+{
+	unsigned seq;
+
+	do {
+		seq = __atomic_load_n(&self->stats_seq, __ATOMIC_ACQUIRE);
+		*stats = self->stats[lane];
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) || seq != __atomic_load_n(&self->stats_seq, __ATOMIC_RELAXED));
+}
+
+void
+lanes_free(Lanes *self)
+{
+	unsigned k;
+
+	for (k=0; k<self->count; k++) {
+		if (self->src[k]) {
+			self->src[k]->close(self->src[k]);
+		}
+	}
+	close(self->event_fd);
+	free(self->soa_re);
+	free(self->soa_im);
+	free(self);
+}
+
+/* Static functions {{{ */
+/* Run the AGC, timing recovery and Costas loop of all the lanes over $count
+ * samples. Lane k only consumes the samples in [start[k], end[k]) */
+void
+lanes_process(Lanes *self, const vlanei start, const vlanei end, int count)
+{
+	vlanef re, im, sr, si, rho, half, err, c, s, rr, ri, phase;
+	vlanef timing_acc, nsyms;
+	vlanei idx, active, mid, sym, ev, lock, unlock;
+	const vlanef zero = {0}, one = zero + 1;
+	int i, k;
+
+	half = self->period / 2;
+	timing_acc = zero;
+	nsyms = zero;
+	idx = (vlanei){0};
+
+	for (i=0; i<count; i++, idx += 1) {
+		active = (idx >= start) & (idx < end);
+
+		/* Timing recovery events: the sample halfway between two symbols, and
+		 * the symbol itself */
+		mid = active & (self->offset >= half) & (self->offset < half + 1);
+		sym = active & ~mid & (self->offset >= self->period);
+		ev = mid | sym;
+		self->offset = vblend(active, self->offset + 1, self->offset);
+
+		if (!vany(ev)) {
+			continue;
+		}
+
+		/* AGC, only advanced on the lanes that use this sample */
+		memcpy(&re, self->soa_re + i*LANES, sizeof(re));
+		memcpy(&im, self->soa_im + i*LANES, sizeof(im));
+		self->agc_bias_re = vblend(ev, (self->agc_bias_re * (AGC_BIAS_WINSIZE-1) + re) / (AGC_BIAS_WINSIZE), self->agc_bias_re);
+		self->agc_bias_im = vblend(ev, (self->agc_bias_im * (AGC_BIAS_WINSIZE-1) + im) / (AGC_BIAS_WINSIZE), self->agc_bias_im);
+		sr = re - self->agc_bias_re;
+		si = im - self->agc_bias_im;
+		rho = vsqrt(sr*sr + si*si);
+		self->agc_avg = vblend(ev, (self->agc_avg * (AGC_WINSIZE - 1) + rho) / (AGC_WINSIZE), self->agc_avg);
+		self->agc_gain = vblend(ev, AGC_TARGET / self->agc_avg, self->agc_gain);
+		self->agc_gain = vblend(self->agc_gain > AGC_MAX_GAIN, zero + AGC_MAX_GAIN, self->agc_gain);
+		sr *= self->agc_gain;
+		si *= self->agc_gain;
+
+		self->mid = vblend(mid, si, self->mid);
+		if (!vany(sym)) {
+			continue;
+		}
+
+		/* Gardner timing error */
+		err = (si - self->before) * self->mid;
+		self->offset = vblend(sym, self->offset - self->period + err*self->period/2000000.0, self->offset);
+		self->before = vblend(sym, si, self->before);
+		timing_acc += vblend(sym, vblend(err < 0, -err, err), zero);
+		nsyms += vblend(sym, one, zero);
+
+		/* Costas loop: mix with the NCO, and correct its phase and frequency */
+		vsincos(self->nco_phase, &s, &c);
+		rr = sr*c + si*s;
+		ri = si*c - sr*s;
+		err = (ri * vlut_tanh(self->lut_tanh, rr) - rr * vlut_tanh(self->lut_tanh, ri)) / 255.0;
+		self->cst_avg = vblend(sym, (self->cst_avg * (COSTAS_AVG_WINSIZE-1) + vblend(err < 0, -err, err)) / COSTAS_AVG_WINSIZE,
+		                       self->cst_avg);
+		err = vblend(err > 1, one, vblend(err < -1, -one, err));
+
+		phase = self->nco_phase + self->nco_freq + vblend(self->locked, self->alpha_locked, self->alpha) * err;
+		phase -= __builtin_convertvector(__builtin_convertvector(phase / (float)(2*M_PI), vlanei), vlanef) * (float)(2*M_PI);
+		self->nco_phase = vblend(sym, phase, self->nco_phase);
+		self->nco_freq = vblend(sym, self->nco_freq + vblend(self->locked, self->beta_locked, self->beta) * err, self->nco_freq);
+		self->nco_freq = vblend(self->nco_freq <= (float)-COSTAS_FREQ_MAX, zero - (float)COSTAS_FREQ_MAX/2, self->nco_freq);
+		self->nco_freq = vblend(self->nco_freq >= (float)COSTAS_FREQ_MAX, zero + (float)COSTAS_FREQ_MAX/2, self->nco_freq);
+
+		/* Lock detection, switching to the narrower loop bandwidth */
+		lock = sym & ~self->locked & (self->cst_avg < (float)COSTAS_LOCK_THRESH);
+		unlock = sym & self->locked & (self->cst_avg > (float)COSTAS_UNLOCK_THRESH);
+		self->locked = (self->locked | lock) & ~unlock;
+
+		lanes_emit(self, sym, rr, ri);
+	}
+
+	/* Publish the updated status once per chunk */
+	for (k=0; k<(int)self->count; k++) {
+		self->local_stats[k].in_done = self->src[self->filt[k]]->done(self->src[self->filt[k]]);
+		self->local_stats[k].freq = self->nco_freq[k]*self->sym_rate[k]/(2*M_PI);
+		self->local_stats[k].gain = self->agc_gain[k];
+		if (nsyms[k] > 0) {
+			self->local_stats[k].timing_err = timing_acc[k]*self->period[k]/2000000.0/nsyms[k];
+		}
+		self->local_stats[k].pll_locked = !!self->locked[k];
+	}
+	lanes_publish_stats(self);
+}
+
+/* Append the symbols of the lanes in $sym to their output buffers */
+void
+lanes_emit(Lanes *self, vlanei sym, vlanef re, vlanef im)
+{
+	DemodStats *stats;
+	double ref, pow;
+	unsigned k;
+
+	for (k=0; k<self->count; k++) {
+		if (!sym[k]) {
+			continue;
+		}
+		stats = &self->local_stats[k];
+
+		self->out_buf[k][self->out_offset[k]++] = clamp(re[k]/2);
+		self->out_buf[k][self->out_offset[k]++] = clamp(im[k]/2);
+		if (self->out_offset[k] >= SYM_CHUNKSIZE - 1) {
+			if (self->sink[k]) {
+				self->sink[k](self->out_buf[k], self->out_offset[k], self->sink_ctx[k]);
+			}
+			self->out_offset[k] = 0;
+		}
+		stats->symbols_out++;
+
+		/* Same blind EVM estimate as the scalar demodulator */
+		if (self->locked[k]) {
+			self->evm_abs[k] += fabsf(re[k]) + fabsf(im[k]);
+			self->evm_pow[k] += re[k]*re[k] + im[k]*im[k];
+			stats->symbols_locked++;
+			ref = self->evm_abs[k] / (2*stats->symbols_locked);
+			pow = self->evm_pow[k] / stats->symbols_locked - 2*ref*ref;
+			stats->evm = pow > 0 ? sqrt(pow / (2*ref*ref)) : 0;
+		}
+	}
+}
+
+void
+lanes_publish_stats(Lanes *self)
+{
+	unsigned seq;
+
+	seq = self->stats_seq;
+	__atomic_store_n(&self->stats_seq, seq+1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(self->stats, self->local_stats, sizeof(self->stats));
+	__atomic_store_n(&self->stats_seq, seq+2, __ATOMIC_RELEASE);
+}
+
+void*
+lanes_thr_run(void *x)
+{
+	Lanes *self;
+	uint64_t one = 1;
+
+	self = (Lanes*)x;
+	while (self->thr_is_running && lanes_step(self))
+		;
+	lanes_flush(self);
+
+	self->thr_is_running = 0;
+	write(self->event_fd, &one, sizeof(one));
+	return NULL;
+}
+
+/* Per-lane select: mask ? a : b */
+vlanef
+vblend(vlanei mask, vlanef a, vlanef b)
+{
+	return (vlanef)((mask & (vlanei)a) | (~mask & (vlanei)b));
+}
+
+int
+vany(vlanei mask)
+{
+	int k;
+
+	for (k=0; k<LANES; k++) {
+		if (mask[k]) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* There is no generic vector sqrt, but the lane-wise loop maps to one */
+vlanef
+vsqrt(vlanef x)
+{
+	vlanef ret;
+	int k;
+
+	for (k=0; k<LANES; k++) {
+		ret[k] = sqrtf(x[k]);
+	}
+	return ret;
+}
+
+/* Same table lookup as the scalar Costas loop, one gather per lane */
+vlanef
+vlut_tanh(const float *lut, vlanef x)
+{
+	vlanef ret;
+	int k;
+
+	for (k=0; k<LANES; k++) {
+		ret[k] = x[k] > 127 ? 1 : x[k] < -128 ? -1 : lut[(int)x[k]+128];
+	}
+	return ret;
+}
+
+/* Sine and cosine of $x, |x| < 2pi. The argument is reduced to [-pi/4, pi/4]
+ * and the quadrant, and both are approximated with Taylor polynomials, which
+ * are accurate to a few ulps in that range */
+void
+vsincos(vlanef x, vlanef *s, vlanef *c)
+{
+	const vlanef zero = {0};
+	vlanef r, r2, ps, pc, tmp;
+	vlanei q, swap, neg_s, neg_c, sign;
+
+	q = __builtin_convertvector(x * (float)M_2_PI + vblend(x < 0, zero - 0.5f, zero + 0.5f), vlanei);
+	r = x - __builtin_convertvector(q, vlanef) * 1.57079637050628662109375f;
+	r -= __builtin_convertvector(q, vlanef) * -4.37113900018624283e-8f;
+	r2 = r*r;
+
+	ps = r * (1 + r2 * (-1.0f/6 + r2 * (1.0f/120 + r2 * (-1.0f/5040))));
+	pc = 1 + r2 * (-0.5f + r2 * (1.0f/24 + r2 * (-1.0f/720 + r2 * (1.0f/40320))));
+
+	/* sin(r + q*pi/2), cos(r + q*pi/2) depending on q mod 4 */
+	swap = (q & 1) != 0;
+	neg_s = (q & 2) != 0;
+	neg_c = ((q + 1) & 2) != 0;
+	tmp = vblend(swap, pc, ps);
+	pc = vblend(swap, ps, pc);
+	ps = tmp;
+
+	sign = (vlanei){0} + (int32_t)0x80000000;
+	*s = (vlanef)((vlanei)ps ^ (neg_s & sign));
+	*c = (vlanef)((vlanei)pc ^ (neg_c & sign));
+}
+/*}}}*/
@@ -1,11 +1,26 @@
 #include <complex.h>
+#include <errno.h>
 #include <math.h>
+#include <poll.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 #include "demod.h"
+#include "autotune.h"
+#include "backfill.h"
+#include "batch.h"
+#include "cadu.h"
+#include "checkpoint.h"
+#include "framesync.h"
+#include "metrics.h"
 #include "options.h"
+#include "segment.h"
+#include "shmring.h"
+#include "status.h"
+#include "sweep.h"
+#include "symwriter.h"
 #include "tui.h"
 #include "utils.h"
 #include "wavfile.h"
@@ -27,84 +42,252 @@
 
 /* Interpolator default options */
 #define INTERP_FACTOR 4
+
+/* Number of pipeline threads, and of threads sharing the RRC filter */
+#define THREADS 1
+#define FIR_THREADS 1
+
+/* Offline segment-parallel mode defaults, overlap in seconds */
+#define SEGMENTS 1
+#define SEGMENT_OVERLAP 5
+
+/* Archive batch mode workers, 0 means one per core */
+#define JOBS 0
+
+/* Seconds of input demodulated again backwards, 0 to disable */
+#define BACKFILL 0
+
+/* Seconds between checkpoints */
+#define CHECKPOINT_INTERVAL 10
+
+/* Shared memory ring size, in bytes (about 30s of symbols at 72k) */
+#define SHM_RING_SIZE (1 << 22)
+
+/* Milliseconds between stats events in the status stream */
+#define STATUS_INTERVAL 1000
 /*}}}*/
 
-static int stdout_print_info(const char *msg, ...);
+static int  stdout_print_info(const char *msg, ...);
+static int  stderr_print_info(const char *msg, ...);
+static int  print_info(FILE *fd, const char *msg, va_list ap);
+static void print_stage_util(Demod *demod, const DemodStats *stats, int (*log)(const char *msg, ...));
+static void print_prof_shares(const DemodStats *stats, const DemodStats *prev, int (*log)(const char *msg, ...));
+static void print_profile(const DemodStats *stats, int (*log)(const char *msg, ...));
+static char* sweep_prefix(const char *in_fname);
+static void run_segmented(const char *in_fname, const char *out_fname, unsigned samplerate,
+                          const DemodParams *params, unsigned nsegs, float overlap, int upd_interval, int quiet);
 
 int
 main(int argc, char *argv[])
 {
-	int c, free_fname_on_exit;
-	struct timespec timespec;
-	float freq, gain;
-	uint64_t in_done, in_total;
-	int pll_locked;
+	int c, free_fname_on_exit, archive, sweep;
+	int resumed, exact, dirty, status_dirty, ret, timeout;
+	unsigned level, level_changes;
+	const char *pname;
+	struct pollfd fds[2];
+	uint64_t in_total, now_ns, next_ns;
+	unsigned events;
+	DemodStats stats, prev_stats;
+	DemodState state;
+	Backfill *bf;
+	int bf_ret;
+	CaduDecoder *cadu;
+	CaduStats cadu_stats;
+	FrameSync *fsync;
+	FrameSyncStats fsync_stats;
+	SymWriter *writer;
+	ShmRing *shm;
+	Metrics *metrics;
+	StatusStream *status;
+	FILE *soft_fd, *cadu_fd, *quality_fd;
+	DemodSink sink;
+	void *sink_ctx;
 	Source *raw_samp;
 	Demod *demod;
+	Wisdom wisdom;
+	const WisdomRate *tuned;
+	char wisdom_fname[512];
+	int have_wisdom;
 
 	/* Command line changeable parameters {{{*/
-	int symbol_rate;
+	DemodParams params;
 	unsigned samplerate;
 	int batch_mode;
 	int upd_interval;
 	int quiet;
-	float costas_bw;
-	float rrc_alpha;
-	unsigned interp_factor;
-	unsigned rrc_order;
+	unsigned nsegs;
+	float overlap;
+	unsigned jobs;
+	char *ckpt_fname;
+	float ckpt_interval;
+	float backfill;
+	char *cadu_fname;
+	int canonical;
+	SymFormat out_fmt;
+	int compress;
+	char *shm_name;
+	char *metrics_addr;
+	char *quality_fname;
+	float max_lag;
+	int status_fd;
+	unsigned status_interval;
+	int json;
+	int autotune;
+	float margin;
+	char *sweep_lists[SWEEP_NPARAMS];
+	int use_lanes;
+	int profile;
 	char *out_fname;
 	int (*log)(const char *msg, ...);
 	/*}}}*/
 	/* Initialize the parameters that can be overridden with command-line args {{{*/
 	batch_mode  = 0;
-	rrc_alpha = RRC_ALPHA;
+	params.rrc_alpha = RRC_ALPHA;
 	samplerate = 0;
 	quiet = 0;
 	log = tui_print_info;
 	upd_interval = UPD_INTERVAL;
-	symbol_rate = SYM_RATE;
-	costas_bw = COSTAS_BW;
+	params.sym_rate = SYM_RATE;
+	params.pll_bw = COSTAS_BW;
 	out_fname = NULL;
-	interp_factor = INTERP_FACTOR;
-	rrc_order = RRC_FIR_ORDER;
+	params.interp_factor = INTERP_FACTOR;
+	params.rrc_order = RRC_FIR_ORDER;
+	params.nthreads = 0;         /* Set below, from the wisdom file if any */
+	params.fir_threads = 0;
+	params.chunk_size = 0;
+	nsegs = SEGMENTS;
+	overlap = SEGMENT_OVERLAP;
+	jobs = JOBS;
+	ckpt_fname = NULL;
+	ckpt_interval = CHECKPOINT_INTERVAL;
+	backfill = BACKFILL;
+	cadu_fname = NULL;
+	canonical = 0;
+	out_fmt = SYMFMT_S8;
+	compress = 0;
+	shm_name = NULL;
+	metrics_addr = NULL;
+	quality_fname = NULL;
+	max_lag = 0;
+	status_fd = -1;
+	status_interval = STATUS_INTERVAL;
+	json = 0;
+	autotune = 0;
+	margin = 0;
+	use_lanes = 0;
+	profile = 0;
+	for (c=0; c<SWEEP_NPARAMS; c++) {
+		sweep_lists[c] = NULL;
+	}
 	free_fname_on_exit = 0;
 	/* }}} */
 	/* Parse command line args {{{*/
+	pname = argv[0];
 	if (argc < 2) {
-		usage(argv[0]);
+		usage(pname);
+	}
+
+	/* Archive reprocessing subcommand: "meteor_demod batch [options] inputs..." */
+	archive = !strcmp(argv[1], "batch");
+	/* Parameter sweep subcommand: "meteor_demod sweep [options] file_in", where
+	 * -a, -b, -f and -O accept comma-separated lists */
+	sweep = !strcmp(argv[1], "sweep");
+	if (archive || sweep) {
+		argc--;
+		argv++;
 	}
 
 	optind = 0;
 	while ((c = getopt_long(argc, argv, SHORTOPTS, longopts, NULL)) != -1) {
 		switch (c) {
 		case 'a':
-			rrc_alpha = atof(optarg);
+			params.rrc_alpha = atof(optarg);
+			sweep_lists[SWEEP_ALPHA] = optarg;
 			break;
 		case 'b':
-			costas_bw = atoi(optarg);
+			params.pll_bw = atoi(optarg);
+			sweep_lists[SWEEP_PLL_BW] = optarg;
+			break;
+		case 'A':
+			autotune = 1;
 			break;
 		case 'B':
 			batch_mode = 1;
 			upd_interval = SLEEP_INTERVAL;
 			log = stdout_print_info;
 			break;
+		case 'c':
+			ckpt_fname = optarg;
+			break;
+		case 'C':
+			ckpt_interval = atof(optarg);
+			break;
+		case 'd':
+			cadu_fname = optarg;
+			break;
+		case 'e':
+			if (symwriter_parse_format(optarg, &out_fmt)) {
+				fatal("Invalid output encoding");
+			}
+			break;
 		case 'f':
-			rrc_order = atoi(optarg);
+			params.rrc_order = atoi(optarg);
+			sweep_lists[SWEEP_FIR_ORDER] = optarg;
+			break;
+		case 'F':
+			backfill = atof(optarg);
+			break;
+		case 'g':
+			max_lag = atof(optarg);
 			break;
 		case 'h':
-			usage(argv[0]);
+			usage(pname);
+			break;
+		case 'j':
+			jobs = atoi(optarg);
+			break;
+		case 'J':
+			json = 1;
+			break;
+		case 'l':
+			overlap = atof(optarg);
+			if (overlap <= 0) {
+				fatal("Invalid segment overlap");
+			}
+			break;
+		case 'L':
+			use_lanes = 1;
+			break;
+		case 'm':
+			shm_name = optarg;
+			break;
+		case 'M':
+			metrics_addr = optarg;
 			break;
 		case 'o':
 			out_fname = optarg;
 			break;
 		case 'O':
-			interp_factor = atoi(optarg);
+			params.interp_factor = atoi(optarg);
+			sweep_lists[SWEEP_OVERSAMP] = optarg;
+			break;
+		case 'p':
+			params.fir_threads = atoi(optarg);
+			if (params.fir_threads < 1) {
+				fatal("Invalid number of filter threads");
+			}
+			break;
+		case 'P':
+			canonical = 1;
 			break;
 		case 'q':
 			quiet = 1;
 			break;
+		case 'Q':
+			quality_fname = optarg;
+			break;
 		case 'r':
-			symbol_rate = atoi(optarg);
+			params.sym_rate = atoi(optarg);
 			break;
 		case 'R':
 			upd_interval = atoi(optarg);
@@ -112,78 +295,414 @@ main(int argc, char *argv[])
 		case 's':
 			samplerate = atoi(optarg);
 			break;
+		case 'S':
+			nsegs = atoi(optarg);
+			break;
+		case 't':
+			params.nthreads = atoi(optarg);
+			if (params.nthreads < 1 || params.nthreads > DEMOD_MAX_STAGES) {
+				fatal("Invalid number of threads");
+			}
+			break;
+		case 'T':
+			profile = 1;
+			break;
+		case 'u':
+			status_fd = atoi(optarg);
+			if (status_fd < 0) {
+				fatal("Invalid status fd");
+			}
+			break;
+		case 'U':
+			status_interval = atoi(optarg);
+			break;
 		case 'v':
 			version();
 			break;
+		case 'x':
+			margin = atof(optarg);
+			if (margin <= 0) {
+				fatal("Invalid real time margin");
+			}
+			break;
+		case 'z':
+#ifndef HAVE_ZSTD
+			fatal("Compiled without zstd support");
+#endif
+			compress = 1;
+			break;
 		default:
-			usage(argv[0]);
+			usage(pname);
 		}
 	}
 
+	/* Benchmark this machine, and save the results for the next runs */
+	have_wisdom = !wisdom_path(wisdom_fname, sizeof(wisdom_fname));
+	if (autotune) {
+		if (!have_wisdom) {
+			fatal("Could not find a place for the wisdom file");
+		}
+		splash();
+		autotune_run(&wisdom, &params, samplerate, stdout_print_info);
+		if (wisdom_save(&wisdom, wisdom_fname)) {
+			fatal("Could not save the wisdom file");
+		}
+		stdout_print_info("Results saved to %s\n", wisdom_fname);
+		return 0;
+	}
+
+	/* Use the settings found by --autotune, unless overridden */
+	have_wisdom = have_wisdom && !wisdom_load(&wisdom, wisdom_fname);
+	if (have_wisdom) {
+		params.chunk_size = wisdom.chunk_size;
+	}
+	if (!params.nthreads) {
+		params.nthreads = have_wisdom ? wisdom.nthreads : THREADS;
+	}
+	if (!params.fir_threads) {
+		params.fir_threads = have_wisdom ? wisdom.fir_threads : FIR_THREADS;
+	}
+	if (margin > 0 && !have_wisdom) {
+		fatal("No tuning results for this machine, run with --autotune first");
+	}
+
 	/* Check if input filename was provided */
 	if (argc - optind < 1) {
-		usage(argv[0]);
+		usage(pname);
+	}
+	/* JSON on stdout: the log moves to stderr */
+	if (json) {
+		if (!batch_mode) {
+			upd_interval = SLEEP_INTERVAL;
+		}
+		batch_mode = 1;
+		log = stderr_print_info;
+		status_fd = STDOUT_FILENO;
+	}
+	/* The demodulator state can only be captured when the filter and the
+	 * sync run on the same thread */
+	if (ckpt_fname) {
+		if (archive || sweep || nsegs != 1) {
+			fatal("Checkpoints are not supported in batch, sweep or segmented mode");
+		}
+		if (params.nthreads > 2) {
+			params.nthreads = 2;
+		}
+		if (backfill > 0 || cadu_fname || canonical || out_fmt != SYMFMT_S8 || compress || shm_name) {
+			fatal("Checkpoints can't be combined with --backfill, --decode, --canonical, --encoding, --zstd or --shm");
+		}
+	}
+	if ((cadu_fname || canonical || out_fmt != SYMFMT_S8 || compress || shm_name) && (archive || sweep || nsegs != 1)) {
+		fatal("Decoding, phase resolution, output encodings and shared memory output are not supported in batch, sweep or segmented mode");
+	}
+	if ((profile || metrics_addr || quality_fname || max_lag > 0 || margin > 0 || status_fd >= 0) && (archive || sweep || nsegs != 1)) {
+		fatal("Profiling, the metrics server, the quality log, the lag monitor, --margin and the status stream are not supported in batch, sweep or segmented mode");
+	}
+	/* The lag monitor replaces the filter between two chunks, which can only
+	 * be done on the thread running the sync */
+	if (max_lag > 0) {
+		if (ckpt_fname) {
+			fatal("The lag monitor can't be combined with checkpoints");
+		}
+		if (params.nthreads > 2) {
+			params.nthreads = 2;
+		}
 	}
 	/*}}}*/
 
-	/* If no filename was specified, generate one */
-	if (!out_fname) {
+	/* Archive mode: process all the inputs, -o is the output directory */
+	if (archive) {
+		return batch_run(argv+optind, argc-optind, out_fname ? out_fname : ".", samplerate, &params, jobs,
+		                 batch_mode ? upd_interval : SLEEP_INTERVAL, quiet, stdout_print_info) ? 1 : 0;
+	}
+
+	/* Sweep mode: one output per combination, named after -o or the input */
+	if (sweep) {
+		return sweep_run(argv[optind], out_fname ? out_fname : sweep_prefix(argv[optind]), samplerate, &params,
+		                 sweep_lists, use_lanes, batch_mode ? upd_interval : SLEEP_INTERVAL, quiet, stdout_print_info) ? 1 : 0;
+	}
+
+	/* If no filename was specified, generate one. When decoding or writing to
+	 * shared memory, the soft symbols are only saved if explicitly requested */
+	if (!out_fname && !cadu_fname && !shm_name) {
 		out_fname = gen_fname();
 		free_fname_on_exit = 1;
 	}
 
+	/* Offline segment-parallel mode has its own, simpler loop */
+	if (nsegs != 1) {
+		run_segmented(argv[optind], out_fname, samplerate, &params, nsegs, overlap,
+		              batch_mode ? upd_interval : SLEEP_INTERVAL, quiet);
+		if (free_fname_on_exit) {
+			free(out_fname);
+		}
+		return 0;
+	}
+
 	/* Open raw samples file */
 	raw_samp = open_samples_file(argv[optind], samplerate);
 	if (!raw_samp) {
 		fatal("Couldn't open samples file");
 	}
 
+	/* Use the most expensive filter that still runs fast enough, keeping the
+	 * RRC order or the oversampling factor if set on the command line */
+	tuned = NULL;
+	if (margin > 0) {
+		tuned = wisdom_pick(&wisdom, margin*raw_samp->samplerate,
+		                    sweep_lists[SWEEP_FIR_ORDER] ? params.rrc_order : 0,
+		                    sweep_lists[SWEEP_OVERSAMP] ? params.interp_factor : 0);
+		if (!tuned) {
+			fatal("No tuning results for this RRC order and oversampling factor");
+		}
+		params.rrc_order = tuned->order;
+		params.interp_factor = tuned->factor;
+	}
+
+	/* Pick up where the previous run left off, if there's a checkpoint. Live
+	 * inputs can't be rewound, but the loops can still start out locked */
+	resumed = ckpt_fname && !checkpoint_read(ckpt_fname, &state);
+	exact = resumed && raw_samp->seek && !raw_samp->seek(raw_samp, state.in_pos);
+
 	/* Initialize the UI */
 	if (!batch_mode) {
-		tui_init(upd_interval);
-	} else if (!quiet) {
+		tui_init();
+	} else if (!quiet && !json) {
 		splash();
 	}
 
 	if (!quiet) {
-		log("Input: %s, output: %s\n", argv[optind], out_fname);
+		log("Input: %s, output: %s\n", argv[optind], out_fname ? out_fname : cadu_fname ? cadu_fname : shm_name);
 		log("Input samplerate: %d\n", raw_samp->samplerate);
+		if (have_wisdom) {
+			log("Tuning results loaded from %s\n", wisdom_fname);
+		}
+		if (tuned && tuned->rate >= margin*raw_samp->samplerate) {
+			log("RRC order %u, oversampling %u: %.1fx real time\n",
+			    tuned->order, tuned->factor, tuned->rate/raw_samp->samplerate);
+		} else if (tuned) {
+			log("Nothing runs %.1fx faster than real time, using RRC order %u, oversampling %u (%.1fx)\n",
+			    margin, tuned->order, tuned->factor, tuned->rate/raw_samp->samplerate);
+		}
+	}
+
+	/* Keep the beginning of the input around to demodulate it again once the
+	 * loops have locked */
+	bf = NULL;
+	if (backfill > 0) {
+		bf = backfill_init(raw_samp, &params, backfill);
 	}
 
 	/* Initialize the demodulator */
-	demod = demod_init(raw_samp, interp_factor, rrc_order, rrc_alpha, costas_bw, symbol_rate);
-	demod_start(demod, out_fname);
+	demod = demod_init(bf ? bf->tee : raw_samp, &params);
+	if (resumed) {
+		if (demod_set_state(demod, &state, exact)) {
+			fatal("The checkpoint was saved with different parameters");
+		}
+		free(state.filter_mem);
+		if (!quiet) {
+			if (exact) {
+				log("Resuming from sample %llu\n", (unsigned long long)state.in_pos);
+			} else {
+				log("Resuming with the saved carrier and timing lock\n");
+			}
+		}
+	}
+	if (ckpt_fname) {
+		demod_set_checkpoint(demod, ckpt_fname, ckpt_interval*1000);
+	}
+	if (max_lag > 0 && demod_set_max_lag(demod, max_lag)) {
+		fatal("Could not enable the lag monitor");
+	}
+	quality_fd = NULL;
+	if (quality_fname) {
+		if (!(quality_fd = fopen(quality_fname, resumed ? "a" : "w"))) {
+			fatal("Could not open the quality log for writing");
+		}
+		demod_set_quality_log(demod, quality_fd);
+	}
+
+	/* Chain the optional output stages: backfill, phase resolution, the CADU
+	 * decoder, the shared memory ring, and finally the soft symbols file,
+	 * packed if requested */
+	soft_fd = NULL;
+	cadu_fd = NULL;
+	cadu = NULL;
+	fsync = NULL;
+	writer = NULL;
+	shm = NULL;
+	if (bf || cadu_fname || canonical || out_fmt != SYMFMT_S8 || compress || shm_name) {
+		sink = NULL;
+		sink_ctx = NULL;
+		if (out_fname) {
+			if (!(soft_fd = fopen(out_fname, "w"))) {
+				fatal("Could not open file for writing");
+			}
+			if (out_fmt != SYMFMT_S8 || compress) {
+				writer = symwriter_init(soft_fd, out_fmt, compress, params.sym_rate, 0);
+				sink = symwriter_sink;
+				sink_ctx = writer;
+			} else {
+				sink = demod_file_sink;
+				sink_ctx = soft_fd;
+			}
+		}
+		if (shm_name) {
+			shm = shmring_create(shm_name, SHM_RING_SIZE, params.sym_rate, sink, sink_ctx);
+			sink = shmring_sink;
+			sink_ctx = shm;
+		}
+		if (cadu_fname) {
+			if (!(cadu_fd = fopen(cadu_fname, "w"))) {
+				fatal("Could not open file for writing");
+			}
+			cadu = cadu_init(cadu_fd, sink, sink_ctx);
+			sink = cadu_sink;
+			sink_ctx = cadu;
+		}
+		if (canonical) {
+			fsync = framesync_init(sink, sink_ctx);
+			sink = framesync_sink;
+			sink_ctx = fsync;
+		}
+		if (bf) {
+			backfill_attach(bf, demod, sink, sink_ctx);
+		} else {
+			demod_set_sink(demod, sink, sink_ctx);
+		}
+		demod_start(demod, NULL);
+	} else {
+		demod_start(demod, out_fname);
+	}
 	if (!quiet) {
 		log("Demodulator initialized\n");
 	}
 
-	/* Initialize the struct that will be the argument to nanosleep() */
-	timespec.tv_sec = upd_interval/1000;
-	timespec.tv_nsec = ((upd_interval - timespec.tv_sec*1000))*1000L*1000;
+	/* Serve the status to the monitoring system, if requested */
+	metrics = NULL;
+	if (metrics_addr) {
+		if (!(metrics = metrics_init(metrics_addr, demod, shm))) {
+			fatal("Could not start the metrics server");
+		}
+		if (!quiet) {
+			log("Serving metrics on %s\n", metrics_addr);
+		}
+	}
 
-	/* Main UI update loop */
+	/* Report to the supervisor, if requested */
 	in_total = demod_get_size(demod);
+	status = NULL;
+	if (status_fd >= 0) {
+		if (!(status = status_init(status_fd, status_interval))) {
+			fatal("Invalid status fd");
+		}
+		status_start(status, argv[optind], out_fname ? out_fname : cadu_fname ? cadu_fname : shm_name,
+		             raw_samp->samplerate, &params, in_total);
+	}
+
+	/* Main UI update loop: sleep until the demodulator has news or a key is
+	 * pressed, and redraw at most once every upd_interval ms. The status
+	 * stream has its own interval */
+	memset(&prev_stats, 0, sizeof(prev_stats));
+	level = 0;
+	level_changes = 0;
+	fds[0].fd = demod_get_event_fd(demod);
+	fds[0].events = POLLIN;
+	fds[1].fd = batch_mode ? -1 : STDIN_FILENO;
+	fds[1].events = POLLIN;
+	dirty = 1;
+	status_dirty = status != NULL;
+	next_ns = get_time_ns();
 	while (demod_status(demod)) {
-		in_done = demod_get_done(demod);
-		freq = demod_get_freq(demod);
-		gain = demod_get_gain(demod);
-		pll_locked = demod_is_pll_locked(demod);
+		now_ns = get_time_ns();
+		if (dirty && now_ns >= next_ns) {
+			dirty = 0;
+			next_ns = now_ns + upd_interval*1000000ULL;
+			demod_watch_stats(demod);
+			demod_get_stats(demod, &stats);
 
-		if (batch_mode) {
-			if (!quiet) {
-				log("(%5.1f%%) Carrier: %+7.1f Hz, Locked: %s\n",
-					(float)in_done/in_total*100, freq, pll_locked ? "Yes" : "No");
+			if (batch_mode) {
+				if (!quiet) {
+					log("(%5.1f%%) Carrier: %+7.1f Hz, Locked: %s, SNR: %.1f dB\n",
+						(float)stats.in_done/in_total*100, stats.freq, stats.pll_locked ? "Yes" : "No", stats.snr);
+					if (stats.stages > 1) {
+						print_stage_util(demod, &stats, log);
+					}
+					if (profile) {
+						print_prof_shares(&stats, &prev_stats, log);
+						prev_stats = stats;
+					}
+					if (fsync) {
+						framesync_get_stats(fsync, &fsync_stats);
+						log("Sync: %s, phase state %d\n", fsync_stats.locked ? "Yes" : "No", fsync_stats.state);
+					}
+					if (cadu) {
+						cadu_get_stats(cadu, &cadu_stats);
+						log("Frames: %lu/%lu OK\n", (unsigned long)cadu_stats.ok, (unsigned long)cadu_stats.frames);
+					}
+				}
+			} else {
+				tui_update_file_in(raw_samp->samplerate, stats.in_done, in_total);
+				tui_update_data_out(stats.symbols_out*2);
+				tui_update_pll(stats.freq, stats.pll_locked, stats.gain, stats.snr);
+				tui_draw_constellation(demod_get_buf(demod), 2*CONSTELL_SAMPLES);
 			}
-			nanosleep(&timespec, NULL);
-		} else {
-			if (tui_process_input()) {
-				/* Exit on user request */
-				break;
+		}
+
+		if (status_dirty && now_ns >= status_due(status)) {
+			status_dirty = 0;
+			demod_watch_stats(demod);
+			demod_get_stats(demod, &stats);
+			status_update(status, &stats);
+		}
+
+		/* Wait for news, or for the next update if there's something new */
+		timeout = dirty ? (int)((next_ns - now_ns + 999999) / 1000000) : -1;
+		if (status_dirty && (timeout < 0 || status_due(status) - now_ns < timeout * 1000000ULL)) {
+			timeout = (status_due(status) - now_ns + 999999) / 1000000;
+		}
+		ret = poll(fds, 2, timeout);
+		if (ret < 0 && errno != EINTR) {
+			fatal("poll() failed");
+		}
+		if (ret > 0 && (fds[0].revents & POLLIN)) {
+			events = demod_get_events(demod);
+			if (events & (DEMOD_EVENT_STATS | DEMOD_EVENT_STATE)) {
+				dirty = 1;
+				status_dirty = status != NULL;
+			}
+			/* Lock and level changes are reported right away, with the
+			 * values recorded at the time of the switch */
+			if (events & DEMOD_EVENT_STATE) {
+				demod_get_stats(demod, &stats);
+				if (stats.level_changes != level_changes) {
+					if (stats.level_changes - level_changes > 1) {
+						log("Lag monitor: %u switches since the last report\n", stats.level_changes - level_changes);
+					}
+					if (stats.level > level) {
+						log("Falling behind, switching to RRC order %u, oversampling %u (lag: %.1fs)\n",
+						    stats.rrc_order, stats.interp_factor, stats.level_lag);
+					} else {
+						log("Caught up, switching back to RRC order %u, oversampling %u\n",
+						    stats.rrc_order, stats.interp_factor);
+					}
+					level = stats.level;
+					level_changes = stats.level_changes;
+				}
+				if (status) {
+					status_update(status, &stats);
+				}
 			}
-			tui_update_file_in(raw_samp->samplerate, in_done, in_total);
-			tui_update_data_out(demod_get_bytes_out(demod));
-			tui_update_pll(freq, pll_locked, gain);
-			tui_draw_constellation(demod_get_buf(demod), 256);
+		}
+
+		/* Terminal resizes are read as a keypress, and only interrupt poll()
+		 * if they happen while it's waiting, so check after every wakeup */
+		if (fds[1].fd >= 0 && tui_process_input()) {
+			/* Exit on user request */
+			break;
+		}
+		if (ret > 0 && (fds[1].revents & (POLLHUP | POLLERR | POLLNVAL))) {
+			fds[1].fd = -1;
 		}
 	}
 
@@ -193,9 +712,69 @@ main(int argc, char *argv[])
 		} else {
 			log("Aborting\n");
 		}
+		demod_get_stats(demod, &stats);
+		if (stats.stages > 1) {
+			print_stage_util(demod, &stats, log);
+		}
+		log("Signal quality: average SNR %.1f dB while locked, %.1f%% of the symbols locked\n",
+		    stats.snr_avg, stats.symbols_out ? stats.symbols_locked*100.0/stats.symbols_out : 0);
+	}
+	if (profile) {
+		demod_get_stats(demod, &stats);
+		print_profile(&stats, log);
+	}
+	if (status) {
+		demod_get_stats(demod, &stats);
+		status_finish(status, &stats, demod_status(demod));
+		status_close(status);
 	}
 
+	if (metrics) {
+		metrics_close(metrics);
+	}
 	demod_join(demod);
+	if (bf) {
+		bf_ret = backfill_finish(bf);
+		if (!quiet && bf_ret < 0) {
+			log("Backfill: the input is too short for a backward pass\n");
+		} else if (!quiet && bf_ret > 0) {
+			log("Backfill: the two passes could not be lined up\n");
+		} else if (!quiet) {
+			log("Backfill: %lu symbols taken from the backward pass (%.0f%% match)\n", (unsigned long)bf->recovered, bf->score*100);
+		}
+		backfill_free(bf);
+	}
+	if (fsync) {
+		framesync_flush(fsync);
+		if (!quiet) {
+			framesync_get_stats(fsync, &fsync_stats);
+			log("Sync: %lu markers, %lu phase slips, %lu sync losses\n", (unsigned long)fsync_stats.markers,
+			    (unsigned long)fsync_stats.slips, (unsigned long)fsync_stats.sync_lost);
+		}
+		framesync_free(fsync);
+	}
+	if (cadu) {
+		if (!quiet) {
+			cadu_get_stats(cadu, &cadu_stats);
+			log("Frames: %lu found, %lu OK, %lu bytes corrected, %lu phase slips, %lu sync losses\n",
+			    (unsigned long)cadu_stats.frames, (unsigned long)cadu_stats.ok, (unsigned long)cadu_stats.rs_fixed,
+			    (unsigned long)cadu_stats.slips, (unsigned long)cadu_stats.sync_lost);
+		}
+		cadu_free(cadu);
+		fclose(cadu_fd);
+	}
+	if (shm) {
+		shmring_close(shm);
+	}
+	if (writer) {
+		symwriter_close(writer);
+	}
+	if (soft_fd) {
+		fclose(soft_fd);
+	}
+	if (quality_fd) {
+		fclose(quality_fd);
+	}
 	raw_samp->close(raw_samp);
 	if (free_fname_on_exit) {
 		free(out_fname);
@@ -214,21 +793,188 @@ main(int argc, char *argv[])
 int
 stdout_print_info(const char *msg, ...)
 {
-	time_t t;
 	va_list ap;
+
+	va_start(ap, msg);
+	print_info(stdout, msg, ap);
+	va_end(ap);
+
+	return 0;
+}
+
+int
+stderr_print_info(const char *msg, ...)
+{
+	va_list ap;
+
+	va_start(ap, msg);
+	print_info(stderr, msg, ap);
+	va_end(ap);
+
+	return 0;
+}
+
+/* Print a log message, prefixed with the current time */
+int
+print_info(FILE *fd, const char *msg, va_list ap)
+{
+	time_t t;
 	struct tm* tm;
 	char timestr[] = "HH:MM:SS";
 
-
 	t = time(NULL);
 	tm = localtime(&t);
 	strftime(timestr, sizeof(timestr), "%T", tm);
-	printf("(%s) ", timestr);
-	va_start(ap, msg);
-	vprintf(msg, ap);
-	va_end(ap);
+	fprintf(fd, "(%s) ", timestr);
+	vfprintf(fd, msg, ap);
 
 	return 0;
 }
-/*}}}*/
 
+/* Split the input file into segments and demodulate them in parallel, printing
+ * the status to stdout like in batch mode */
+void
+run_segmented(const char *in_fname, const char *out_fname, unsigned samplerate,
+              const DemodParams *params, unsigned nsegs, float overlap, int upd_interval, int quiet)
+{
+	Segmenter *seg;
+	DemodStats stats;
+	uint64_t in_total, now_ns, next_ns;
+	int failed;
+
+	if (!nsegs) {
+		nsegs = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+
+	seg = segmenter_init(in_fname, samplerate, params, nsegs, overlap);
+	nsegs = seg->count;
+
+	if (!quiet) {
+		splash();
+		stdout_print_info("Input: %s, output: %s\n", in_fname, out_fname);
+		stdout_print_info("Input samplerate: %d\n", seg->samplerate);
+		stdout_print_info("Splitting the input into %u segments, %.1fs overlap\n", nsegs, overlap);
+	}
+
+	segmenter_start(seg, out_fname);
+
+	/* Print the status every upd_interval ms, waking up early if a segment
+	 * stops so that the last one is noticed right away */
+	in_total = segmenter_get_size(seg);
+	next_ns = get_time_ns();
+	while (segmenter_status(seg)) {
+		now_ns = get_time_ns();
+		if (now_ns >= next_ns) {
+			next_ns = now_ns + upd_interval*1000000ULL;
+			if (!quiet) {
+				segmenter_get_stats(seg, &stats);
+				stdout_print_info("(%5.1f%%) Segments locked: %d/%u\n",
+				                  (float)stats.in_done/in_total*100, stats.pll_locked, nsegs);
+			}
+		}
+		segmenter_wait(seg, (next_ns - now_ns + 999999) / 1000000);
+	}
+
+	failed = segmenter_join(seg, out_fname);
+	if (failed < 0) {
+		fatal("Could not open file for writing");
+	}
+	if (!quiet) {
+		if (failed) {
+			stdout_print_info("Warning: %d/%u seams could not be aligned\n", failed, nsegs-1);
+		}
+		stdout_print_info("Decoding completed\n");
+	}
+}
+
+/* Print how busy each pipeline stage was */
+void
+print_stage_util(Demod *demod, const DemodStats *stats, int (*log)(const char *msg, ...))
+{
+	char buf[128];
+	unsigned i;
+	int len;
+
+	len = 0;
+	for (i=0; i<stats->stages; i++) {
+		len += snprintf(buf+len, sizeof(buf)-len, "%s%s %.0f%%", i ? ", " : "",
+		                demod_get_stage_name(demod, i), stats->stage_util[i]*100);
+	}
+	log("Stage utilization: %s\n", buf);
+}
+
+/* Print the share of the processing time each step took since the previous
+ * update, and the resulting throughput */
+void
+print_prof_shares(const DemodStats *stats, const DemodStats *prev, int (*log)(const char *msg, ...))
+{
+	char buf[128];
+	uint64_t delta[DEMOD_PROF_COUNT], total;
+	unsigned i;
+	int len;
+
+	total = 0;
+	for (i=0; i<DEMOD_PROF_COUNT; i++) {
+		delta[i] = stats->prof_ns[i] - prev->prof_ns[i];
+		total += delta[i];
+	}
+	if (!total) {
+		return;
+	}
+
+	len = 0;
+	for (i=0; i<DEMOD_PROF_COUNT; i++) {
+		len += snprintf(buf+len, sizeof(buf)-len, "%s%s %.0f%%", i ? ", " : "",
+		                demod_get_prof_name(i), delta[i]*100.0/total);
+	}
+	log("Profile: %s (%.2f Msamp/s)\n", buf,
+	    (stats->prof_items[DEMOD_PROF_INPUT] - prev->prof_items[DEMOD_PROF_INPUT]) * 1e3 / total);
+}
+
+/* Print the time spent in each processing step, its throughput and its share
+ * of the total. With more than one thread, the total can exceed the wall clock
+ * time */
+void
+print_profile(const DemodStats *stats, int (*log)(const char *msg, ...))
+{
+	static const char *units[DEMOD_PROF_COUNT] = { "samp", "samp", "samp", "sym", "sym" };
+	uint64_t total;
+	unsigned i;
+
+	total = 0;
+	for (i=0; i<DEMOD_PROF_COUNT; i++) {
+		total += stats->prof_ns[i];
+	}
+	if (!total) {
+		return;
+	}
+
+	log("%-11s %10s %16s %7s\n", "Step", "Time (s)", "Throughput", "Share");
+	for (i=0; i<DEMOD_PROF_COUNT; i++) {
+		log("%-11s %10.3f %9.2f M%s/s %6.1f%%\n", demod_get_prof_name(i), stats->prof_ns[i]/1e9,
+		    stats->prof_ns[i] ? stats->prof_items[i]*1e3/stats->prof_ns[i] : 0, units[i],
+		    stats->prof_ns[i]*100.0/total);
+	}
+	log("%-11s %10.3f (wall clock: %.3f s)\n", "total", total/1e9, stats->wall_ns/1e9);
+}
+
+/* Default sweep output prefix: the input basename, without its extension */
+char*
+sweep_prefix(const char *in_fname)
+{
+	const char *base, *ext;
+	char *ret;
+	size_t len;
+
+	base = strrchr(in_fname, '/');
+	base = base ? base+1 : in_fname;
+	ext = strrchr(base, '.');
+	len = (ext && ext != base) ? (size_t)(ext - base) : strlen(base);
+
+	ret = safealloc(len + 1);
+	memcpy(ret, base, len);
+	ret[len] = '\0';
+
+	return ret;
+}
+/*}}}*/
@@ -0,0 +1,112 @@
+#include <string.h>
+#include "memsrc.h"
+#include "probes.h"
+#include "utils.h"
+
+typedef struct {
+	const float complex *buf;
+	size_t len, pos;
+	uint64_t samples_read;
+} MemState;
+
+static int      memsrc_read(Source *self, size_t count);
+static int      memsrc_close(Source *self);
+static uint64_t memsrc_get_size(const Source *self);
+static uint64_t memsrc_get_done(const Source *self);
+
+/* Create an empty in-memory source */
+Source*
+memsrc_init(unsigned samplerate)
+{
+	Source *src;
+	MemState *state;
+
+	src = safealloc(sizeof(*src));
+
+	src->count = 0;
+	src->bps = sizeof(*src->data);
+	src->samplerate = samplerate;
+	src->data = NULL;
+	src->read = memsrc_read;
+	src->close = memsrc_close;
+	src->size = memsrc_get_size;
+	src->done = memsrc_get_done;
+	src->seek = NULL;
+
+	src->_backend = safealloc(sizeof(MemState));
+	state = (MemState*)src->_backend;
+	state->buf = NULL;
+	state->len = 0;
+	state->pos = 0;
+	state->samples_read = 0;
+
+	return src;
+}
+
+/* Make a new block of samples available for reading. The block must stay
+ * valid until it has been read completely */
+void
+memsrc_feed(Source *self, const float complex *data, size_t count)
+{
+	MemState *state;
+
+	state = (MemState*)self->_backend;
+	state->buf = data;
+	state->len = count;
+	state->pos = 0;
+}
+
+/* Static functions {{{ */
+/* Copy up to $count samples from the current block. Returns 0 once the block
+ * has been consumed */
+int
+memsrc_read(Source *self, size_t count)
+{
+	MemState *state;
+	size_t n;
+
+	state = (MemState*)self->_backend;
+	PROBE1(read_start, count);
+
+	if (!self->data) {
+		self->data = safealloc(sizeof(*self->data) * count);
+	} else if (self->count < count) {
+		free(self->data);
+		self->data = safealloc(sizeof(*self->data) * count);
+	}
+	self->count = count;
+
+	n = state->len - state->pos;
+	n = (n < count) ? n : count;
+	memcpy(self->data, state->buf + state->pos, sizeof(*self->data) * n);
+	state->pos += n;
+	state->samples_read += n;
+	PROBE2(read_done, n, state->samples_read);
+
+	return n;
+}
+
+/* The total length of a pushed stream is unknown */
+uint64_t
+memsrc_get_size(const Source *self)
+{
+	(void)self;
+	return 0;
+}
+
+uint64_t
+memsrc_get_done(const Source *self)
+{
+	const MemState *state = self->_backend;
+	return state->samples_read;
+}
+
+int
+memsrc_close(Source *self)
+{
+	free(self->_backend);
+	free(self->data);
+	free(self);
+	return 0;
+}
+/*}}}*/
@@ -0,0 +1,372 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "metrics.h"
+#include "pipe.h"
+#include "utils.h"
+
+/* How often the server thread checks whether it should stop */
+#define POLL_INTERVAL_MS 200
+/* Time a client gets to send its request */
+#define REQUEST_TIMEOUT_MS 1000
+
+#define REQUEST_SIZE 1024
+#define RESPONSE_SIZE 16384
+
+typedef struct {
+	char data[RESPONSE_SIZE];
+	size_t len;
+} Buf;
+
+static int   metrics_listen(const char *addr, char **unix_path);
+static void* metrics_thr_run(void *arg);
+static void  metrics_serve(Metrics *self, int fd);
+static void  metrics_render(const Metrics *self, Buf *buf);
+static void  metric(Buf *buf, const char *name, const char *type, const char *help, double val);
+static void  buf_printf(Buf *buf, const char *fmt, ...);
+
+/* Start serving the status of $demod, and of the shared memory ring $shm if
+ * not NULL, on $addr: "unix:<path>" for a Unix socket, "<port>" for a TCP port
+ * on localhost, or "<ipv4 address>:<port>". Returns NULL on failure */
+Metrics*
+metrics_init(const char *addr, const Demod *demod, const ShmRing *shm)
+{
+	Metrics *ret;
+	char *unix_path;
+	int fd;
+
+	if ((fd = metrics_listen(addr, &unix_path)) < 0) {
+		return NULL;
+	}
+
+	ret = safealloc(sizeof(*ret));
+	ret->fd = fd;
+	ret->unix_path = unix_path;
+	ret->demod = demod;
+	ret->shm = shm;
+	ret->samplerate = demod->src->samplerate;
+	ret->running = 1;
+
+	if (pthread_create(&ret->t, NULL, metrics_thr_run, ret)) {
+		ret->running = 0;
+		metrics_close(ret);
+		return NULL;
+	}
+
+	return ret;
+}
+
+/* Stop the server. Must be called before the demodulator is freed */
+void
+metrics_close(Metrics *self)
+{
+	void *retval;
+
+	if (self->running) {
+		self->running = 0;
+		pthread_join(self->t, &retval);
+	}
+
+	close(self->fd);
+	if (self->unix_path) {
+		unlink(self->unix_path);
+		free(self->unix_path);
+	}
+	free(self);
+}
+
+/* Static functions {{{ */
+/* Create a listening socket for $addr */
+int
+metrics_listen(const char *addr, char **unix_path)
+{
+	struct sockaddr_un sun;
+	struct sockaddr_in sin;
+	const char *port;
+	char host[INET_ADDRSTRLEN];
+	int fd, one;
+
+	*unix_path = NULL;
+
+	if (!strncmp(addr, "unix:", 5)) {
+		addr += 5;
+		if (strlen(addr) >= sizeof(sun.sun_path)) {
+			return -1;
+		}
+		memset(&sun, 0, sizeof(sun));
+		sun.sun_family = AF_UNIX;
+		strcpy(sun.sun_path, addr);
+
+		/* Remove the socket left behind by a previous run, if any */
+		unlink(addr);
+		if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+			return -1;
+		}
+		if (bind(fd, (struct sockaddr*)&sun, sizeof(sun)) || listen(fd, 4)) {
+			close(fd);
+			return -1;
+		}
+		*unix_path = safealloc(strlen(addr) + 1);
+		strcpy(*unix_path, addr);
+		return fd;
+	}
+
+	/* TCP, bound to localhost unless an address is given */
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	if ((port = strrchr(addr, ':'))) {
+		if ((size_t)(port - addr) >= sizeof(host)) {
+			return -1;
+		}
+		memcpy(host, addr, port - addr);
+		host[port - addr] = '\0';
+		port++;
+	} else {
+		strcpy(host, "127.0.0.1");
+		port = addr;
+	}
+	if (inet_pton(AF_INET, host, &sin.sin_addr) != 1 || atoi(port) <= 0 || atoi(port) > 65535) {
+		return -1;
+	}
+	sin.sin_port = htons(atoi(port));
+
+	if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+		return -1;
+	}
+	one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(fd, (struct sockaddr*)&sin, sizeof(sin)) || listen(fd, 4)) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* Accept connections one at a time until asked to stop. Scrapes are rare and
+ * quick, so there's no point in serving them concurrently */
+void*
+metrics_thr_run(void *arg)
+{
+	Metrics *self;
+	struct pollfd pfd;
+	int fd;
+
+	self = (Metrics*)arg;
+	pfd.fd = self->fd;
+	pfd.events = POLLIN;
+
+	while (self->running) {
+		if (poll(&pfd, 1, POLL_INTERVAL_MS) <= 0) {
+			continue;
+		}
+		if ((fd = accept(self->fd, NULL, NULL)) < 0) {
+			continue;
+		}
+		metrics_serve(self, fd);
+		close(fd);
+	}
+
+	return NULL;
+}
+
+/* Answer a single HTTP request */
+void
+metrics_serve(Metrics *self, int fd)
+{
+	Buf body;
+	struct pollfd pfd;
+	char req[REQUEST_SIZE], hdr[256];
+	size_t len;
+	ssize_t n;
+	int hdr_len;
+
+	/* Read up to the end of the request headers. The request itself doesn't
+	 * matter much: every GET gets the metrics */
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	len = 0;
+	while (len < sizeof(req)-1) {
+		if (poll(&pfd, 1, REQUEST_TIMEOUT_MS) <= 0) {
+			return;
+		}
+		if ((n = recv(fd, req+len, sizeof(req)-1-len, 0)) <= 0) {
+			return;
+		}
+		len += n;
+		req[len] = '\0';
+		if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n")) {
+			break;
+		}
+	}
+
+	if (strncmp(req, "GET ", 4)) {
+		hdr_len = snprintf(hdr, sizeof(hdr), "HTTP/1.0 405 Method Not Allowed\r\nContent-Length: 0\r\n\r\n");
+		send(fd, hdr, hdr_len, MSG_NOSIGNAL);
+		return;
+	}
+
+	body.len = 0;
+	metrics_render(self, &body);
+	hdr_len = snprintf(hdr, sizeof(hdr),
+	                   "HTTP/1.0 200 OK\r\n"
+	                   "Content-Type: text/plain; version=0.0.4\r\n"
+	                   "Content-Length: %lu\r\n"
+	                   "Connection: close\r\n\r\n", (unsigned long)body.len);
+	if (send(fd, hdr, hdr_len, MSG_NOSIGNAL) == hdr_len) {
+		send(fd, body.data, body.len, MSG_NOSIGNAL);
+	}
+}
+
+/* Write all the metrics in the Prometheus text format */
+void
+metrics_render(const Metrics *self, Buf *buf)
+{
+	const Demod *demod;
+	const ShmRingHeader *hdr;
+	DemodStats stats;
+	PipeStats ps;
+	uint64_t in_size, write_pos, read_pos;
+	unsigned i;
+
+	demod = self->demod;
+	demod_get_stats(demod, &stats);
+	in_size = demod_get_size(demod);
+
+	metric(buf, "meteor_demod_input_samplerate", "gauge",
+	       "Input samplerate, in samples/s", self->samplerate);
+	metric(buf, "meteor_demod_input_samples_total", "counter",
+	       "Input samples processed", stats.in_done);
+	if (in_size) {
+		metric(buf, "meteor_demod_input_progress_ratio", "gauge",
+		       "Fraction of the input file processed", (double)stats.in_done / in_size);
+	}
+	metric(buf, "meteor_demod_uptime_seconds", "gauge",
+	       "Time since the demodulator started", stats.wall_ns / 1e9);
+	metric(buf, "meteor_demod_realtime_factor", "gauge",
+	       "Input duration processed per second of wall clock time",
+	       stats.wall_ns ? stats.in_done / (double)self->samplerate / (stats.wall_ns / 1e9) : 0);
+
+	if (demod->max_lag > 0) {
+		metric(buf, "meteor_demod_lag_seconds", "gauge",
+		       "How far behind the input the demodulator is", stats.lag);
+		metric(buf, "meteor_demod_degradation_level", "gauge",
+		       "Configuration picked by the lag monitor, 0 at full quality", stats.level);
+	}
+	metric(buf, "meteor_demod_rrc_order", "gauge",
+	       "RRC filter order in use", stats.rrc_order);
+	metric(buf, "meteor_demod_oversampling", "gauge",
+	       "Interpolation factor in use", stats.interp_factor);
+
+	metric(buf, "meteor_demod_symbols_total", "counter",
+	       "Symbols output", stats.symbols_out);
+	metric(buf, "meteor_demod_symbols_locked_total", "counter",
+	       "Symbols output while the PLL was locked", stats.symbols_locked);
+	metric(buf, "meteor_demod_lock_ratio", "gauge",
+	       "Fraction of the symbols output while the PLL was locked",
+	       stats.symbols_out ? (double)stats.symbols_locked / stats.symbols_out : 0);
+	metric(buf, "meteor_demod_pll_locked", "gauge",
+	       "Whether the PLL is currently locked", stats.pll_locked);
+	metric(buf, "meteor_demod_carrier_offset_hz", "gauge",
+	       "Carrier frequency offset tracked by the PLL", stats.freq);
+	metric(buf, "meteor_demod_agc_gain", "gauge",
+	       "AGC gain", stats.gain);
+	metric(buf, "meteor_demod_timing_error_samples", "gauge",
+	       "Average symbol timing correction, in samples", stats.timing_err);
+	metric(buf, "meteor_demod_evm_ratio", "gauge",
+	       "RMS error vector magnitude while locked", stats.evm);
+	metric(buf, "meteor_demod_snr_db", "gauge",
+	       "SNR estimated over the last second of symbols", stats.snr);
+	metric(buf, "meteor_demod_snr_locked_avg_db", "gauge",
+	       "Average SNR over the seconds spent mostly locked", stats.snr_avg);
+
+	/* Per pipeline stage */
+	buf_printf(buf, "# HELP meteor_demod_stage_utilization_ratio Fraction of time each pipeline stage spent working\n"
+	                "# TYPE meteor_demod_stage_utilization_ratio gauge\n");
+	for (i=0; i<stats.stages; i++) {
+		buf_printf(buf, "meteor_demod_stage_utilization_ratio{stage=\"%s\"} %.9g\n",
+		           demod_get_stage_name(demod, i), stats.stage_util[i]);
+	}
+	buf_printf(buf, "# HELP meteor_demod_step_seconds_total Time spent in each processing step\n"
+	                "# TYPE meteor_demod_step_seconds_total counter\n");
+	for (i=0; i<DEMOD_PROF_COUNT; i++) {
+		buf_printf(buf, "meteor_demod_step_seconds_total{step=\"%s\"} %.9g\n",
+		           demod_get_prof_name(i), stats.prof_ns[i] / 1e9);
+	}
+
+	/* Rings between the pipeline stages. They never drop samples, a full
+	 * ring makes the stage before it wait instead */
+	if (demod->nstages > 1) {
+		buf_printf(buf, "# HELP meteor_demod_ring_fill_blocks Blocks queued between pipeline stages\n"
+		                "# TYPE meteor_demod_ring_fill_blocks gauge\n");
+		for (i=0; i<demod->nstages-1; i++) {
+			pipe_get_stats(demod->pipes[i], &ps);
+			buf_printf(buf, "meteor_demod_ring_fill_blocks{stage=\"%s\"} %u\n", demod_get_stage_name(demod, i), ps.fill);
+		}
+		buf_printf(buf, "# HELP meteor_demod_ring_size_blocks Capacity of the rings between pipeline stages\n"
+		                "# TYPE meteor_demod_ring_size_blocks gauge\n");
+		for (i=0; i<demod->nstages-1; i++) {
+			pipe_get_stats(demod->pipes[i], &ps);
+			buf_printf(buf, "meteor_demod_ring_size_blocks{stage=\"%s\"} %u\n", demod_get_stage_name(demod, i), ps.nblocks);
+		}
+		buf_printf(buf, "# HELP meteor_demod_ring_stall_seconds_total Time a stage waited for room in its output ring\n"
+		                "# TYPE meteor_demod_ring_stall_seconds_total counter\n");
+		for (i=0; i<demod->nstages-1; i++) {
+			pipe_get_stats(demod->pipes[i], &ps);
+			buf_printf(buf, "meteor_demod_ring_stall_seconds_total{stage=\"%s\"} %.9g\n", demod_get_stage_name(demod, i), ps.stall_ns / 1e9);
+		}
+		buf_printf(buf, "# HELP meteor_demod_ring_starve_seconds_total Time a stage waited for data from the one before\n"
+		                "# TYPE meteor_demod_ring_starve_seconds_total counter\n");
+		for (i=0; i<demod->nstages-1; i++) {
+			pipe_get_stats(demod->pipes[i], &ps);
+			buf_printf(buf, "meteor_demod_ring_starve_seconds_total{stage=\"%s\"} %.9g\n", demod_get_stage_name(demod, i+1), ps.starve_ns / 1e9);
+		}
+	}
+
+	/* Shared memory output */
+	if (self->shm) {
+		hdr = self->shm->hdr;
+		write_pos = __atomic_load_n(&hdr->write_pos, __ATOMIC_RELAXED);
+		read_pos = __atomic_load_n(&hdr->read_pos, __ATOMIC_RELAXED);
+		metric(buf, "meteor_demod_shm_size_bytes", "gauge",
+		       "Size of the shared memory ring", hdr->size);
+		metric(buf, "meteor_demod_shm_fill_bytes", "gauge",
+		       "Bytes in the shared memory ring not read by the consumer yet",
+		       write_pos > read_pos ? write_pos - read_pos : 0);
+		metric(buf, "meteor_demod_shm_written_bytes_total", "counter",
+		       "Bytes written to the shared memory ring", write_pos);
+		metric(buf, "meteor_demod_shm_overrun_bytes_total", "counter",
+		       "Bytes dropped because the shared memory ring was full",
+		       __atomic_load_n(&hdr->overruns, __ATOMIC_RELAXED));
+	}
+}
+
+/* Write a single unlabeled metric, with its description */
+void
+metric(Buf *buf, const char *name, const char *type, const char *help, double val)
+{
+	buf_printf(buf, "# HELP %s %s\n# TYPE %s %s\n%s %.15g\n", name, help, name, type, name, val);
+}
+
+void
+buf_printf(Buf *buf, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(buf->data + buf->len, sizeof(buf->data) - buf->len, fmt, ap);
+	va_end(ap);
+
+	if (n > 0) {
+		buf->len = MIN(buf->len + n, sizeof(buf->data) - 1);
+	}
+}
+/*}}}*/
@@ -0,0 +1,264 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "pipe.h"
+#include "ring.h"
+#include "utils.h"
+
+#define PIPE_NBLOCKS 4
+#define PIPE_SPIN_COUNT 64
+#define PIPE_SLEEP_NS 100000
+
+static int      pipe_read(Source *self, size_t count);
+static int      pipe_close(Source *self);
+static uint64_t pipe_get_size(const Source *self);
+static uint64_t pipe_get_done(const Source *self);
+static void*    pipe_thr_run(void *x);
+
+typedef struct {
+	Source *upstream;
+	Ring *ring;
+	size_t chunk_size;
+	pthread_t t;
+
+	/* Consumer side */
+	RingBlock *cur;
+	size_t cur_offset;
+	uint64_t done;
+
+	/* Shared between the stage thread and the consumer */
+	volatile int stop;
+	int eof;
+	uint64_t work_ns, stall_ns, starve_ns;
+} PipeState;
+
+/* Start a new thread reading $chunk_size samples at a time from $upstream.
+ * The thread is pinned to $cpu, unless $cpu is negative */
+Source*
+pipe_init(Source *upstream, size_t chunk_size, int cpu)
+{
+	Source *pipe;
+	PipeState *state;
+
+	pipe = safealloc(sizeof(*pipe));
+
+	pipe->count = 0;
+	pipe->samplerate = upstream->samplerate;
+	pipe->bps = upstream->bps;
+	pipe->data = NULL;
+	pipe->read = pipe_read;
+	pipe->close = pipe_close;
+	pipe->size = pipe_get_size;
+	pipe->done = pipe_get_done;
+	pipe->seek = NULL;
+
+	pipe->_backend = safealloc(sizeof(PipeState));
+	state = (PipeState*)pipe->_backend;
+
+	state->upstream = upstream;
+	state->ring = ring_init(PIPE_NBLOCKS, chunk_size);
+	state->chunk_size = chunk_size;
+	state->cur = NULL;
+	state->cur_offset = 0;
+	state->done = 0;
+	state->stop = 0;
+	state->eof = 0;
+	state->work_ns = 0;
+	state->stall_ns = 0;
+	state->starve_ns = 0;
+
+	pthread_create(&state->t, NULL, pipe_thr_run, (void*)state);
+	if (cpu >= 0) {
+		pin_thread(state->t, cpu);
+	}
+
+	return pipe;
+}
+
+/* Get the timing counters and fill level of a pipe. Safe to call from any
+ * thread */
+void
+pipe_get_stats(const Source *self, PipeStats *stats)
+{
+	const PipeState *state = self->_backend;
+
+	stats->work_ns = __atomic_load_n(&state->work_ns, __ATOMIC_RELAXED);
+	stats->stall_ns = __atomic_load_n(&state->stall_ns, __ATOMIC_RELAXED);
+	stats->starve_ns = __atomic_load_n(&state->starve_ns, __ATOMIC_RELAXED);
+	stats->fill = ring_fill(state->ring);
+	stats->nblocks = state->ring->nblocks;
+}
+
+/* Pin a thread to a CPU core, wrapping around if there are fewer cores than
+ * requested */
+int
+pin_thread(pthread_t thr, int cpu)
+{
+	cpu_set_t set;
+	long ncpus;
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpus < 1) {
+		return -1;
+	}
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu % ncpus, &set);
+	return pthread_setaffinity_np(thr, sizeof(set), &set);
+}
+
+/* Busy-wait for a bit, then start yielding the CPU */
+void
+backoff(unsigned *spins)
+{
+	struct timespec ts;
+
+	if (*spins < PIPE_SPIN_COUNT) {
+		(*spins)++;
+		sched_yield();
+	} else {
+		ts.tv_sec = 0;
+		ts.tv_nsec = PIPE_SLEEP_NS;
+		nanosleep(&ts, NULL);
+	}
+}
+
+/* Static functions {{{ */
+uint64_t
+pipe_get_size(const Source *self)
+{
+	const PipeState *state = self->_backend;
+	return state->upstream->size(state->upstream);
+}
+
+/* Return how far into the upstream source the consumer is */
+uint64_t
+pipe_get_done(const Source *self)
+{
+	const PipeState *state = self->_backend;
+	return state->done;
+}
+
+/* Copy $count samples out of the ring, waiting for the stage thread to produce
+ * them if necessary. Returns less than $count samples only at end of stream */
+int
+pipe_read(Source *self, size_t count)
+{
+	PipeState *state;
+	size_t n, copied;
+	unsigned spins;
+	uint64_t t0;
+
+	state = (PipeState*)self->_backend;
+
+	if (!self->data) {
+		self->data = safealloc(sizeof(*self->data) * count);
+	} else if (self->count < count) {
+		free(self->data);
+		self->data = safealloc(sizeof(*self->data) * count);
+	}
+	self->count = count;
+
+	copied = 0;
+	while (copied < count) {
+		/* Grab a new block if the current one has been used up */
+		if (!state->cur) {
+			spins = 0;
+			t0 = get_time_ns();
+			while (!(state->cur = ring_read_acquire(state->ring))) {
+				if (__atomic_load_n(&state->eof, __ATOMIC_ACQUIRE) &&
+				    !(state->cur = ring_read_acquire(state->ring))) {
+					break;
+				}
+				backoff(&spins);
+			}
+			__atomic_store_n(&state->starve_ns, state->starve_ns + get_time_ns() - t0, __ATOMIC_RELAXED);
+
+			if (!state->cur) {
+				break;
+			}
+			state->cur_offset = 0;
+		}
+
+		n = MIN(count - copied, state->cur->count - state->cur_offset);
+		memcpy(self->data + copied, state->cur->data + state->cur_offset, sizeof(*self->data) * n);
+		copied += n;
+		state->cur_offset += n;
+
+		if (state->cur_offset >= state->cur->count) {
+			state->done = state->cur->done;
+			state->cur = NULL;
+			ring_read_release(state->ring);
+		}
+	}
+
+	return copied;
+}
+
+/* Stop the stage thread and free the pipe. Note that this function does not
+ * try to close the upstream source */
+int
+pipe_close(Source *self)
+{
+	PipeState *state;
+
+	state = (PipeState*)self->_backend;
+	state->stop = 1;
+	pthread_join(state->t, NULL);
+
+	ring_free(state->ring);
+	free(state);
+	free(self->data);
+	free(self);
+	return 0;
+}
+
+/* Stage thread: keep reading from upstream until either it runs out of
+ * samples, or the pipe gets closed */
+void*
+pipe_thr_run(void *x)
+{
+	PipeState *state;
+	Source *upstream;
+	RingBlock *block;
+	unsigned spins;
+	uint64_t t0, t1;
+	int count;
+
+	state = (PipeState*)x;
+	upstream = state->upstream;
+
+	while (!state->stop) {
+		/* Wait for a free block */
+		spins = 0;
+		t0 = get_time_ns();
+		while (!(block = ring_write_acquire(state->ring)) && !state->stop) {
+			backoff(&spins);
+		}
+		t1 = get_time_ns();
+		__atomic_store_n(&state->stall_ns, state->stall_ns + t1 - t0, __ATOMIC_RELAXED);
+		if (!block) {
+			break;
+		}
+
+		count = upstream->read(upstream, state->chunk_size);
+		if (count > 0) {
+			memcpy(block->data, upstream->data, sizeof(*block->data) * count);
+			block->count = count;
+			block->done = upstream->done(upstream);
+		}
+		__atomic_store_n(&state->work_ns, state->work_ns + get_time_ns() - t1, __ATOMIC_RELAXED);
+
+		if (count <= 0) {
+			break;
+		}
+		ring_write_commit(state->ring);
+	}
+
+	__atomic_store_n(&state->eof, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+/*}}}*/
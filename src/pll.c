@@ -1,15 +1,11 @@
 #include <stdio.h>
 #include <math.h>
 #include "pll.h"
-#include "tui.h"
+#include "probes.h"
 #include "utils.h"
 
-#define FREQ_MAX 0.8
-#define AVG_WINSIZE 40000
-
-static float costas_compute_delta(float i_branch, float q_branch);
-static float* _lut_tanh;
-inline float lut_tanh(float val);
+static float costas_compute_delta(const Costas *self, float i_branch, float q_branch);
+static float lut_tanh(const float *lut, float val);
 
 /* Initialize a Costas loop for carrier frequency/phase recovery */
 Costas*
@@ -31,12 +27,11 @@ costas_init(float bw)
 	costas->moving_avg = 1;
 	costas->locked = 0;
 
-	_lut_tanh = safealloc(sizeof(float) * 256);
-	for (i=0; i<256; i++) {
-		_lut_tanh[i] = tanh((i-128));
+	/* Each loop gets its own table, so that multiple instances can coexist */
+	for (i=0; i<COSTAS_LUT_SIZE; i++) {
+		costas->lut_tanh[i] = tanh((i-128));
 	}
 
-
 	return costas;
 }
 
@@ -56,27 +51,29 @@ costas_resync(Costas *self, float complex samp)
 	retval = samp * nco_out;
 
 	/* Calculate phase delta and updothe the running average */
-	error = costas_compute_delta(crealf(retval), cimagf(retval))/255.0;
-	self->moving_avg = (self->moving_avg * (AVG_WINSIZE-1) + fabs(error))/AVG_WINSIZE;
+	error = costas_compute_delta(self, crealf(retval), cimagf(retval))/255.0;
+	self->moving_avg = (self->moving_avg * (COSTAS_AVG_WINSIZE-1) + fabs(error))/COSTAS_AVG_WINSIZE;
 	error = float_clamp(error, 1.0);
 
 	/* Apply phase and frequency corrections, and advance the phase */
 	self->nco_phase = fmod(self->nco_phase + self->nco_freq + self->alpha*error, 2*M_PI);
 	self->nco_freq = self->nco_freq + self->beta*error;
 
-	if (self->nco_freq <= -FREQ_MAX) {
-		self->nco_freq = -FREQ_MAX/2;
-	} else if (self->nco_freq >= FREQ_MAX) {
-		self->nco_freq = FREQ_MAX/2;
+	if (self->nco_freq <= -COSTAS_FREQ_MAX) {
+		self->nco_freq = -COSTAS_FREQ_MAX/2;
+	} else if (self->nco_freq >= COSTAS_FREQ_MAX) {
+		self->nco_freq = COSTAS_FREQ_MAX/2;
 	}
 
 	/* Detect whether the PLL is locked, and decrease the BW if it is */
-	if (!self->locked && self->moving_avg < 0.3) {
+	if (!self->locked && self->moving_avg < COSTAS_LOCK_THRESH) {
 		costas_recompute_coeffs(self, self->damping, self->bw/2);
 		self->locked = 1;
-	} else if (self->locked && self->moving_avg > 0.35) {
+		PROBE2(pll_lock, (long)(self->nco_freq*1e6), (long)(self->moving_avg*1e6));
+	} else if (self->locked && self->moving_avg > COSTAS_UNLOCK_THRESH) {
 		costas_recompute_coeffs(self, self->damping, self->bw);
 		self->locked = 0;
+		PROBE2(pll_unlock, (long)(self->nco_freq*1e6), (long)(self->moving_avg*1e6));
 	}
 
 
@@ -102,22 +99,21 @@ void
 costas_free(Costas *self)
 {
 	free(self);
-	free(_lut_tanh);
 }
 
 /* Static functions {{{ */
 /* Compute the delta phase value to use when correcting the NCO frequency */
 float
-costas_compute_delta(float i_branch, float q_branch)
+costas_compute_delta(const Costas *self, float i_branch, float q_branch)
 {
 	float error;
-	error = q_branch * lut_tanh(i_branch) -
-	        i_branch * lut_tanh(q_branch);
+	error = q_branch * lut_tanh(self->lut_tanh, i_branch) -
+	        i_branch * lut_tanh(self->lut_tanh, q_branch);
 	return error;
 }
 
 float
-lut_tanh(float val)
+lut_tanh(const float *lut, float val)
 {
 	if (val > 127) {
 		return 1;
@@ -126,6 +122,6 @@ lut_tanh(float val)
 		return -1;
 	}
 
-	return _lut_tanh[(int)val+128];
+	return lut[(int)val+128];
 }
 /*}}}*/
@@ -0,0 +1,131 @@
+#include "pool.h"
+#include "utils.h"
+
+typedef struct {
+	Pool *pool;
+	unsigned idx;
+} WorkerArgs;
+
+static void* pool_worker_run(void *x);
+
+/* Create a pool that splits work $count ways: $count-1 threads are spawned,
+ * and the thread calling pool_run() takes care of the first slice */
+Pool*
+pool_init(unsigned count)
+{
+	Pool *pool;
+	WorkerArgs *args;
+	unsigned i;
+
+	pool = safealloc(sizeof(*pool));
+	pool->count = count ? count : 1;
+	pool->fn = NULL;
+	pool->arg = NULL;
+	pool->generation = 0;
+	pool->pending = 0;
+	pool->quit = 0;
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->finish, NULL);
+
+	pool->threads = safealloc(sizeof(*pool->threads) * pool->count);
+	for (i=1; i<pool->count; i++) {
+		args = safealloc(sizeof(*args));
+		args->pool = pool;
+		args->idx = i;
+		pthread_create(&pool->threads[i], NULL, pool_worker_run, args);
+	}
+
+	return pool;
+}
+
+/* Run fn(arg, idx, count) for every idx in [0, count), in parallel */
+void
+pool_run(Pool *self, PoolFn fn, void *arg)
+{
+	if (self->count == 1) {
+		fn(arg, 0, 1);
+		return;
+	}
+
+	pthread_mutex_lock(&self->mutex);
+	self->fn = fn;
+	self->arg = arg;
+	self->pending = self->count - 1;
+	self->generation++;
+	pthread_cond_broadcast(&self->start);
+	pthread_mutex_unlock(&self->mutex);
+
+	fn(arg, 0, self->count);
+
+	pthread_mutex_lock(&self->mutex);
+	while (self->pending) {
+		pthread_cond_wait(&self->finish, &self->mutex);
+	}
+	pthread_mutex_unlock(&self->mutex);
+}
+
+/* Stop the worker threads and free the pool */
+void
+pool_free(Pool *self)
+{
+	unsigned i;
+
+	pthread_mutex_lock(&self->mutex);
+	self->quit = 1;
+	pthread_cond_broadcast(&self->start);
+	pthread_mutex_unlock(&self->mutex);
+
+	for (i=1; i<self->count; i++) {
+		pthread_join(self->threads[i], NULL);
+	}
+
+	pthread_mutex_destroy(&self->mutex);
+	pthread_cond_destroy(&self->start);
+	pthread_cond_destroy(&self->finish);
+	free(self->threads);
+	free(self);
+}
+
+/* Static functions {{{ */
+void*
+pool_worker_run(void *x)
+{
+	WorkerArgs *args;
+	Pool *pool;
+	unsigned idx, generation;
+	PoolFn fn;
+	void *arg;
+
+	args = (WorkerArgs*)x;
+	pool = args->pool;
+	idx = args->idx;
+	free(args);
+
+	generation = 0;
+	for (;;) {
+		pthread_mutex_lock(&pool->mutex);
+		while (pool->generation == generation && !pool->quit) {
+			pthread_cond_wait(&pool->start, &pool->mutex);
+		}
+		if (pool->quit) {
+			pthread_mutex_unlock(&pool->mutex);
+			break;
+		}
+		generation = pool->generation;
+		fn = pool->fn;
+		arg = pool->arg;
+		pthread_mutex_unlock(&pool->mutex);
+
+		fn(arg, idx, pool->count);
+
+		pthread_mutex_lock(&pool->mutex);
+		if (!--pool->pending) {
+			pthread_cond_signal(&pool->finish);
+		}
+		pthread_mutex_unlock(&pool->mutex);
+	}
+
+	return NULL;
+}
+/*}}}*/
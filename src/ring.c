@@ -0,0 +1,88 @@
+#include "ring.h"
+#include "utils.h"
+
+/* Create a ring of $nblocks blocks, each holding up to $block_size samples */
+Ring*
+ring_init(unsigned nblocks, size_t block_size)
+{
+	Ring *ring;
+	unsigned i;
+
+	ring = safealloc(sizeof(*ring));
+	ring->blocks = safealloc(sizeof(*ring->blocks) * nblocks);
+	for (i=0; i<nblocks; i++) {
+		ring->blocks[i].data = safealloc(sizeof(*ring->blocks[i].data) * block_size);
+		ring->blocks[i].count = 0;
+		ring->blocks[i].done = 0;
+	}
+
+	ring->nblocks = nblocks;
+	ring->block_size = block_size;
+	ring->head = 0;
+	ring->tail = 0;
+
+	return ring;
+}
+
+/* Get the next free block, or NULL if the ring is full */
+RingBlock*
+ring_write_acquire(Ring *self)
+{
+	unsigned tail;
+
+	tail = __atomic_load_n(&self->tail, __ATOMIC_ACQUIRE);
+	if (self->head - tail >= self->nblocks) {
+		return NULL;
+	}
+
+	return &self->blocks[self->head % self->nblocks];
+}
+
+/* Make the block returned by ring_write_acquire() visible to the consumer */
+void
+ring_write_commit(Ring *self)
+{
+	__atomic_store_n(&self->head, self->head + 1, __ATOMIC_RELEASE);
+}
+
+/* Get the oldest filled block, or NULL if the ring is empty */
+RingBlock*
+ring_read_acquire(Ring *self)
+{
+	unsigned head;
+
+	head = __atomic_load_n(&self->head, __ATOMIC_ACQUIRE);
+	if (head == self->tail) {
+		return NULL;
+	}
+
+	return &self->blocks[self->tail % self->nblocks];
+}
+
+/* Give the block returned by ring_read_acquire() back to the producer */
+void
+ring_read_release(Ring *self)
+{
+	__atomic_store_n(&self->tail, self->tail + 1, __ATOMIC_RELEASE);
+}
+
+/* Number of blocks currently queued. Safe to call from any thread */
+unsigned
+ring_fill(const Ring *self)
+{
+	return __atomic_load_n(&self->head, __ATOMIC_ACQUIRE) -
+	       __atomic_load_n(&self->tail, __ATOMIC_ACQUIRE);
+}
+
+/* Free a ring and all its blocks */
+void
+ring_free(Ring *self)
+{
+	unsigned i;
+
+	for (i=0; i<self->nblocks; i++) {
+		free(self->blocks[i].data);
+	}
+	free(self->blocks);
+	free(self);
+}
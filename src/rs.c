@@ -0,0 +1,259 @@
+#include <pthread.h>
+#include <string.h>
+#include "rs.h"
+
+#define GF_POLY 0x187
+#define FCR 112
+#define PRIM 11
+#define IPRIM 116       /* PRIM * IPRIM = 1 mod RS_N */
+#define A0 RS_N         /* log(0) */
+
+static void     rs_init_tables(void);
+static unsigned modnn(unsigned x);
+
+static pthread_once_t _tables_once = PTHREAD_ONCE_INIT;
+static uint8_t _alpha_to[RS_N+1];
+static uint8_t _index_of[RS_N+1];
+static uint8_t _genpoly[RS_ROOTS+1];
+static uint8_t _to_dual[256];
+static uint8_t _from_dual[256];
+
+/* Correct a codeword in place. Returns the number of corrected bytes, or -1 if
+ * the codeword has too many errors */
+int
+rs_decode(uint8_t *data, unsigned stride)
+{
+	uint8_t cw[RS_N];
+	uint8_t s[RS_ROOTS], lambda[RS_ROOTS+1], b[RS_ROOTS+1], t[RS_ROOTS+1], omega[RS_ROOTS+1];
+	uint8_t reg[RS_ROOTS+1], root[RS_ROOTS], loc[RS_ROOTS];
+	unsigned discr_r, num1, num2, den, tmp, q;
+	int i, j, k, r, el, deg_lambda, deg_omega, count, syn_error;
+
+	pthread_once(&_tables_once, rs_init_tables);
+
+	for (i=0; i<RS_N; i++) {
+		cw[i] = _from_dual[data[i*stride]];
+	}
+
+	/* Compute the syndromes */
+	for (i=0; i<RS_ROOTS; i++) {
+		s[i] = cw[0];
+	}
+	for (j=1; j<RS_N; j++) {
+		for (i=0; i<RS_ROOTS; i++) {
+			if (s[i] == 0) {
+				s[i] = cw[j];
+			} else {
+				s[i] = cw[j] ^ _alpha_to[modnn(_index_of[s[i]] + (FCR+i)*PRIM)];
+			}
+		}
+	}
+
+	syn_error = 0;
+	for (i=0; i<RS_ROOTS; i++) {
+		syn_error |= s[i];
+		s[i] = _index_of[s[i]];
+	}
+	if (!syn_error) {
+		return 0;
+	}
+
+	/* Berlekamp-Massey: find the error locator polynomial */
+	memset(lambda, 0, sizeof(lambda));
+	lambda[0] = 1;
+	for (i=0; i<RS_ROOTS+1; i++) {
+		b[i] = _index_of[lambda[i]];
+	}
+
+	el = 0;
+	for (r=1; r<=RS_ROOTS; r++) {
+		discr_r = 0;
+		for (i=0; i<r; i++) {
+			if (lambda[i] != 0 && s[r-i-1] != A0) {
+				discr_r ^= _alpha_to[modnn(_index_of[lambda[i]] + s[r-i-1])];
+			}
+		}
+		discr_r = _index_of[discr_r];
+
+		if (discr_r == A0) {
+			memmove(&b[1], b, RS_ROOTS);
+			b[0] = A0;
+		} else {
+			t[0] = lambda[0];
+			for (i=0; i<RS_ROOTS; i++) {
+				t[i+1] = lambda[i+1];
+				if (b[i] != A0) {
+					t[i+1] ^= _alpha_to[modnn(discr_r + b[i])];
+				}
+			}
+			if (2*el <= r-1) {
+				el = r - el;
+				for (i=0; i<=RS_ROOTS; i++) {
+					b[i] = (lambda[i] == 0) ? A0 : modnn(_index_of[lambda[i]] - discr_r + RS_N);
+				}
+			} else {
+				memmove(&b[1], b, RS_ROOTS);
+				b[0] = A0;
+			}
+			memcpy(lambda, t, sizeof(lambda));
+		}
+	}
+
+	deg_lambda = 0;
+	for (i=0; i<RS_ROOTS+1; i++) {
+		lambda[i] = _index_of[lambda[i]];
+		if (lambda[i] != A0) {
+			deg_lambda = i;
+		}
+	}
+
+	/* Chien search: find the roots of the error locator */
+	memcpy(&reg[1], &lambda[1], RS_ROOTS);
+	count = 0;
+	for (i=1, k=IPRIM-1; i<=RS_N; i++, k=modnn(k+IPRIM)) {
+		q = 1;
+		for (j=deg_lambda; j>0; j--) {
+			if (reg[j] != A0) {
+				reg[j] = modnn(reg[j] + j);
+				q ^= _alpha_to[reg[j]];
+			}
+		}
+		if (q) {
+			continue;
+		}
+		root[count] = i;
+		loc[count] = k;
+		if (++count == deg_lambda) {
+			break;
+		}
+	}
+	if (deg_lambda != count) {
+		return -1;
+	}
+
+	/* Forney: compute the error values */
+	deg_omega = deg_lambda - 1;
+	for (i=0; i<=deg_omega; i++) {
+		tmp = 0;
+		for (j=i; j>=0; j--) {
+			if (s[i-j] != A0 && lambda[j] != A0) {
+				tmp ^= _alpha_to[modnn(s[i-j] + lambda[j])];
+			}
+		}
+		omega[i] = _index_of[tmp];
+	}
+
+	for (j=count-1; j>=0; j--) {
+		num1 = 0;
+		for (i=deg_omega; i>=0; i--) {
+			if (omega[i] != A0) {
+				num1 ^= _alpha_to[modnn(omega[i] + i*root[j])];
+			}
+		}
+		num2 = _alpha_to[modnn(root[j]*(FCR-1) + RS_N)];
+		den = 0;
+		for (i=((deg_lambda < RS_ROOTS-1) ? deg_lambda : RS_ROOTS-1) & ~1; i>=0; i-=2) {
+			if (lambda[i+1] != A0) {
+				den ^= _alpha_to[modnn(lambda[i+1] + i*root[j])];
+			}
+		}
+		if (num1 && den) {
+			cw[loc[j]] ^= _alpha_to[modnn(_index_of[num1] + _index_of[num2] + RS_N - _index_of[den])];
+		}
+	}
+
+	for (i=0; i<RS_N; i++) {
+		data[i*stride] = _to_dual[cw[i]];
+	}
+	return count;
+}
+
+/* Compute the parity bytes of a codeword, from its first RS_K bytes */
+void
+rs_encode(uint8_t *data, unsigned stride)
+{
+	uint8_t parity[RS_ROOTS];
+	unsigned feedback;
+	int i, j;
+
+	pthread_once(&_tables_once, rs_init_tables);
+
+	memset(parity, 0, sizeof(parity));
+	for (i=0; i<RS_K; i++) {
+		feedback = _index_of[_from_dual[data[i*stride]] ^ parity[0]];
+		if (feedback != A0) {
+			for (j=1; j<RS_ROOTS; j++) {
+				parity[j] ^= _alpha_to[modnn(feedback + _genpoly[RS_ROOTS-j])];
+			}
+		}
+		memmove(&parity[0], &parity[1], RS_ROOTS-1);
+		parity[RS_ROOTS-1] = (feedback != A0) ? _alpha_to[modnn(feedback + _genpoly[0])] : 0;
+	}
+
+	for (i=0; i<RS_ROOTS; i++) {
+		data[(RS_K+i)*stride] = _to_dual[parity[i]];
+	}
+}
+
+/* Static functions {{{ */
+/* Build the Galois field tables, the generator polynomial, and the
+ * conversion tables between the conventional and the dual basis */
+void
+rs_init_tables()
+{
+	static const uint8_t tal[] = { 0x8d, 0xef, 0xec, 0x86, 0xfa, 0x99, 0xaf, 0x7b };
+	unsigned sr, root;
+	int i, j, k;
+
+	_index_of[0] = A0;
+	_alpha_to[A0] = 0;
+	sr = 1;
+	for (i=0; i<RS_N; i++) {
+		_index_of[sr] = i;
+		_alpha_to[i] = sr;
+		sr <<= 1;
+		if (sr & 0x100) {
+			sr ^= GF_POLY;
+		}
+		sr &= 0xFF;
+	}
+
+	_genpoly[0] = 1;
+	for (i=0, root=FCR*PRIM; i<RS_ROOTS; i++, root+=PRIM) {
+		_genpoly[i+1] = 1;
+		for (j=i; j>0; j--) {
+			if (_genpoly[j] != 0) {
+				_genpoly[j] = _genpoly[j-1] ^ _alpha_to[modnn(_index_of[_genpoly[j]] + root)];
+			} else {
+				_genpoly[j] = _genpoly[j-1];
+			}
+		}
+		_genpoly[0] = _alpha_to[modnn(_index_of[_genpoly[0]] + root)];
+	}
+	for (i=0; i<=RS_ROOTS; i++) {
+		_genpoly[i] = _index_of[_genpoly[i]];
+	}
+
+	for (i=0; i<256; i++) {
+		_to_dual[i] = 0;
+		for (j=0; j<8; j++) {
+			for (k=0; k<8; k++) {
+				if (i & (1 << k)) {
+					_to_dual[i] ^= tal[7-k] & (1 << j);
+				}
+			}
+		}
+		_from_dual[_to_dual[i]] = i;
+	}
+}
+
+unsigned
+modnn(unsigned x)
+{
+	while (x >= RS_N) {
+		x -= RS_N;
+		x = (x >> 8) + (x & RS_N);
+	}
+	return x;
+}
+/*}}}*/
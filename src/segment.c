@@ -0,0 +1,378 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "align.h"
+#include "segment.h"
+#include "utils.h"
+#include "wavfile.h"
+
+/* Symbols used to line up two consecutive segments, and how far from the
+ * expected position to look for the best match */
+#define ALIGN_WINSIZE 1024
+#define ALIGN_SLACK 512
+#define ALIGN_MIN_SCORE 0.9
+
+static int      slice_read(Source *self, size_t count);
+static int      slice_close(Source *self);
+static uint64_t slice_get_size(const Source *self);
+static uint64_t slice_get_done(const Source *self);
+static Source*  slice_init(Source *upstream, uint64_t start, uint64_t count);
+static int      stitch(Segmenter *self, unsigned idx, FILE *out_fd, int8_t *tail, size_t *tail_len);
+
+typedef struct {
+	Source *upstream;
+	uint64_t start, count;
+} SliceState;
+
+/* Split the file into $count segments, each one overlapping the previous one
+ * by $overlap seconds */
+Segmenter*
+segmenter_init(const char *fname, unsigned samplerate, const DemodParams *params, unsigned count, float overlap)
+{
+	Segmenter *ret;
+	Segment *seg;
+	Source *src;
+	uint64_t seg_len, start, end, overlap_samp;
+	unsigned i;
+
+	ret = safealloc(sizeof(*ret));
+
+	/* Open the file once to figure out its length */
+	src = open_samples_file(fname, samplerate);
+	ret->total = src->size(src);
+	ret->samplerate = src->samplerate;
+	if (!src->seek || !ret->total) {
+		fatal("Input must be a regular file of known length to split it into segments");
+	}
+	src->close(src);
+
+	/* The overlap must cover the filter delay, plus enough symbols to look for
+	 * the seam in */
+	overlap_samp = overlap * ret->samplerate;
+	if (overlap_samp < params->rrc_order + (double)ALIGN_SLACK * ret->samplerate / params->sym_rate) {
+		fatal("Segment overlap too short to line up the segments");
+	}
+
+	/* Make sure each segment is long enough to line it up with the next */
+	seg_len = ret->total / count;
+	if (seg_len < 2*overlap_samp) {
+		count = ret->total / (2*overlap_samp);
+		count = count ? count : 1;
+		seg_len = ret->total / count;
+	}
+
+	ret->count = count;
+	ret->params = *params;
+	ret->params.nthreads = 1;
+	ret->params.fir_threads = 1;
+	ret->segs = safealloc(sizeof(*ret->segs) * count);
+	ret->fds = safealloc(sizeof(*ret->fds) * count);
+
+	for (i=0; i<count; i++) {
+		seg = &ret->segs[i];
+
+		start = i * seg_len;
+		end = (i == count-1) ? ret->total : (i+1) * seg_len;
+		seg->lead_in = (start < overlap_samp) ? start : overlap_samp;
+
+		seg->src = open_samples_file(fname, samplerate);
+		if (seg->src->seek(seg->src, start - seg->lead_in)) {
+			fatal("Could not seek into the input file");
+		}
+		seg->slice = slice_init(seg->src, start - seg->lead_in, end - start + seg->lead_in);
+		seg->demod = demod_init(seg->slice, &ret->params);
+		seg->tmp_fname = NULL;
+	}
+
+	return ret;
+}
+
+/* Start demodulating all the segments in parallel, each one writing to its
+ * own temporary file next to $out_fname */
+void
+segmenter_start(Segmenter *self, const char *out_fname)
+{
+	unsigned i;
+	size_t len;
+	int fd;
+
+	len = strlen(out_fname) + sizeof(".segXXXXXX.XXXXXX");
+	for (i=0; i<self->count; i++) {
+		self->segs[i].tmp_fname = safealloc(len);
+		snprintf(self->segs[i].tmp_fname, len, "%s.seg%u.XXXXXX", out_fname, i);
+		if ((fd = mkstemp(self->segs[i].tmp_fname)) < 0) {
+			fatal("Could not create temporary file");
+		}
+		close(fd);
+
+		demod_start(self->segs[i].demod, self->segs[i].tmp_fname);
+	}
+}
+
+/* Returns 1 as long as at least one segment is still being processed */
+int
+segmenter_status(const Segmenter *self)
+{
+	unsigned i;
+
+	for (i=0; i<self->count; i++) {
+		if (demod_status(self->segs[i].demod)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Wait up to $timeout ms (forever if negative) for one of the segments to
+ * stop */
+void
+segmenter_wait(Segmenter *self, int timeout)
+{
+	unsigned i, running;
+
+	running = 0;
+	for (i=0; i<self->count; i++) {
+		self->fds[i].fd = demod_status(self->segs[i].demod) ? demod_get_event_fd(self->segs[i].demod) : -1;
+		self->fds[i].events = POLLIN;
+		running += self->fds[i].fd >= 0;
+	}
+	if (!running) {
+		return;
+	}
+	if (poll(self->fds, self->count, timeout) < 0 && errno != EINTR) {
+		fatal("poll() failed");
+	}
+	for (i=0; i<self->count; i++) {
+		if (self->fds[i].fd >= 0 && (self->fds[i].revents & POLLIN)) {
+			demod_get_events(self->segs[i].demod);
+		}
+	}
+}
+
+/* Aggregate the stats of all the segments. pll_locked is set to the number of
+ * segments whose loop is currently locked */
+void
+segmenter_get_stats(const Segmenter *self, DemodStats *stats)
+{
+	DemodStats seg_stats;
+	unsigned i;
+
+	demod_get_stats(self->segs[0].demod, stats);
+	stats->pll_locked = !!stats->pll_locked;
+
+	for (i=1; i<self->count; i++) {
+		demod_get_stats(self->segs[i].demod, &seg_stats);
+		stats->symbols_out += seg_stats.symbols_out;
+		stats->in_done += seg_stats.in_done;
+		stats->pll_locked += !!seg_stats.pll_locked;
+	}
+}
+
+/* Total number of samples to process, overlaps included */
+uint64_t
+segmenter_get_size(const Segmenter *self)
+{
+	uint64_t ret;
+	unsigned i;
+
+	ret = 0;
+	for (i=0; i<self->count; i++) {
+		ret += self->segs[i].slice->size(self->segs[i].slice);
+	}
+	return ret;
+}
+
+/* Wait for all the segments to be processed, then stitch them together into
+ * $out_fname. Returns the number of seams that couldn't be lined up, or -1 on
+ * error */
+int
+segmenter_join(Segmenter *self, const char *out_fname)
+{
+	FILE *out_fd;
+	int8_t tail[2*ALIGN_WINSIZE];
+	size_t tail_len;
+	unsigned i;
+	int ret;
+
+	while (segmenter_status(self)) {
+		segmenter_wait(self, -1);
+	}
+	for (i=0; i<self->count; i++) {
+		demod_join(self->segs[i].demod);
+		self->segs[i].slice->close(self->segs[i].slice);
+		self->segs[i].src->close(self->segs[i].src);
+	}
+
+	ret = 0;
+	tail_len = 0;
+	if (!(out_fd = fopen(out_fname, "w"))) {
+		ret = -1;
+	}
+
+	for (i=0; i<self->count; i++) {
+		if (ret >= 0) {
+			ret += stitch(self, i, out_fd, tail, &tail_len);
+		}
+		unlink(self->segs[i].tmp_fname);
+		free(self->segs[i].tmp_fname);
+	}
+
+	if (out_fd) {
+		fclose(out_fd);
+	}
+	free(self->segs);
+	free(self->fds);
+	free(self);
+
+	return ret;
+}
+
+/* Static functions {{{ */
+/* Append the output of the $idx-th segment to $out_fd, skipping the symbols
+ * that overlap with the previous segment. $tail holds the last symbols written
+ * so far, and gets updated. Returns 1 if the segment couldn't be aligned */
+int
+stitch(Segmenter *self, unsigned idx, FILE *out_fd, int8_t *tail, size_t *tail_len)
+{
+	const Segment *seg;
+	FILE *in_fd;
+	int8_t buf[SYM_CHUNKSIZE];
+	int8_t *head;
+	size_t expected, head_len, skip, lo, hi, n;
+	double delay;
+	long size;
+	AlignResult res;
+	int failed;
+
+	seg = &self->segs[idx];
+	if (!(in_fd = fopen(seg->tmp_fname, "r"))) {
+		return 1;
+	}
+
+	/* Find where the previous segment ended inside this one. The last symbol
+	 * of each segment lags its end by the filter delay */
+	skip = 0;
+	res.rot = 0;
+	failed = 0;
+	if (idx > 0) {
+		delay = ((double)seg->lead_in - self->params.rrc_order) * self->params.sym_rate / self->samplerate;
+		expected = (delay > 0) ? delay : 0;
+		lo = (expected > ALIGN_SLACK) ? expected - ALIGN_SLACK : 0;
+		hi = expected + ALIGN_SLACK;
+
+		head = safealloc(2 * (hi+1));
+		head_len = fread(head, 2, hi+1, in_fd);
+		hi = (head_len > 0) ? head_len - 1 : 0;
+
+		align_find(tail, *tail_len, head, lo, hi, &res);
+		if (res.score >= ALIGN_MIN_SCORE) {
+			skip = res.end;
+		} else {
+			/* Couldn't find the seam: cut at the expected position */
+			skip = expected;
+			res.rot = 0;
+			failed = 1;
+		}
+		free(head);
+	}
+
+	/* Copy the rest of the segment, in the same orientation as the
+	 * previous one */
+	fseek(in_fd, 2*skip, SEEK_SET);
+	while ((n = fread(buf, 1, sizeof(buf), in_fd)) > 0) {
+		soft_rotate(buf, n/2, res.rot);
+		fwrite(buf, n, 1, out_fd);
+	}
+
+	/* Save the last symbols for the next seam */
+	fseek(in_fd, 0, SEEK_END);
+	size = ftell(in_fd);
+	*tail_len = (size > 2*(long)skip) ? (size - 2*(long)skip) / 2 : 0;
+	if (*tail_len > ALIGN_WINSIZE) {
+		*tail_len = ALIGN_WINSIZE;
+	}
+	fseek(in_fd, size - 2*(*tail_len), SEEK_SET);
+	*tail_len = fread(tail, 2, *tail_len, in_fd);
+	soft_rotate(tail, *tail_len, res.rot);
+
+	fclose(in_fd);
+	return failed;
+}
+
+/* Wrap $upstream, so that it stops after $count samples. $start is where the
+ * upstream source is currently positioned */
+Source*
+slice_init(Source *upstream, uint64_t start, uint64_t count)
+{
+	Source *slice;
+	SliceState *state;
+
+	slice = safealloc(sizeof(*slice));
+
+	slice->count = 0;
+	slice->samplerate = upstream->samplerate;
+	slice->bps = upstream->bps;
+	slice->data = NULL;
+	slice->read = slice_read;
+	slice->close = slice_close;
+	slice->size = slice_get_size;
+	slice->done = slice_get_done;
+	slice->seek = NULL;
+
+	slice->_backend = safealloc(sizeof(SliceState));
+	state = (SliceState*)slice->_backend;
+	state->upstream = upstream;
+	state->start = start;
+	state->count = count;
+
+	return slice;
+}
+
+int
+slice_read(Source *self, size_t count)
+{
+	SliceState *state;
+	uint64_t left;
+	int ret;
+
+	state = (SliceState*)self->_backend;
+	left = state->count - slice_get_done(self);
+	if (count > left) {
+		count = left;
+	}
+	if (!count) {
+		return 0;
+	}
+
+	ret = state->upstream->read(state->upstream, count);
+	self->data = state->upstream->data;
+	self->count = state->upstream->count;
+
+	return ret;
+}
+
+uint64_t
+slice_get_size(const Source *self)
+{
+	const SliceState *state = self->_backend;
+	return state->count;
+}
+
+uint64_t
+slice_get_done(const Source *self)
+{
+	const SliceState *state = self->_backend;
+	return state->upstream->done(state->upstream) - state->start;
+}
+
+/* Free the slice. Note that this function does not try to close the upstream
+ * source */
+int
+slice_close(Source *self)
+{
+	free(self->_backend);
+	free(self);
+	return 0;
+}
+/*}}}*/
@@ -0,0 +1,241 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include "shmring.h"
+#include "utils.h"
+
+static ShmRing* shmring_map(char *name, int fd, size_t map_size, int owner);
+static char*    shmring_name(const char *name);
+static long     futex(uint32_t *addr, int op, uint32_t val, const struct timespec *timeout);
+
+/* Create the shared-memory segment $name, with a data area of at least $size
+ * bytes. The symbols written to the ring are passed on to $next, if any */
+ShmRing*
+shmring_create(const char *name, size_t size, unsigned sym_rate, DemodSink next, void *next_ctx)
+{
+	ShmRing *ret;
+	ShmRingHeader *hdr;
+	char *shm_name;
+	size_t header_size, ring_size;
+	int fd;
+
+	/* A power of two, so that positions can be wrapped with a mask */
+	for (ring_size = 1; ring_size < size; ring_size <<= 1)
+		;
+	header_size = sysconf(_SC_PAGESIZE);
+	while (header_size < sizeof(ShmRingHeader)) {
+		header_size <<= 1;
+	}
+
+	shm_name = shmring_name(name);
+	fd = shm_open(shm_name, O_RDWR | O_CREAT | O_TRUNC, 0660);
+	if (fd < 0 || ftruncate(fd, header_size + ring_size)) {
+		fatal("Could not create the shared memory ring");
+		/* Not reached */
+		return NULL;
+	}
+
+	ret = shmring_map(shm_name, fd, header_size + ring_size, 1);
+	close(fd);
+	ret->next = next;
+	ret->next_ctx = next_ctx;
+
+	hdr = ret->hdr;
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->version = SHMRING_VERSION;
+	hdr->header_size = header_size;
+	hdr->sym_rate = sym_rate;
+	hdr->size = ring_size;
+	ret->data = (int8_t*)hdr + header_size;
+
+	/* Publish the magic last, consumers check it before anything else */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(hdr->magic, SHMRING_MAGIC, sizeof(hdr->magic));
+
+	return ret;
+}
+
+/* DemodSink: consume $len bytes of soft symbols */
+void
+shmring_sink(const int8_t *syms, size_t len, void *ctx)
+{
+	ShmRing *self;
+	ShmRingHeader *hdr;
+	uint64_t write_pos, read_pos;
+	size_t offset, n;
+
+	self = (ShmRing*)ctx;
+	hdr = self->hdr;
+
+	write_pos = hdr->write_pos;
+	read_pos = __atomic_load_n(&hdr->read_pos, __ATOMIC_ACQUIRE);
+
+	if (hdr->size - (write_pos - read_pos) < len) {
+		/* Never block the demodulator, drop the whole chunk instead */
+		__atomic_store_n(&hdr->overruns, hdr->overruns + len, __ATOMIC_RELAXED);
+	} else {
+		offset = write_pos & (hdr->size - 1);
+		n = MIN(len, hdr->size - offset);
+		memcpy(self->data + offset, syms, n);
+		memcpy(self->data, syms + n, len - n);
+
+		__atomic_store_n(&hdr->write_ns, get_time_ns(), __ATOMIC_RELAXED);
+		__atomic_store_n(&hdr->write_pos, write_pos + len, __ATOMIC_RELEASE);
+		__atomic_add_fetch(&hdr->write_seq, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&hdr->waiting, __ATOMIC_SEQ_CST)) {
+			futex(&hdr->write_seq, FUTEX_WAKE, INT_MAX, NULL);
+		}
+	}
+
+	if (self->next) {
+		self->next(syms, len, self->next_ctx);
+	}
+}
+
+/* Map an existing ring, created by another process */
+ShmRing*
+shmring_open(const char *name)
+{
+	ShmRing *ret;
+	ShmRingHeader hdr;
+	char *shm_name;
+	int fd;
+
+	shm_name = shmring_name(name);
+	fd = shm_open(shm_name, O_RDWR, 0);
+	if (fd < 0) {
+		free(shm_name);
+		return NULL;
+	}
+
+	if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    memcmp(hdr.magic, SHMRING_MAGIC, sizeof(hdr.magic)) || hdr.version != SHMRING_VERSION) {
+		close(fd);
+		free(shm_name);
+		return NULL;
+	}
+
+	ret = shmring_map(shm_name, fd, hdr.header_size + hdr.size, 0);
+	close(fd);
+	ret->data = (int8_t*)ret->hdr + hdr.header_size;
+
+	return ret;
+}
+
+/* Wait up to $timeout_ms ms for data to be available, and point $syms to it.
+ * Returns the number of contiguous bytes that can be read, 0 if the wait
+ * timed out or if the producer is done and the ring is empty */
+size_t
+shmring_read_acquire(ShmRing *self, const int8_t **syms, int timeout_ms)
+{
+	ShmRingHeader *hdr;
+	struct timespec timeout;
+	uint64_t write_pos, read_pos;
+	uint32_t seq;
+	size_t offset;
+
+	hdr = self->hdr;
+	read_pos = hdr->read_pos;
+	write_pos = __atomic_load_n(&hdr->write_pos, __ATOMIC_ACQUIRE);
+
+	if (write_pos == read_pos && !__atomic_load_n(&hdr->closed, __ATOMIC_ACQUIRE)) {
+		seq = __atomic_load_n(&hdr->write_seq, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&hdr->waiting, 1, __ATOMIC_SEQ_CST);
+
+		/* Check again now that the producer is guaranteed to see the flag */
+		write_pos = __atomic_load_n(&hdr->write_pos, __ATOMIC_ACQUIRE);
+		if (write_pos == read_pos) {
+			timeout.tv_sec = timeout_ms / 1000;
+			timeout.tv_nsec = (timeout_ms % 1000) * 1000L * 1000;
+			futex(&hdr->write_seq, FUTEX_WAIT, seq, &timeout);
+			write_pos = __atomic_load_n(&hdr->write_pos, __ATOMIC_ACQUIRE);
+		}
+		__atomic_store_n(&hdr->waiting, 0, __ATOMIC_RELAXED);
+	}
+
+	offset = read_pos & (hdr->size - 1);
+	*syms = self->data + offset;
+	return MIN(write_pos - read_pos, hdr->size - offset);
+}
+
+/* Give $len bytes returned by shmring_read_acquire() back to the producer */
+void
+shmring_read_release(ShmRing *self, size_t len)
+{
+	__atomic_store_n(&self->hdr->read_pos, self->hdr->read_pos + len, __ATOMIC_RELEASE);
+}
+
+/* Whether the producer is done and all the symbols have been read */
+int
+shmring_eof(const ShmRing *self)
+{
+	return __atomic_load_n(&self->hdr->closed, __ATOMIC_ACQUIRE) &&
+	       __atomic_load_n(&self->hdr->write_pos, __ATOMIC_ACQUIRE) == self->hdr->read_pos;
+}
+
+/* Unmap the ring. The producer also marks it as closed, wakes the consumer
+ * up and removes the name; the memory stays valid until the consumer unmaps
+ * it too */
+void
+shmring_close(ShmRing *self)
+{
+	if (self->owner) {
+		__atomic_store_n(&self->hdr->closed, 1, __ATOMIC_RELEASE);
+		__atomic_add_fetch(&self->hdr->write_seq, 1, __ATOMIC_SEQ_CST);
+		futex(&self->hdr->write_seq, FUTEX_WAKE, INT_MAX, NULL);
+		shm_unlink(self->name);
+	}
+
+	munmap(self->hdr, self->map_size);
+	free(self->name);
+	free(self);
+}
+
+/* Static functions {{{ */
+ShmRing*
+shmring_map(char *name, int fd, size_t map_size, int owner)
+{
+	ShmRing *ret;
+	void *addr;
+
+	addr = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED) {
+		fatal("Could not map the shared memory ring");
+		/* Not reached */
+		return NULL;
+	}
+
+	ret = safealloc(sizeof(*ret));
+	ret->name = name;
+	ret->hdr = addr;
+	ret->map_size = map_size;
+	ret->owner = owner;
+	ret->next = NULL;
+	ret->next_ctx = NULL;
+
+	return ret;
+}
+
+/* Shared memory object names must start with a slash */
+char*
+shmring_name(const char *name)
+{
+	char *ret;
+
+	ret = safealloc(strlen(name) + 2);
+	sprintf(ret, "%s%s", name[0] == '/' ? "" : "/", name);
+	return ret;
+}
+
+long
+futex(uint32_t *addr, int op, uint32_t val, const struct timespec *timeout)
+{
+	return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+/*}}}*/
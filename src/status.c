@@ -0,0 +1,335 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "status.h"
+#include "utils.h"
+
+/* Longest event, longer ones are dropped */
+#define STATUS_LINE_SIZE 4096
+
+typedef struct {
+	char data[STATUS_LINE_SIZE];
+	size_t len;
+} Line;
+
+static void  status_begin(Line *line, const char *event);
+static void  status_emit(StatusStream *self, const Line *line, int wait);
+static void* status_thr_run(void *x);
+static int   write_all(int fd, const char *buf, size_t len);
+static void  line_printf(Line *line, const char *fmt, ...);
+static void  line_str(Line *line, const char *str);
+
+/* Start a status stream on $fd, with periodic stats every $interval_ms.
+ * Returns NULL if $fd is not open */
+StatusStream*
+status_init(int fd, unsigned interval_ms)
+{
+	StatusStream *self;
+	sigset_t set, old;
+
+	if (fcntl(fd, F_GETFL) < 0) {
+		return NULL;
+	}
+
+	self = safealloc(sizeof(*self));
+	self->fd = fd;
+	self->interval_ns = interval_ms * 1000000ULL;
+	self->next_ns = 0;
+	self->samplerate = 0;
+	self->in_size = 0;
+	self->locked = 0;
+	self->level_changes = 0;
+	self->prev_in_done = 0;
+	self->prev_wall_ns = 0;
+	self->closing = 0;
+	self->failed = 0;
+	self->dropped = 0;
+	self->buf = safealloc(STATUS_BUF_SIZE);
+	self->wbuf = safealloc(STATUS_BUF_SIZE);
+	self->len = 0;
+	pthread_mutex_init(&self->mutex, NULL);
+	pthread_cond_init(&self->cond, NULL);
+
+	/* The writer runs with SIGPIPE blocked, so that a reader going away
+	 * shows up as EPIPE instead of killing the program */
+	sigemptyset(&set);
+	sigaddset(&set, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &set, &old);
+	pthread_create(&self->t, NULL, status_thr_run, self);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	return self;
+}
+
+/* Report the parameters of the run. $out_fname can be NULL, and $in_size is 0
+ * for live inputs */
+void
+status_start(StatusStream *self, const char *in_fname, const char *out_fname,
+             unsigned samplerate, const DemodParams *params, uint64_t in_size)
+{
+	Line line;
+
+	self->samplerate = samplerate;
+	self->in_size = in_size;
+
+	status_begin(&line, "start");
+	line_printf(&line, ",\"input\":");
+	line_str(&line, in_fname);
+	line_printf(&line, ",\"output\":");
+	line_str(&line, out_fname);
+	line_printf(&line, ",\"samplerate\":%u,\"symrate\":%u,\"rrc_order\":%u,\"rrc_alpha\":%g,\"oversamp\":%u,"
+	            "\"pll_bw\":%g,\"threads\":%u,\"fir_threads\":%u,\"chunk_size\":%u",
+	            samplerate, params->sym_rate, params->rrc_order, params->rrc_alpha, params->interp_factor,
+	            params->pll_bw, params->nthreads, params->fir_threads,
+	            params->chunk_size ? params->chunk_size : CHUNKSIZE);
+	if (in_size) {
+		line_printf(&line, ",\"size\":%llu}\n", (unsigned long long)in_size);
+	} else {
+		line_printf(&line, ",\"size\":null}\n");
+	}
+	status_emit(self, &line, 0);
+}
+
+/* Report the lock and lag monitor transitions since the last call, and the
+ * stats if the interval has elapsed */
+void
+status_update(StatusStream *self, const DemodStats *stats)
+{
+	Line line;
+	uint64_t now;
+	double rate;
+
+	if (stats->pll_locked != self->locked) {
+		status_begin(&line, stats->pll_locked ? "lock" : "unlock");
+		line_printf(&line, ",\"symbols\":%llu,\"carrier_hz\":%.1f,\"snr_db\":%.1f}\n",
+		            (unsigned long long)stats->symbols_out, stats->freq, stats->snr);
+		status_emit(self, &line, 0);
+		self->locked = stats->pll_locked;
+	}
+	if (stats->level_changes != self->level_changes) {
+		status_begin(&line, "level");
+		line_printf(&line, ",\"level\":%u,\"rrc_order\":%u,\"oversamp\":%u,\"lag_s\":%.2f}\n",
+		            stats->level, stats->rrc_order, stats->interp_factor, stats->level_lag);
+		status_emit(self, &line, 0);
+		self->level_changes = stats->level_changes;
+	}
+
+	now = get_time_ns();
+	if (now < self->next_ns) {
+		return;
+	}
+	self->next_ns = now + self->interval_ns;
+
+	/* Throughput since the previous stats event */
+	rate = 0;
+	if (stats->wall_ns > self->prev_wall_ns) {
+		rate = (stats->in_done - self->prev_in_done) * 1e9 / (stats->wall_ns - self->prev_wall_ns);
+	}
+	self->prev_in_done = stats->in_done;
+	self->prev_wall_ns = stats->wall_ns;
+
+	status_begin(&line, "stats");
+	if (self->in_size) {
+		line_printf(&line, ",\"progress\":%.4f", (double)stats->in_done / self->in_size);
+	} else {
+		line_printf(&line, ",\"progress\":null");
+	}
+	line_printf(&line, ",\"samples\":%llu,\"symbols\":%llu,\"locked\":%s,\"carrier_hz\":%.1f,\"snr_db\":%.1f,"
+	            "\"evm\":%.3f,\"gain\":%.3f,\"msps\":%.3f,\"realtime\":%.2f,\"lag_s\":%.2f,\"level\":%u,"
+	            "\"dropped\":%lu}\n",
+	            (unsigned long long)stats->in_done, (unsigned long long)stats->symbols_out,
+	            stats->pll_locked ? "true" : "false", stats->freq, stats->snr, stats->evm, stats->gain,
+	            rate/1e6, self->samplerate ? rate/self->samplerate : 0, stats->lag, stats->level,
+	            __atomic_load_n(&self->dropped, __ATOMIC_RELAXED));
+	status_emit(self, &line, 0);
+}
+
+/* Report the final summary. Unlike the other events, it waits for room in the
+ * buffer instead of being dropped */
+void
+status_finish(StatusStream *self, const DemodStats *stats, int aborted)
+{
+	Line line;
+	double secs, rate;
+
+	secs = stats->wall_ns / 1e9;
+	rate = secs > 0 ? stats->in_done / secs : 0;
+
+	status_begin(&line, "end");
+	line_printf(&line, ",\"status\":\"%s\",\"duration_s\":%.3f,\"samples\":%llu,\"symbols\":%llu,"
+	            "\"locked_pct\":%.2f,\"snr_avg_db\":%.1f,\"msps\":%.3f,\"realtime\":%.2f,\"dropped\":%lu}\n",
+	            aborted ? "aborted" : "completed", secs, (unsigned long long)stats->in_done,
+	            (unsigned long long)stats->symbols_out,
+	            stats->symbols_out ? stats->symbols_locked*100.0/stats->symbols_out : 0, stats->snr_avg,
+	            rate/1e6, self->samplerate ? rate/self->samplerate : 0,
+	            __atomic_load_n(&self->dropped, __ATOMIC_RELAXED));
+	status_emit(self, &line, 1);
+}
+
+/* When the next stats event is due, in get_time_ns() time */
+uint64_t
+status_due(const StatusStream *self)
+{
+	return self->next_ns;
+}
+
+/* Wait for the reader to take everything that is still queued, and free the
+ * stream. The fd is left open */
+void
+status_close(StatusStream *self)
+{
+	pthread_mutex_lock(&self->mutex);
+	self->closing = 1;
+	pthread_cond_broadcast(&self->cond);
+	pthread_mutex_unlock(&self->mutex);
+	pthread_join(self->t, NULL);
+
+	pthread_mutex_destroy(&self->mutex);
+	pthread_cond_destroy(&self->cond);
+	free(self->buf);
+	free(self->wbuf);
+	free(self);
+}
+
+/* Static functions {{{ */
+/* Start an event: its type, and the wall clock time */
+void
+status_begin(Line *line, const char *event)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	line->len = 0;
+	line_printf(line, "{\"event\":\"%s\",\"time\":%.3f", event, ts.tv_sec + ts.tv_nsec/1e9);
+}
+
+/* Queue an event for the writer thread. Unless $wait is set, events that don't
+ * fit in the buffer are dropped whole, so that the stream stays valid */
+void
+status_emit(StatusStream *self, const Line *line, int wait)
+{
+	if (line->len >= sizeof(line->data) - 1) {
+		__atomic_add_fetch(&self->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	pthread_mutex_lock(&self->mutex);
+	while (wait && !self->failed && self->len + line->len > STATUS_BUF_SIZE) {
+		pthread_cond_wait(&self->cond, &self->mutex);
+	}
+	if (self->failed) {
+		/* The reader is gone */
+	} else if (self->len + line->len > STATUS_BUF_SIZE) {
+		__atomic_add_fetch(&self->dropped, 1, __ATOMIC_RELAXED);
+	} else {
+		memcpy(self->buf + self->len, line->data, line->len);
+		self->len += line->len;
+		pthread_cond_broadcast(&self->cond);
+	}
+	pthread_mutex_unlock(&self->mutex);
+}
+
+/* Writer thread: take the queued events, and write them out while the next
+ * ones are queued in the other buffer. Stops once the stream is closed and
+ * everything has been written, or when the reader goes away */
+void*
+status_thr_run(void *x)
+{
+	StatusStream *self;
+	char *tmp;
+	size_t len;
+
+	self = (StatusStream*)x;
+	pthread_mutex_lock(&self->mutex);
+	for (;;) {
+		while (!self->len && !self->closing) {
+			pthread_cond_wait(&self->cond, &self->mutex);
+		}
+		if (!self->len) {
+			break;
+		}
+
+		tmp = self->wbuf;
+		self->wbuf = self->buf;
+		self->buf = tmp;
+		len = self->len;
+		self->len = 0;
+		pthread_cond_broadcast(&self->cond);
+		pthread_mutex_unlock(&self->mutex);
+
+		if (write_all(self->fd, self->wbuf, len)) {
+			pthread_mutex_lock(&self->mutex);
+			self->failed = 1;
+			self->len = 0;
+			pthread_cond_broadcast(&self->cond);
+			break;
+		}
+		pthread_mutex_lock(&self->mutex);
+	}
+	pthread_mutex_unlock(&self->mutex);
+
+	return NULL;
+}
+
+/* Blocking write of the whole buffer. Returns 0 on success */
+int
+write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, buf, len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n <= 0) {
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+void
+line_printf(Line *line, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(line->data + line->len, sizeof(line->data) - line->len, fmt, ap);
+	va_end(ap);
+
+	if (n > 0) {
+		line->len = MIN(line->len + n, sizeof(line->data) - 1);
+	}
+}
+
+/* Append a JSON string, or null */
+void
+line_str(Line *line, const char *str)
+{
+	if (!str) {
+		line_printf(line, "null");
+		return;
+	}
+
+	line_printf(line, "\"");
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\') {
+			line_printf(line, "\\%c", *str);
+		} else if ((unsigned char)*str < 0x20) {
+			line_printf(line, "\\u%04x", *str);
+		} else {
+			line_printf(line, "%c", *str);
+		}
+	}
+	line_printf(line, "\"");
+}
+/*}}}*/
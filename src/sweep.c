@@ -0,0 +1,320 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include "fanout.h"
+#include "lanes.h"
+#include "sweep.h"
+#include "utils.h"
+#include "wavfile.h"
+
+typedef struct {
+	DemodParams params;
+	Source *branch;         /* NULL once closed */
+	Demod *demod;
+	Lanes *lanes;           /* With use_lanes, the group this run is a lane of */
+	unsigned lane;
+	char *out_fname;
+	float lock, evm;
+} SweepRun;
+
+static unsigned parse_list(const char *list, float *values);
+static char*    sweep_out_fname(const char *prefix, const DemodParams *params);
+static void     sweep_print_params(const DemodParams *params, char *buf, size_t len);
+static void     sweep_init_lanes(SweepRun *runs, unsigned count);
+static int      sweep_status(const SweepRun *run);
+static int      sweep_event_fd(const SweepRun *run);
+static void     sweep_get_stats(const SweepRun *run, DemodStats *stats);
+
+/* Demodulate $in_fname once for every combination of the values in $lists,
+ * reading the input only once. A NULL list means the value in $params is used.
+ * Each output is named after $out_prefix and the parameters it was made with.
+ * With $use_lanes, LANES combinations at a time share a thread and are run by
+ * the multi-stream demodulator. Returns 0 on success */
+int
+sweep_run(const char *in_fname, const char *out_prefix, unsigned samplerate, const DemodParams *params,
+          char *const lists[SWEEP_NPARAMS], int use_lanes, int upd_interval, int quiet,
+          int (*log)(const char *msg, ...))
+{
+	float values[SWEEP_NPARAMS][SWEEP_MAX_RUNS];
+	unsigned nvalues[SWEEP_NPARAMS];
+	unsigned idx[SWEEP_NPARAMS];
+	SweepRun *runs, *run, *best;
+	Source *src;
+	Fanout *fan;
+	DemodStats stats;
+	struct pollfd *fds;
+	uint64_t in_total, in_min, now_ns, next_ns;
+	unsigned i, j, count, running;
+	int timeout;
+	char desc[64];
+
+	/* Expand the lists into the set of combinations */
+	count = 1;
+	for (i=0; i<SWEEP_NPARAMS; i++) {
+		nvalues[i] = lists[i] ? parse_list(lists[i], values[i]) : 0;
+		if (!nvalues[i]) {
+			nvalues[i] = 1;
+			values[i][0] = (i == SWEEP_PLL_BW) ? params->pll_bw :
+			               (i == SWEEP_ALPHA) ? params->rrc_alpha :
+			               (i == SWEEP_FIR_ORDER) ? params->rrc_order : params->interp_factor;
+		}
+		count *= nvalues[i];
+		idx[i] = 0;
+		if (count > SWEEP_MAX_RUNS) {
+			fatal("Too many parameter combinations");
+		}
+	}
+
+	src = open_samples_file(in_fname, samplerate);
+	if (!src) {
+		fatal("Couldn't open samples file");
+	}
+	fan = fanout_init(src, count, CHUNKSIZE);
+
+	runs = safealloc(sizeof(*runs) * count);
+	for (i=0; i<count; i++) {
+		run = &runs[i];
+		run->params = *params;
+		run->params.nthreads = 1;
+		run->params.fir_threads = 1;
+		run->params.pll_bw = values[SWEEP_PLL_BW][idx[SWEEP_PLL_BW]];
+		run->params.rrc_alpha = values[SWEEP_ALPHA][idx[SWEEP_ALPHA]];
+		run->params.rrc_order = values[SWEEP_FIR_ORDER][idx[SWEEP_FIR_ORDER]];
+		run->params.interp_factor = values[SWEEP_OVERSAMP][idx[SWEEP_OVERSAMP]];
+
+		run->out_fname = sweep_out_fname(out_prefix, &run->params);
+		run->branch = fanout_branch(fan, i);
+		run->demod = use_lanes ? NULL : demod_init(run->branch, &run->params);
+		run->lanes = NULL;
+
+		/* Next combination, odometer-style */
+		for (j=0; j<SWEEP_NPARAMS && ++idx[j] == nvalues[j]; j++) {
+			idx[j] = 0;
+		}
+	}
+
+	if (use_lanes) {
+		sweep_init_lanes(runs, count);
+	}
+
+	if (!quiet) {
+		splash();
+		log("Input: %s, samplerate: %d\n", in_fname, src->samplerate);
+		log("Sweeping %u parameter combinations\n", count);
+		if (use_lanes) {
+			log("Running %u streams per thread\n", LANES);
+		}
+	}
+
+	for (i=0; i<count; i++) {
+		if (runs[i].demod) {
+			demod_start(runs[i].demod, runs[i].out_fname);
+		}
+	}
+
+	/* Status update loop. The slowest instance sets the pace for all of them.
+	 * Wake up when the next update is due, or when an instance stops */
+	fds = safealloc(sizeof(*fds) * count);
+	for (i=0; i<count; i++) {
+		fds[i].fd = sweep_event_fd(&runs[i]);
+		fds[i].events = POLLIN;
+	}
+	in_total = src->size(src);
+	next_ns = get_time_ns() + upd_interval*1000000ULL;
+	do {
+		now_ns = get_time_ns();
+		timeout = (next_ns > now_ns) ? (int)((next_ns - now_ns + 999999) / 1000000) : 0;
+		if (poll(fds, count, timeout) < 0 && errno != EINTR) {
+			fatal("poll() failed");
+		}
+
+		running = 0;
+		in_min = in_total;
+		for (i=0; i<count; i++) {
+			if (fds[i].fd >= 0 && (fds[i].revents & POLLIN) && runs[i].demod) {
+				demod_get_events(runs[i].demod);
+			}
+			if (!sweep_status(&runs[i])) {
+				fds[i].fd = -1;
+			}
+			running += sweep_status(&runs[i]);
+			sweep_get_stats(&runs[i], &stats);
+			in_min = MIN(in_min, stats.in_done);
+		}
+
+		now_ns = get_time_ns();
+		if (now_ns >= next_ns) {
+			next_ns = now_ns + upd_interval*1000000ULL;
+			if (!quiet && running) {
+				log("(%5.1f%%) %u/%u instances running\n", in_total ? (float)in_min/in_total*100 : 0, running, count);
+			}
+		}
+	} while (running);
+	free(fds);
+
+	/* Report the results, and point out the lowest EVM among the instances
+	 * that stayed locked the longest */
+	best = NULL;
+	for (i=0; i<count; i++) {
+		run = &runs[i];
+		sweep_get_stats(run, &stats);
+		if (run->demod) {
+			demod_join(run->demod);
+		} else if (!run->lane) {
+			lanes_join(run->lanes);
+		}
+
+		run->lock = stats.symbols_out ? (float)stats.symbols_locked/stats.symbols_out : 0;
+		run->evm = stats.evm;
+
+		if (!quiet) {
+			sweep_print_params(&run->params, desc, sizeof(desc));
+			log("%s: locked %5.1f%%, EVM %5.1f%% -> %s\n", desc, run->lock*100, run->evm*100, run->out_fname);
+		}
+
+		/* Lock percentages within a point of each other are considered equal */
+		if (!best || run->lock > best->lock + 0.01 ||
+		    (run->lock > best->lock - 0.01 && run->evm < best->evm)) {
+			best = run;
+		}
+	}
+	if (!quiet && best) {
+		log("Best: %s\n", best->out_fname);
+	}
+
+	for (i=0; i<count; i++) {
+		if (runs[i].lanes && !runs[i].lane) {
+			lanes_free(runs[i].lanes);
+		}
+		if (runs[i].branch) {
+			runs[i].branch->close(runs[i].branch);
+		}
+		free(runs[i].out_fname);
+	}
+	fanout_free(fan);
+	src->close(src);
+	free(runs);
+
+	return 0;
+}
+
+/* Static functions {{{ */
+/* Group the runs LANES at a time, and start one multi-stream demodulator for
+ * each group. The lanes of a group read their branches in lockstep from the
+ * same thread, so they must all consume the input at the same rate: runs with
+ * different oversampling factors go in different groups. Those are contiguous,
+ * since the oversampling factor is the last parameter to change */
+void
+sweep_init_lanes(SweepRun *runs, unsigned count)
+{
+	Source *srcs[LANES];
+	DemodParams params[LANES];
+	const char *fnames[LANES];
+	Lanes *lanes;
+	unsigned i, j, n;
+
+	for (i=0; i<count; i += n) {
+		n = MIN(count - i, LANES);
+		for (j=1; j<n; j++) {
+			if (runs[i+j].params.interp_factor != runs[i].params.interp_factor) {
+				n = j;
+				break;
+			}
+		}
+		for (j=0; j<n; j++) {
+			srcs[j] = runs[i+j].branch;
+			params[j] = runs[i+j].params;
+			fnames[j] = runs[i+j].out_fname;
+		}
+
+		lanes = lanes_init(srcs, params, n);
+		for (j=0; j<n; j++) {
+			runs[i+j].lanes = lanes;
+			runs[i+j].lane = j;
+
+			/* Detach the branches that won't be read, so that they don't
+			 * hold the others back */
+			if (lanes_shares_filter(lanes, j)) {
+				runs[i+j].branch->close(runs[i+j].branch);
+				runs[i+j].branch = NULL;
+			}
+		}
+		lanes_start(lanes, fnames);
+	}
+}
+
+/* A lane is done when its whole group is */
+int
+sweep_status(const SweepRun *run)
+{
+	return run->demod ? demod_status(run->demod) : lanes_status(run->lanes);
+}
+
+/* Event fd that signals the end of $run. The lanes of a group share one, so
+ * it is only returned for the first lane */
+int
+sweep_event_fd(const SweepRun *run)
+{
+	if (run->demod) {
+		return demod_get_event_fd(run->demod);
+	}
+	return run->lane ? -1 : lanes_get_event_fd(run->lanes);
+}
+
+void
+sweep_get_stats(const SweepRun *run, DemodStats *stats)
+{
+	if (run->demod) {
+		demod_get_stats(run->demod, stats);
+	} else {
+		lanes_get_stats(run->lanes, run->lane, stats);
+	}
+}
+
+/* Parse a comma-separated list of numbers. Returns how many were found */
+unsigned
+parse_list(const char *list, float *values)
+{
+	const char *ptr;
+	char *end;
+	unsigned count;
+
+	count = 0;
+	for (ptr = list; *ptr; ptr = end + (*end == ',')) {
+		if (count >= SWEEP_MAX_RUNS) {
+			fatal("Too many values in a parameter list");
+		}
+		values[count++] = strtod(ptr, &end);
+		if (end == ptr || (*end && *end != ',')) {
+			fatal("Invalid parameter list");
+		}
+	}
+
+	return count;
+}
+
+/* Name the output after the parameters it was produced with */
+char*
+sweep_out_fname(const char *prefix, const DemodParams *params)
+{
+	char desc[64];
+	char *ret;
+	size_t len;
+
+	snprintf(desc, sizeof(desc), "-b%g-a%g-f%u-O%u.s",
+	         params->pll_bw, params->rrc_alpha, params->rrc_order, params->interp_factor);
+	len = strlen(prefix) + strlen(desc) + 1;
+	ret = safealloc(len);
+	snprintf(ret, len, "%s%s", prefix, desc);
+
+	return ret;
+}
+
+void
+sweep_print_params(const DemodParams *params, char *buf, size_t len)
+{
+	snprintf(buf, len, "PLL bw %5g, alpha %4g, FIR order %3u, oversamp %u",
+	         params->pll_bw, params->rrc_alpha, params->rrc_order, params->interp_factor);
+}
+/*}}}*/
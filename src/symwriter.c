@@ -0,0 +1,250 @@
+#include <string.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "symwriter.h"
+#include "utils.h"
+
+/* Packed blocks buffered before being handed to stdio or the compressor */
+#define PACK_OUTBUF (64 * PACK_BLOCK)
+#define ZSTD_LEVEL 3
+
+typedef int8_t  vpack_s8 __attribute__((vector_size(PACK_BLOCK)));
+typedef uint8_t vpack_u8 __attribute__((vector_size(PACK_BLOCK)));
+
+/* Shuffle masks. EVEN picks every other symbol, LANE(k) picks the k-th symbol
+ * of each group of 8, and TRI interleaves three vectors of per-group bytes */
+#define EVEN8(n) n, n+2, n+4, n+6, n+8, n+10, n+12, n+14
+#define EVEN EVEN8(0), EVEN8(16), EVEN8(32), EVEN8(48)
+#define LANE(k) k, 8+k, 16+k, 24+k, 32+k, 40+k, 48+k, 56+k
+#define LANE8(k) { LANE(k), LANE(k), LANE(k), LANE(k), LANE(k), LANE(k), LANE(k), LANE(k) }
+#define TRI_A(g) g, PACK_BLOCK+g, 0
+#define TRI_B(g) 3*g, 3*g+1, PACK_BLOCK+g
+
+static const vpack_u8 even_mask = { EVEN, EVEN };
+static const vpack_u8 lane_mask[8] = { LANE8(0), LANE8(1), LANE8(2), LANE8(3), LANE8(4), LANE8(5), LANE8(6), LANE8(7) };
+static const vpack_u8 tri_a_mask = { TRI_A(0), TRI_A(1), TRI_A(2), TRI_A(3), TRI_A(4), TRI_A(5), TRI_A(6), TRI_A(7) };
+static const vpack_u8 tri_b_mask = { TRI_B(0), TRI_B(1), TRI_B(2), TRI_B(3), TRI_B(4), TRI_B(5), TRI_B(6), TRI_B(7) };
+
+static void symwriter_pack_pending(SymWriter *self);
+static void symwriter_emit(SymWriter *self, int end);
+
+/* Initialize a writer packing the symbols as $fmt into $fd. With $compress,
+ * the output is a zstd-compressed container starting with a SymHeader */
+SymWriter*
+symwriter_init(FILE *fd, SymFormat fmt, int compress, unsigned sym_rate, uint64_t sample_offset)
+{
+	SymWriter *ret;
+	SymHeader hdr;
+
+#ifndef HAVE_ZSTD
+	if (compress) {
+		fatal("Compiled without zstd support");
+		/* Not reached */
+		return NULL;
+	}
+#endif
+
+	ret = safealloc(sizeof(*ret));
+	ret->fd = fd;
+	ret->fmt = fmt;
+	ret->compress = compress;
+	ret->npending = 0;
+	ret->npacked = 0;
+	ret->packed = safealloc(PACK_OUTBUF);
+	ret->zstd = NULL;
+	ret->zbuf = NULL;
+
+	if (compress) {
+		memset(&hdr, 0, sizeof(hdr));
+		memcpy(hdr.magic, SYMFILE_MAGIC, sizeof(hdr.magic));
+		hdr.sym_rate = sym_rate;
+		hdr.sample_offset = sample_offset;
+		hdr.version = SYMFILE_VERSION;
+		hdr.format = fmt;
+		hdr.compression = 1;
+		fwrite(&hdr, sizeof(hdr), 1, fd);
+
+#ifdef HAVE_ZSTD
+		ret->zstd = ZSTD_createCCtx();
+		if (!ret->zstd) {
+			fatal("Could not initialize the zstd compressor");
+		}
+		ZSTD_CCtx_setParameter(ret->zstd, ZSTD_c_compressionLevel, ZSTD_LEVEL);
+		ret->zbuf_size = ZSTD_CStreamOutSize();
+		ret->zbuf = safealloc(ret->zbuf_size);
+#endif
+	}
+
+	return ret;
+}
+
+/* DemodSink: consume $len bytes of soft symbols */
+void
+symwriter_sink(const int8_t *syms, size_t len, void *ctx)
+{
+	SymWriter *self;
+	size_t n;
+
+	self = (SymWriter*)ctx;
+	while (len > 0) {
+		/* Whole blocks go straight from the input to the kernel */
+		if (!self->npending && len >= PACK_BLOCK) {
+			if (self->npacked + PACK_BLOCK > PACK_OUTBUF) {
+				symwriter_emit(self, 0);
+			}
+			self->npacked += symwriter_pack(self->fmt, syms, self->packed + self->npacked);
+			syms += PACK_BLOCK;
+			len -= PACK_BLOCK;
+			continue;
+		}
+
+		n = PACK_BLOCK - self->npending;
+		if (n > len) {
+			n = len;
+		}
+		memcpy(self->pending + self->npending, syms, n);
+		self->npending += n;
+		syms += n;
+		len -= n;
+
+		if (self->npending == PACK_BLOCK) {
+			symwriter_pack_pending(self);
+		}
+	}
+}
+
+/* Write out the last, partial block and end the compressed frame. The file
+ * itself is left open */
+void
+symwriter_close(SymWriter *self)
+{
+	if (self->npending) {
+		symwriter_pack_pending(self);
+	}
+	symwriter_emit(self, 1);
+
+#ifdef HAVE_ZSTD
+	ZSTD_freeCCtx(self->zstd);
+#endif
+	free(self->zbuf);
+	free(self->packed);
+	free(self);
+}
+
+/* Parse an output format name. Returns 0 on success */
+int
+symwriter_parse_format(const char *name, SymFormat *fmt)
+{
+	if (!strcmp(name, "s8")) {
+		*fmt = SYMFMT_S8;
+	} else if (!strcmp(name, "s4")) {
+		*fmt = SYMFMT_S4;
+	} else if (!strcmp(name, "s3")) {
+		*fmt = SYMFMT_S3;
+	} else if (!strcmp(name, "hard")) {
+		*fmt = SYMFMT_HARD;
+	} else {
+		return -1;
+	}
+	return 0;
+}
+
+/* Quantize and pack PACK_BLOCK symbols from $in into $out. The top bits of
+ * each symbol are kept, so the sign always survives. Returns the number of
+ * bytes written */
+size_t
+symwriter_pack(SymFormat fmt, const int8_t *in, uint8_t *out)
+{
+	vpack_s8 v;
+	vpack_u8 u, q, b0, b1, b2, packed;
+	int k;
+
+	memcpy(&v, in, sizeof(v));
+	u = (vpack_u8)v;
+
+	switch (fmt) {
+	case SYMFMT_S4:
+		packed = (__builtin_shuffle(u, even_mask) & 0xF0) | (__builtin_shuffle(u, even_mask + 1) >> 4);
+		memcpy(out, &packed, PACK_BLOCK/2);
+		return PACK_BLOCK/2;
+	case SYMFMT_S3:
+		/* 8 symbols of 3 bits each make up 3 bytes: split the bits of each
+		 * lane across the three output bytes, then interleave them */
+		q = u >> 5;
+		b0 = __builtin_shuffle(q, lane_mask[0]) << 5 | __builtin_shuffle(q, lane_mask[1]) << 2 |
+		     __builtin_shuffle(q, lane_mask[2]) >> 1;
+		b1 = __builtin_shuffle(q, lane_mask[2]) << 7 | __builtin_shuffle(q, lane_mask[3]) << 4 |
+		     __builtin_shuffle(q, lane_mask[4]) << 1 | __builtin_shuffle(q, lane_mask[5]) >> 2;
+		b2 = __builtin_shuffle(q, lane_mask[5]) << 6 | __builtin_shuffle(q, lane_mask[6]) << 3 |
+		     __builtin_shuffle(q, lane_mask[7]);
+		packed = __builtin_shuffle(__builtin_shuffle(b0, b1, tri_a_mask), b2, tri_b_mask);
+		memcpy(out, &packed, PACK_BLOCK*3/8);
+		return PACK_BLOCK*3/8;
+	case SYMFMT_HARD:
+		q = ~u >> 7;
+		packed = __builtin_shuffle(q, lane_mask[0]) << 7;
+		for (k=1; k<8; k++) {
+			packed |= __builtin_shuffle(q, lane_mask[k]) << (7-k);
+		}
+		memcpy(out, &packed, PACK_BLOCK/8);
+		return PACK_BLOCK/8;
+	default:
+		memcpy(out, in, PACK_BLOCK);
+		return PACK_BLOCK;
+	}
+}
+
+/* Static functions {{{ */
+/* Pack the pending symbols, padding the block with zeroes. The padding is cut
+ * off the output, rounding up to the next byte */
+void
+symwriter_pack_pending(SymWriter *self)
+{
+	static const unsigned bits[] = { 8, 4, 3, 1 };
+	size_t count;
+
+	if (self->npacked + PACK_BLOCK > PACK_OUTBUF) {
+		symwriter_emit(self, 0);
+	}
+
+	count = self->npending;
+	memset(self->pending + count, 0, PACK_BLOCK - count);
+	symwriter_pack(self->fmt, self->pending, self->packed + self->npacked);
+	self->npacked += (count * bits[self->fmt] + 7) / 8;
+	self->npending = 0;
+}
+
+/* Write the packed bytes to the file, through the compressor if enabled */
+void
+symwriter_emit(SymWriter *self, int end)
+{
+#ifdef HAVE_ZSTD
+	ZSTD_inBuffer in;
+	ZSTD_outBuffer out;
+	size_t remaining;
+
+	if (self->compress) {
+		in.src = self->packed;
+		in.size = self->npacked;
+		in.pos = 0;
+		do {
+			out.dst = self->zbuf;
+			out.size = self->zbuf_size;
+			out.pos = 0;
+			remaining = ZSTD_compressStream2(self->zstd, &out, &in, end ? ZSTD_e_end : ZSTD_e_continue);
+			if (ZSTD_isError(remaining)) {
+				fatal(ZSTD_getErrorName(remaining));
+			}
+			fwrite(self->zbuf, out.pos, 1, self->fd);
+		} while (end ? remaining != 0 : in.pos < in.size);
+		self->npacked = 0;
+		return;
+	}
+#else
+	(void)end;
+#endif
+	fwrite(self->packed, self->npacked, 1, self->fd);
+	self->npacked = 0;
+}
+/*}}}*/
@@ -0,0 +1,71 @@
+#include <string.h>
+#include "triplebuf.h"
+#include "utils.h"
+
+#define TB_DIRTY 0x4
+#define TB_INDEX 0x3
+
+/* Initialize a triple buffer made of three zeroed blocks of $size bytes */
+TripleBuf*
+triplebuf_init(size_t size)
+{
+	TripleBuf *tb;
+	int i;
+
+	tb = safealloc(sizeof(*tb));
+	for (i=0; i<3; i++) {
+		tb->buf[i] = safealloc(size);
+		memset(tb->buf[i], 0, size);
+	}
+
+	tb->size = size;
+	tb->back = 0;
+	tb->middle = 1;
+	tb->front = 2;
+
+	return tb;
+}
+
+/* Get the buffer the writer is allowed to fill */
+void*
+triplebuf_back(TripleBuf *self)
+{
+	return self->buf[self->back];
+}
+
+/* Swap the back buffer with the spare one, marking it as fresh */
+void
+triplebuf_publish(TripleBuf *self)
+{
+	unsigned prev;
+
+	prev = __atomic_exchange_n(&self->middle, self->back | TB_DIRTY, __ATOMIC_ACQ_REL);
+	self->back = prev & TB_INDEX;
+}
+
+/* Get the most recently published buffer. The returned pointer stays valid
+ * until the next call to triplebuf_read() */
+const void*
+triplebuf_read(TripleBuf *self)
+{
+	unsigned prev;
+
+	if (__atomic_load_n(&self->middle, __ATOMIC_RELAXED) & TB_DIRTY) {
+		prev = __atomic_exchange_n(&self->middle, self->front, __ATOMIC_ACQ_REL);
+		self->front = prev & TB_INDEX;
+	}
+
+	return self->buf[self->front];
+}
+
+/* Free a triple buffer */
+void
+triplebuf_free(TripleBuf *self)
+{
+	int i;
+
+	for (i=0; i<3; i++) {
+		free(self->buf[i]);
+	}
+	free(self);
+}
@@ -8,9 +8,6 @@
 #include "tui.h"
 #include "utils.h"
 
-/* Saved for when we want to wait indefinitely for user input */
-static unsigned _upd_interval;
-
 enum {
 	PAIR_DEF = 1,
 	PAIR_GREEN_DEF = 2,
@@ -31,7 +28,7 @@ struct {
 
 /* Initialize the ncurses tui */
 void
-tui_init(unsigned upd_interval)
+tui_init()
 {
 	int rows, cols;
 	setlocale(LC_ALL, "");
@@ -48,11 +45,10 @@ tui_init(unsigned upd_interval)
 	init_pair(PAIR_GREEN_DEF, COLOR_GREEN, -1);
 
 	getmaxyx(stdscr, rows, cols);
-	_upd_interval = upd_interval;
 
 	windows_init(rows, cols);
 	print_banner(tui.banner_top);
-	tui_update_pll(0, 0, 1);
+	tui_update_pll(0, 0, 1, 0);
 	iq_draw_quadrants(tui.iq);
 }
 
@@ -93,24 +89,24 @@ tui_handle_resize()
 	wrefresh(tui.iq);
 }
 
-/* Get user input, return 1 if an abort was requested, 0 otherwise. This also
- * doubles as a throttling for the refresh rate, since wgetch() blocks for
- * upd_interval milliseconds before returning if no key is pressed */
+/* Handle the pending keypresses without blocking, return 1 if an abort was
+ * requested, 0 otherwise */
 int
 tui_process_input()
 {
 	int ch;
-	ch = wgetch(tui.infowin);
 
-	switch(ch) {
-	case KEY_RESIZE:
-		tui_handle_resize();
-		break;
-	case 'q':
-		return 1;
-		break;
-	default:
-		break;
+	while ((ch = wgetch(tui.infowin)) != ERR) {
+		switch(ch) {
+		case KEY_RESIZE:
+			tui_handle_resize();
+			break;
+		case 'q':
+			return 1;
+			break;
+		default:
+			break;
+		}
 	}
 	wrefresh(tui.infowin);
 	return 0;
@@ -141,7 +137,7 @@ tui_print_info(const char *msg, ...)
 
 /* Update the PLL info displayed */
 void
-tui_update_pll(float freq, int islocked, float gain)
+tui_update_pll(float freq, int islocked, float gain, float snr)
 {
 	assert(tui.pll);
 
@@ -150,8 +146,8 @@ tui_update_pll(float freq, int islocked, float gain)
 	wattrset(tui.pll, A_BOLD);
 	wprintw(tui.pll, "PLL info\n");
 	wattroff(tui.pll, A_BOLD);
-	wprintw(tui.pll, "Gain\tCarrier Freq\tStatus\n");
-	wprintw(tui.pll, "%.3f\t%+7.1f Hz\t", gain, freq);
+	wprintw(tui.pll, "Gain\tCarrier Freq\tSNR\t\tStatus\n");
+	wprintw(tui.pll, "%.3f\t%+7.1f Hz\t%5.1f dB\t", gain, freq, snr);
 	if (islocked) {
 		wattrset(tui.pll, COLOR_PAIR(PAIR_GREEN_DEF));
 		wprintw(tui.pll, "%s", "Locked");
@@ -164,8 +160,8 @@ tui_update_pll(float freq, int islocked, float gain)
 }
 
 /* Draw an indicative constellation plot, not an accurate one, but still
- * indicative of the signal quality (*dots should be mutexed for this to be
- * accurate, since it comes directly from the decoding thread's memory domain) */
+ * indicative of the signal quality. *dots is a snapshot decimated by the
+ * decoding thread, so it's safe to read while decoding is in progress */
 void
 tui_draw_constellation(const int8_t *dots, unsigned count)
 {
@@ -255,8 +251,10 @@ tui_wait_for_user_input()
 	int ret;
 
 	wtimeout(tui.infowin, -1);
-	ret = wgetch(tui.infowin);
-	wtimeout(tui.infowin, _upd_interval);
+	while ((ret = wgetch(tui.infowin)) == KEY_RESIZE) {
+		tui_handle_resize();
+	}
+	wtimeout(tui.infowin, 0);
 
 	return ret;
 }
@@ -297,7 +295,7 @@ windows_init(int rows, int cols)
 	tui.infowin = newwin(MIN(rows - iq_size/2, 10), cols, 2+iq_size/2+2, 0);
 
 	scrollok(tui.infowin, TRUE);
-	wtimeout(tui.infowin, _upd_interval);
+	wtimeout(tui.infowin, 0);
 }
 
 /* Draw the lines demarking the quadrants in the IQ plot */
@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include <time.h>
 #include "utils.h"
@@ -79,19 +80,46 @@ usage(const char *pname)
 {
 	splash();
 	fprintf(stderr, "Usage: %s [options] file_in\n", pname);
+	fprintf(stderr, "       %s batch [options] <dir|file>...\n", pname);
+	fprintf(stderr, "       %s sweep [options] file_in\n", pname);
 	fprintf(stderr,
-	        "   -o, --output <file>     Output decoded symbols to <file>\n"
+	        "   -o, --output <file>     Output decoded symbols to <file> (output directory in batch mode)\n"
 	        "   -r, --symrate <rate>    Set the symbol rate to <rate> (default: 72000)\n"
 	        "   -s, --samplerate <samp> Force the input samplerate to <samp> (default: auto)\n"
-	        "   -R, --refresh-rate <ms> Refresh the status screen every <ms> ms (default: 50ms in TUI mode, 5000ms in batch mode)\n"
+	        "   -R, --refresh-rate <ms> Refresh the status screen at most every <ms> ms (default: 50ms in TUI mode, 5000ms in batch mode)\n"
 	        "   -B, --batch             Do not use ncurses, write the message log to stdout instead\n"
 	        "   -q, --quiet             Do not print status information\n"
+	        "   -t, --threads <n>       Split the processing across <n> threads, 1 to 3 (default: 1)\n"
+	        "   -d, --decode <file>     Decode the symbols, and write the CADUs that pass the RS check to <file>\n"
+	        "   -P, --canonical         Use the sync marker to rotate the output to a fixed phase (negative = 1)\n"
+	        "   -e, --encoding <fmt>    Write the symbols as <fmt>: s8, s4, s3 or hard (default: s8)\n"
+	        "   -z, --zstd              Compress the symbols, in a container with a small header\n"
+	        "   -m, --shm <name>        Write the symbols to the shared memory ring buffer <name>\n"
+	        "   -Q, --quality <file>    Write the SNR, EVM and lock state measured every second to <file>, as CSV\n"
+	        "   -M, --metrics <addr>    Serve Prometheus metrics on <addr>: <port>, <ip>:<port> or unix:<path>\n"
+	        "   -T, --profile           Time each processing step, and print a summary at the end\n"
+	        "   -u, --status-fd <fd>    Write status events to file descriptor <fd>, as JSON lines\n"
+	        "   -U, --status-interval <ms> Write a stats event every <ms> ms (default: 1000)\n"
+	        "   -J, --json              Write the status events to stdout, and the log to stderr\n"
 	        "\n"
 	        "Advanced options:\n"
 	        "   -b, --pll-bw <bw>       Set the PLL bandwidth to <bw> (default: 100)\n"
 	        "   -a, --alpha <alpha>     Set the RRC filter alpha to <alpha> (default: 0.6)\n"
 	        "   -f, --fir-order <ord>   Set the RRC filter order to <ord> (default: 64)\n"
 	        "   -O, --oversamp <mult>   Set the interpolation factor to <mult> (default: 4)\n"
+	        "   -p, --fir-threads <n>   Split the RRC filtering across <n> threads (default: 1)\n"
+	        "   -g, --max-lag <secs>    Switch to cheaper settings when more than <secs> behind a live input\n"
+	        "   -A, --autotune          Benchmark this machine, and save the fastest settings for the next runs\n"
+	        "   -x, --margin <x>        Use the best filter running <x> times faster than real time (needs -A first)\n"
+	        "\n"
+	        "Offline options:\n"
+	        "   -S, --segments <n>      Split the input into <n> segments, demodulated in parallel (0: one per core)\n"
+	        "   -l, --overlap <secs>    Overlap between consecutive segments (default: 5)\n"
+	        "   -F, --backfill <secs>   Demodulate the first <secs> seconds again once locked (default: 0, off)\n"
+	        "   -j, --jobs <n>          In batch mode, process <n> files at a time (default: one per core)\n"
+	        "   -L, --lanes             In sweep mode, run 8 combinations per thread with SIMD across streams\n"
+	        "   -c, --checkpoint <file> Save the demodulator state to <file>, and resume from it if it exists\n"
+	        "   -C, --checkpoint-interval <secs> Save a checkpoint every <secs> seconds (default: 10)\n"
 	        "\n"
 	        "   -h, --help              Print this help screen\n"
 	        "   -v, --version           Print version info\n"
@@ -112,6 +140,38 @@ seconds_to_str(unsigned secs, char *buf)
 	sprintf(buf, "%02u:%02u:%02u", h, m, s);
 }
 
+/* Monotonic timestamp in nanoseconds */
+uint64_t
+get_time_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+/* Model name of the first CPU, "unknown" if it can't be found */
+void
+get_cpu_model(char *buf, size_t len)
+{
+	FILE *fd;
+	char line[256], *val;
+
+	snprintf(buf, len, "unknown");
+	if (!(fd = fopen("/proc/cpuinfo", "r"))) {
+		return;
+	}
+	while (fgets(line, sizeof(line), fd)) {
+		if (!strncmp(line, "model name", 10) && (val = strchr(line, ':'))) {
+			val += 2;
+			val[strcspn(val, "\n")] = '\0';
+			snprintf(buf, len, "%s", val);
+			break;
+		}
+	}
+	fclose(fd);
+}
+
 /* Generate a semi-unique filename */
 char*
 gen_fname()
@@ -0,0 +1,139 @@
+#include <stdlib.h>
+#include <string.h>
+#include "utils.h"
+#include "viterbi.h"
+
+static int parity(unsigned x);
+
+/* Initialize a decoder that can handle blocks of up to $max_len symbols */
+Viterbi*
+viterbi_init(size_t max_len)
+{
+	Viterbi *ret;
+
+	ret = safealloc(sizeof(*ret));
+	ret->max_len = max_len;
+
+	/* The decisions are stored with vector loads/stores, which need the
+	 * natural alignment of the vector type */
+	if (posix_memalign((void**)&ret->decisions, sizeof(v32s), sizeof(*ret->decisions) * max_len)) {
+		fatal("Failed to allocate memory");
+	}
+
+	return ret;
+}
+
+/* Decode $len symbols (2*$len soft bits, negative meaning 1), and write the
+ * first $out_bits decoded bits to $out, MSB first. The encoder state at the
+ * beginning of the block is unknown, so all states start out equally likely;
+ * the symbols after the first $out_bits are only used to settle the
+ * traceback */
+void
+viterbi_decode(Viterbi *self, const int8_t *soft, size_t len, uint8_t *out, size_t out_bits)
+{
+	/* Interleave two vectors of new metrics into states 0-31 and 32-63 */
+	static const v32s lo_mask = {
+		0, 32, 1, 33, 2, 34, 3, 35, 4, 36, 5, 37, 6, 38, 7, 39,
+		8, 40, 9, 41, 10, 42, 11, 43, 12, 44, 13, 45, 14, 46, 15, 47
+	};
+	static const v32s hi_mask = {
+		16, 48, 17, 49, 18, 50, 19, 51, 20, 52, 21, 53, 22, 54, 23, 55,
+		24, 56, 25, 57, 26, 58, 27, 59, 28, 60, 29, 61, 30, 62, 31, 63
+	};
+	v32s coeff_a, coeff_b;
+	v32s lo, hi, bm, m0, m1, m2, m3, even, odd, dec_even, dec_odd;
+	unsigned reg, state, j, best;
+	size_t t;
+	int16_t best_metric;
+
+	if (len > self->max_len) {
+		len = self->max_len;
+	}
+	if (out_bits > len) {
+		out_bits = len;
+	}
+
+	/* Expected encoder output for a 0 bit going into each state 0-31. Going
+	 * into state j+32, or shifting in a 1, flips both output bits, since both
+	 * polynomials tap the oldest and the newest bit */
+	for (j=0; j<VITERBI_STATES/2; j++) {
+		reg = j << 1;
+		coeff_a[j] = parity(reg & VITERBI_POLY_A) ? -1 : 1;
+		coeff_b[j] = parity(reg & VITERBI_POLY_B) ? -1 : 1;
+	}
+
+	lo = (v32s){0};
+	hi = (v32s){0};
+	for (t=0; t<len; t++) {
+		bm = coeff_a * (int16_t)soft[2*t] + coeff_b * (int16_t)soft[2*t+1];
+
+		/* Butterflies: states j and j+32 both lead to 2j and 2j+1 */
+		m0 = lo + bm;
+		m1 = hi - bm;
+		m2 = lo - bm;
+		m3 = hi + bm;
+		dec_even = m1 > m0;
+		dec_odd = m3 > m2;
+		even = (m0 & ~dec_even) | (m1 & dec_even);
+		odd = (m2 & ~dec_odd) | (m3 & dec_odd);
+
+		self->decisions[t][0] = dec_even;
+		self->decisions[t][1] = dec_odd;
+
+		lo = __builtin_shuffle(even, odd, lo_mask);
+		hi = __builtin_shuffle(even, odd, hi_mask);
+
+		/* Keep the metrics from drifting out of range */
+		best_metric = lo[0];
+		lo -= best_metric;
+		hi -= best_metric;
+	}
+
+	/* Trace back from the most likely final state */
+	best = 0;
+	best_metric = lo[0];
+	for (j=0; j<VITERBI_STATES/2; j++) {
+		if (lo[j] > best_metric) {
+			best_metric = lo[j];
+			best = j;
+		}
+		if (hi[j] > best_metric) {
+			best_metric = hi[j];
+			best = j + VITERBI_STATES/2;
+		}
+	}
+
+	memset(out, 0, (out_bits+7)/8);
+	state = best;
+	for (t=len; t-- > 0; ) {
+		if (t < out_bits && (state & 1)) {
+			out[t/8] |= 0x80 >> (t%8);
+		}
+		j = state >> 1;
+		state = j | (self->decisions[t][state & 1][j] ? VITERBI_STATES/2 : 0);
+	}
+}
+
+void
+viterbi_free(Viterbi *self)
+{
+	free(self->decisions);
+	free(self);
+}
+
+/* Shift $bit into the encoder register, and return the two output bits
+ * (A in the MSB, B in the LSB) */
+int
+conv_encode(unsigned *reg, int bit)
+{
+	*reg = ((*reg << 1) | (bit & 1)) & ((1 << VITERBI_K) - 1);
+	return parity(*reg & VITERBI_POLY_A) << 1 | parity(*reg & VITERBI_POLY_B);
+}
+
+/* Static functions {{{ */
+int
+parity(unsigned x)
+{
+	return __builtin_parity(x);
+}
+/*}}}*/
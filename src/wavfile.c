@@ -1,8 +1,8 @@
-#include <assert.h>
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "probes.h"
 #include "utils.h"
 #include "wavfile.h"
 
@@ -17,61 +17,104 @@ static int      wav_read(Source *samp, size_t count);
 static int      wav_close(Source *samp);
 static uint64_t wav_get_size(const Source *samp);
 static uint64_t wav_get_done(const Source *samp);
+static int      wav_seek(Source *samp, uint64_t pos);
 
 extern int errno;
 
+/* Open a .wav file, or a raw 16 bit recording if $samplerate is given. Exits
+ * on failure */
 Source*
 open_samples_file(const char *fname, unsigned samplerate)
+{
+	Source *samp;
+	const char *err;
+
+	if (!(samp = try_open_samples_file(fname, samplerate, &err))) {
+		fatal(err);
+		/* Not reached */
+		return NULL;
+	}
+
+	return samp;
+}
+
+/* Same as open_samples_file(), but returns NULL on failure, with the reason in
+ * $err, so that callers processing many files can skip the bad ones */
+Source*
+try_open_samples_file(const char *fname, unsigned samplerate, const char **err)
 {
 	Source *samp;
 	WavState *state;
 	struct wave_header _header;
 	FILE *fd;
+	off_t fsize;
 
 	errno = 0;
-	if ((fd = fopen(fname, "r"))) {
-		samp = safealloc(sizeof(*samp));
-		samp->_backend = safealloc(sizeof(WavState));
-		state = (WavState*)samp->_backend;
-		state->fd = fd;
-
-		assert(fread(&_header, sizeof(struct wave_header), 1, state->fd));
-
-		samp->count = 0;
-		samp->data = NULL;
-		samp->read = wav_read;
-		samp->close = wav_close;
-		samp->size = wav_get_size;
-		samp->done = wav_get_done;
-
-		/* If any of these comparisons return non-zero, the file is
-		 * not a valid WAVE file: assume raw data */
-		if (!strncmp(_header._riff, "RIFF", 4) &&
-			!strncmp(_header._filetype, "WAVE", 4) &&
-			!strncmp(_header._data, "data", 4)) {
-			samp->samplerate = (samplerate ? samplerate : _header.sample_rate);
-			samp->bps = _header.bits_per_sample/8;
-
-			state->total_samples = _header.subchunk2_size / _header.num_channels / samp->bps;
-		} else {
-			fprintf(stderr, "Warning: input file is not a valid .wav, assuming raw 16 bit data\n");
-			if (!samplerate) {
-				fatal("Please specify an input samplerate (-s <samplerate>)");
-				/* Not reached */
-				return NULL;
-			}
+	if (!(fd = fopen(fname, "r"))) {
+		*err = "Could not find specified file";
+		return NULL;
+	}
+	if (fread(&_header, sizeof(struct wave_header), 1, fd) != 1) {
+		*err = "Input file is too short";
+		fclose(fd);
+		return NULL;
+	}
 
-			samp->samplerate = samplerate;
-			samp->bps = 2;
-			state->total_samples = 0;
+	samp = safealloc(sizeof(*samp));
+	samp->_backend = safealloc(sizeof(WavState));
+	state = (WavState*)samp->_backend;
+	state->fd = fd;
+
+	samp->count = 0;
+	samp->data = NULL;
+	samp->read = wav_read;
+	samp->close = wav_close;
+	samp->size = wav_get_size;
+	samp->done = wav_get_done;
+	samp->seek = wav_seek;
+
+	/* If any of these comparisons return non-zero, the file is
+	 * not a valid WAVE file: assume raw data */
+	if (!strncmp(_header._riff, "RIFF", 4) &&
+		!strncmp(_header._filetype, "WAVE", 4) &&
+		!strncmp(_header._data, "data", 4)) {
+		samp->samplerate = (samplerate ? samplerate : _header.sample_rate);
+		samp->bps = _header.bits_per_sample/8;
+
+		if (!_header.num_channels || !samp->bps || samp->bps > 2 || !samp->samplerate) {
+			*err = "Unsupported .wav format";
+			free(samp->_backend);
+			free(samp);
+			fclose(fd);
+			return NULL;
 		}
-		state->samples_read = 0;
-		state->tmp = safealloc(2*sizeof(*state->tmp));
+
+		state->total_samples = _header.subchunk2_size / _header.num_channels / samp->bps;
 	} else {
-		fatal("Could not find specified file");
-		/* Not reached */
-		return NULL;
-    }
+		if (!samplerate) {
+			*err = "Please specify an input samplerate (-s <samplerate>)";
+			free(samp->_backend);
+			free(samp);
+			fclose(fd);
+			return NULL;
+		}
+		fprintf(stderr, "Warning: input file is not a valid .wav, assuming raw 16 bit data\n");
+
+		samp->samplerate = samplerate;
+		samp->bps = 2;
+
+		/* Infer the number of samples from the file size, if possible */
+		state->total_samples = 0;
+		if (!fseeko(fd, 0, SEEK_END)) {
+			fsize = ftello(fd);
+			if (fsize > (off_t)sizeof(struct wave_header)) {
+				state->total_samples = (fsize - sizeof(struct wave_header)) / 2 / samp->bps;
+			}
+			fseeko(fd, sizeof(struct wave_header), SEEK_SET);
+		}
+	}
+	state->samples_read = 0;
+	state->tmp = safealloc(2*sizeof(*state->tmp));
 
 	return samp;
 }
@@ -102,6 +145,7 @@ wav_read(Source *self, size_t count)
 	unsigned i;
 
 	state = (WavState*)self->_backend;
+	PROBE1(read_start, count);
 
 	if (!self->data) {
 		self->data = safealloc(count * sizeof(*self->data));
@@ -123,10 +167,26 @@ wav_read(Source *self, size_t count)
 
 	/* Update the byte count */
 	state->samples_read += i;
+	PROBE2(read_done, i, state->samples_read);
 
 	return i;
 }
 
+/* Move to the $pos-th sample in the file */
+int
+wav_seek(Source *self, uint64_t pos)
+{
+	WavState *state;
+
+	state = (WavState*)self->_backend;
+	if (fseeko(state->fd, sizeof(struct wave_header) + pos * self->bps * 2, SEEK_SET)) {
+		return -1;
+	}
+	state->samples_read = pos;
+
+	return 0;
+}
+
 /* Close the .wav file descriptor and free the memory associated with this
  * Source object */
 int
@@ -0,0 +1,55 @@
+#!/bin/sh
+# End-to-end benchmark: demodulate a corpus of synthetic passes and report the
+# throughput, how long the PLL took to lock and the symbol error rate against
+# the transmitted symbols. The corpus is generated once, and kept in
+# $BENCH_DIR for the next runs.
+#
+# BENCH_DIR   where to keep the corpus (default: bench)
+# BENCH_SECS  duration of each pass (default: 30)
+# BENCH_ARGS  extra arguments for meteor_demod, e.g. "-t 2"
+
+DEMOD=${DEMOD:-../src/meteor_demod}
+BENCH_DIR=${BENCH_DIR:-bench}
+BENCH_SECS=${BENCH_SECS:-30}
+
+# name samplerate Es/N0 carrier_offset doppler_rate clock_error_ppm
+CORPUS="
+clean    140000 20    0    0   0
+nominal  140000 10 1200  -40   0
+weak     140000  6 1200  -40   0
+doppler  140000 10 3000 -120   0
+clock    140000 10  500    0 100
+hirate   288000 10 1200  -40   0
+"
+
+set -e
+mkdir -p "$BENCH_DIR"
+
+printf "%-8s %7s %5s %9s %7s %8s %10s %5s\n" case rate snr Msamp/s xRT lock SER slips
+echo "$CORPUS" | while read name rate snr freq ramp ppm; do
+	[ -z "$name" ] && continue
+	wav="$BENCH_DIR/$name-$BENCH_SECS.wav"
+	ref="$BENCH_DIR/$name-$BENCH_SECS.ref.s"
+	out="$BENCH_DIR/$name.s"
+
+	if [ ! -f "$wav" ] || [ ! -f "$ref" ]; then
+		./md_lrptgen -d "$BENCH_SECS" -s "$rate" -n "$snr" -f "$freq" -D "$ramp" -t "$ppm" \
+		             -S 1 -o "$wav" -p "$ref"
+	fi
+
+	start=$(date +%s.%N)
+	$DEMOD -B -q -R 10 $BENCH_ARGS -o "$out" "$wav"
+	end=$(date +%s.%N)
+
+	ser=$(./md_ser "$out" "$ref" || true)
+	lock=$(echo "$ser" | sed -n 's/.*lock=\([^ ]*\).*/\1/p')
+	rate_err=$(echo "$ser" | sed -n 's/.*ser=\([^ ]*\).*/\1/p')
+	slips=$(echo "$ser" | sed -n 's/.*slips=\([^ ]*\).*/\1/p')
+
+	awk -v name="$name" -v rate="$rate" -v snr="$snr" -v secs="$BENCH_SECS" \
+	    -v start="$start" -v end="$end" -v lock="$lock" -v ser="$rate_err" -v slips="$slips" \
+	    'BEGIN { t = end - start; if (t <= 0) t = 1e-9;
+	             printf "%-8s %7d %5s %9.2f %7.1f %8s %10s %5s\n",
+	                    name, rate, snr, rate*secs/t/1e6, secs/t, lock, ser, slips }'
+	rm -f "$out"
+done
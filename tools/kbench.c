@@ -0,0 +1,521 @@
+/**
+ * Per-kernel microbenchmark: times each hot function of the demodulator in
+ * isolation, over a grid of filter orders, oversampling factors and chunk
+ * sizes. Every case is warmed up, then timed over a number of repetitions,
+ * and the distribution of the per-repetition times is reported as CSV or JSON,
+ * tagged with a label (the hostname by default), the CPU model and the
+ * compiler, so that results from different builds and machines can be
+ * compared.
+ */
+#include <complex.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "agc.h"
+#include "filters.h"
+#include "interpolator.h"
+#include "memsrc.h"
+#include "pipe.h"
+#include "pll.h"
+#include "utils.h"
+#include "wavfile.h"
+
+#define SAMPLERATE 140000
+#define SYM_RATE 72000
+#define PLL_BW 100
+#define MAX_CHUNK 65536
+#define WAV_SAMPLES (4*MAX_CHUNK)
+
+enum { FMT_CSV, FMT_JSON };
+
+typedef struct {
+	unsigned order, factor, chunk;
+} Case;
+
+typedef struct {
+	const char *name;
+	void* (*setup)(const Case *c);
+	void  (*run)(void *ctx, const Case *c);
+	void  (*teardown)(void *ctx);
+	const unsigned *orders;         /* Zero-terminated, NULL if not a parameter */
+	const unsigned *factors;
+	const unsigned *chunks;
+} Kernel;
+
+typedef struct {
+	Filter *flt;
+	Source *src, *interp;
+	Agc *agc;
+	Costas *cst;
+	float complex *in, *out;
+	char fname[32];
+} Ctx;
+
+static void* setup_filter(const Case *c);
+static void* setup_interp(const Case *c);
+static void* setup_agc(const Case *c);
+static void* setup_costas(const Case *c);
+static void* setup_plain(const Case *c);
+static void* setup_wav(const Case *c);
+static void  run_filter_fwd(void *ctx, const Case *c);
+static void  run_filter_fwd_block(void *ctx, const Case *c);
+static void  run_interp_read(void *ctx, const Case *c);
+static void  run_agc_apply(void *ctx, const Case *c);
+static void  run_costas_resync(void *ctx, const Case *c);
+static void  run_clamp(void *ctx, const Case *c);
+static void  run_wav_read(void *ctx, const Case *c);
+static void  teardown(void *ctx);
+
+static void  bench_case(const Kernel *k, const Case *c, unsigned warmup, unsigned reps, uint64_t *times);
+static int   cmp_u64(const void *a, const void *b);
+static void  print_json_str(FILE *fd, const char *str);
+static void  print_usage(const char *pname);
+
+static const unsigned orders[] = {16, 32, 64, 128, 256, 0};
+static const unsigned factors[] = {2, 4, 8, 0};
+static const unsigned filter_chunks[] = {4096, 0};
+static const unsigned block_chunks[] = {1024, 16384, 0};
+static const unsigned chunks[] = {256, 4096, 65536, 0};
+
+static const Kernel kernels[] = {
+	{ "filter_fwd",       setup_filter, run_filter_fwd,       teardown, orders, NULL,    filter_chunks },
+	{ "filter_fwd_block", setup_filter, run_filter_fwd_block, teardown, orders, NULL,    block_chunks },
+	{ "interp_read",      setup_interp, run_interp_read,      teardown, orders, factors, block_chunks },
+	{ "agc_apply",        setup_agc,    run_agc_apply,        teardown, NULL,   NULL,    chunks },
+	{ "costas_resync",    setup_costas, run_costas_resync,    teardown, NULL,   NULL,    chunks },
+	{ "clamp",            setup_plain,  run_clamp,            teardown, NULL,   NULL,    chunks },
+	{ "wav_read",         setup_wav,    run_wav_read,         teardown, NULL,   NULL,    chunks },
+};
+
+static const unsigned none[] = {0, 0};     /* One 0 entry */
+static volatile float sink;
+
+int
+main(int argc, char *argv[])
+{
+	const Kernel *k;
+	const unsigned *o, *f, *n;
+	Case c;
+	FILE *out;
+	uint64_t *times;
+	unsigned warmup, reps, i;
+	double mean, p50;
+	int c_opt, fmt, first, cpu;
+	char label[64], cpu_model[128];
+	const char *filter;
+
+	fmt = FMT_CSV;
+	out = stdout;
+	warmup = 10;
+	reps = 100;
+	filter = NULL;
+	cpu = -1;
+	if (gethostname(label, sizeof(label))) {
+		strcpy(label, "unknown");
+	}
+	label[sizeof(label)-1] = '\0';
+
+	while ((c_opt = getopt(argc, argv, "c:f:hk:l:o:r:w:")) != -1) {
+		switch (c_opt) {
+		case 'c':
+			cpu = atoi(optarg);
+			break;
+		case 'f':
+			if (!strcmp(optarg, "csv")) {
+				fmt = FMT_CSV;
+			} else if (!strcmp(optarg, "json")) {
+				fmt = FMT_JSON;
+			} else {
+				print_usage(argv[0]);
+			}
+			break;
+		case 'k':
+			filter = optarg;
+			break;
+		case 'l':
+			snprintf(label, sizeof(label), "%s", optarg);
+			break;
+		case 'o':
+			if (!(out = fopen(optarg, "w"))) {
+				fatal("Could not open file for writing");
+			}
+			break;
+		case 'r':
+			reps = atoi(optarg);
+			break;
+		case 'w':
+			warmup = atoi(optarg);
+			break;
+		default:
+			print_usage(argv[0]);
+		}
+	}
+	if (!reps) {
+		print_usage(argv[0]);
+	}
+	if (cpu >= 0 && pin_thread(pthread_self(), cpu)) {
+		fatal("Could not pin to the requested CPU");
+	}
+
+	get_cpu_model(cpu_model, sizeof(cpu_model));
+	times = safealloc(sizeof(*times) * reps);
+
+	if (fmt == FMT_CSV) {
+		fprintf(out, "label,kernel,order,factor,chunk,reps,min_ns,p50_ns,p90_ns,p99_ns,max_ns,mean_ns,ns_per_item,mitems_per_s\n");
+	} else {
+		fprintf(out, "{\n  \"label\": ");
+		print_json_str(out, label);
+		fprintf(out, ",\n  \"version\": ");
+		print_json_str(out, VERSION);
+		fprintf(out, ",\n  \"compiler\": ");
+		print_json_str(out, __VERSION__);
+		fprintf(out, ",\n  \"cpu\": ");
+		print_json_str(out, cpu_model);
+		fprintf(out, ",\n  \"warmup\": %u,\n  \"results\": [", warmup);
+	}
+
+	first = 1;
+	for (k = kernels; k < kernels + sizeof(kernels)/sizeof(kernels[0]); k++) {
+		if (filter && !strstr(k->name, filter)) {
+			continue;
+		}
+		/* Parameters that don't apply to a kernel are reported as 0 */
+		o = k->orders ? k->orders : none;
+		do {
+			f = k->factors ? k->factors : none;
+			do {
+				for (n = k->chunks; *n; n++) {
+					c.order = *o;
+					c.factor = *f;
+					c.chunk = *n;
+					bench_case(k, &c, warmup, reps, times);
+
+					mean = 0;
+					for (i=0; i<reps; i++) {
+						mean += times[i];
+					}
+					mean /= reps;
+					p50 = times[reps/2];
+
+					if (fmt == FMT_CSV) {
+						fprintf(out, "%s,%s,%u,%u,%u,%u,%lu,%lu,%lu,%lu,%lu,%.0f,%.3f,%.3f\n",
+						        label, k->name, c.order, c.factor, c.chunk, reps,
+						        (unsigned long)times[0], (unsigned long)times[reps/2],
+						        (unsigned long)times[reps*90/100], (unsigned long)times[reps*99/100],
+						        (unsigned long)times[reps-1], mean, p50/c.chunk, c.chunk/p50*1e3);
+					} else {
+						fprintf(out, "%s\n    {\"kernel\": \"%s\", \"order\": %u, \"factor\": %u, \"chunk\": %u, \"reps\": %u, "
+						        "\"min_ns\": %lu, \"p50_ns\": %lu, \"p90_ns\": %lu, \"p99_ns\": %lu, \"max_ns\": %lu, "
+						        "\"mean_ns\": %.0f, \"ns_per_item\": %.3f, \"mitems_per_s\": %.3f}",
+						        first ? "" : ",", k->name, c.order, c.factor, c.chunk, reps,
+						        (unsigned long)times[0], (unsigned long)times[reps/2],
+						        (unsigned long)times[reps*90/100], (unsigned long)times[reps*99/100],
+						        (unsigned long)times[reps-1], mean, p50/c.chunk, c.chunk/p50*1e3);
+					}
+					fflush(out);
+					first = 0;
+				}
+			} while (*++f);
+		} while (*++o);
+	}
+
+	if (fmt == FMT_JSON) {
+		fprintf(out, "\n  ]\n}\n");
+	}
+	if (out != stdout) {
+		fclose(out);
+	}
+	free(times);
+	return 0;
+}
+
+/* Static functions {{{ */
+/* Time $reps runs of a case after $warmup untimed ones. $times is returned
+ * sorted, in nanoseconds */
+void
+bench_case(const Kernel *k, const Case *c, unsigned warmup, unsigned reps, uint64_t *times)
+{
+	void *ctx;
+	uint64_t start;
+	unsigned i;
+
+	ctx = k->setup(c);
+	for (i=0; i<warmup; i++) {
+		k->run(ctx, c);
+	}
+	for (i=0; i<reps; i++) {
+		start = get_time_ns();
+		k->run(ctx, c);
+		times[i] = get_time_ns() - start;
+	}
+	k->teardown(ctx);
+
+	qsort(times, reps, sizeof(*times), cmp_u64);
+}
+
+/* Samples with the amplitude and spread of a typical 16-bit recording */
+void*
+setup_plain(const Case *c)
+{
+	Ctx *ctx;
+	unsigned i;
+
+	(void)c;
+	ctx = safealloc(sizeof(*ctx));
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->in = safealloc(sizeof(*ctx->in) * (MAX_CHUNK + 2*MAX_CHUNK));
+	ctx->out = safealloc(sizeof(*ctx->out) * MAX_CHUNK);
+	srand(1);
+	for (i=0; i<3*MAX_CHUNK; i++) {
+		ctx->in[i] = (rand() % 4000 - 2000) + (rand() % 4000 - 2000) * I;
+	}
+
+	return ctx;
+}
+
+void*
+setup_filter(const Case *c)
+{
+	Ctx *ctx;
+
+	ctx = setup_plain(c);
+	ctx->flt = filter_rrc(c->order, 1, SAMPLERATE/(float)SYM_RATE, 0.6);
+	return ctx;
+}
+
+void*
+setup_interp(const Case *c)
+{
+	Ctx *ctx;
+
+	ctx = setup_plain(c);
+	ctx->src = memsrc_init(SAMPLERATE);
+	ctx->interp = interp_init(ctx->src, 0.6, c->order, c->factor, SYM_RATE, 1);
+	return ctx;
+}
+
+void*
+setup_agc(const Case *c)
+{
+	Ctx *ctx;
+
+	ctx = setup_plain(c);
+	ctx->agc = agc_init();
+	return ctx;
+}
+
+void*
+setup_costas(const Case *c)
+{
+	Ctx *ctx;
+
+	ctx = setup_plain(c);
+	ctx->cst = costas_init(2*M_PI*PLL_BW/SYM_RATE);
+	return ctx;
+}
+
+/* The conversion loop reads from an actual file, which stays in the page
+ * cache after the first pass */
+void*
+setup_wav(const Case *c)
+{
+	Ctx *ctx;
+	struct wave_header hdr;
+	int16_t *buf;
+	FILE *fd;
+	int tmp;
+	unsigned i;
+
+	ctx = setup_plain(c);
+	strcpy(ctx->fname, "/tmp/md_kbench-XXXXXX");
+	if ((tmp = mkstemp(ctx->fname)) < 0 || !(fd = fdopen(tmp, "w"))) {
+		fatal("Could not create temporary file");
+	}
+
+	memcpy(hdr._riff, "RIFF", 4);
+	memcpy(hdr._filetype, "WAVE", 4);
+	memcpy(hdr._fmt, "fmt ", 4);
+	memcpy(hdr._data, "data", 4);
+	hdr.subchunk_size = 16;
+	hdr.audio_format = 1;
+	hdr.num_channels = 2;
+	hdr.sample_rate = SAMPLERATE;
+	hdr.bits_per_sample = 16;
+	hdr.block_align = 4;
+	hdr.byte_rate = SAMPLERATE * 4;
+	hdr.subchunk2_size = WAV_SAMPLES * 4;
+	hdr.chunk_size = 36 + hdr.subchunk2_size;
+	fwrite(&hdr, sizeof(hdr), 1, fd);
+
+	buf = safealloc(sizeof(*buf) * 2 * WAV_SAMPLES);
+	for (i=0; i<2*WAV_SAMPLES; i++) {
+		buf[i] = rand() % 4000 - 2000;
+	}
+	fwrite(buf, sizeof(*buf), 2 * WAV_SAMPLES, fd);
+	fclose(fd);
+	free(buf);
+
+	ctx->src = open_samples_file(ctx->fname, 0);
+	return ctx;
+}
+
+void
+run_filter_fwd(void *x, const Case *c)
+{
+	Ctx *ctx = x;
+	float complex acc;
+	unsigned i;
+
+	acc = 0;
+	for (i=0; i<c->chunk; i++) {
+		acc += filter_fwd(ctx->flt, ctx->in[i]);
+	}
+	sink = crealf(acc);
+}
+
+void
+run_filter_fwd_block(void *x, const Case *c)
+{
+	Ctx *ctx = x;
+
+	/* The input is preceded by fwd_count-1 samples of history */
+	filter_fwd_block(ctx->flt, ctx->in + ctx->flt->fwd_count - 1, ctx->out, c->chunk);
+	sink = crealf(ctx->out[c->chunk-1]);
+}
+
+void
+run_interp_read(void *x, const Case *c)
+{
+	Ctx *ctx = x;
+
+	memsrc_feed(ctx->src, ctx->in, c->chunk / c->factor);
+	ctx->interp->read(ctx->interp, c->chunk);
+	sink = crealf(ctx->interp->data[0]);
+}
+
+void
+run_agc_apply(void *x, const Case *c)
+{
+	Ctx *ctx = x;
+	float complex acc;
+	unsigned i;
+
+	acc = 0;
+	for (i=0; i<c->chunk; i++) {
+		acc += agc_apply(ctx->agc, ctx->in[i]);
+	}
+	sink = crealf(acc);
+}
+
+void
+run_costas_resync(void *x, const Case *c)
+{
+	Ctx *ctx = x;
+	float complex acc;
+	unsigned i;
+
+	/* Scaled down to the amplitude the AGC would output */
+	acc = 0;
+	for (i=0; i<c->chunk; i++) {
+		acc += costas_resync(ctx->cst, ctx->in[i] * (1.0f/16));
+	}
+	sink = crealf(acc);
+}
+
+void
+run_clamp(void *x, const Case *c)
+{
+	Ctx *ctx = x;
+	int8_t *out;
+	unsigned i;
+
+	out = (int8_t*)ctx->out;
+	for (i=0; i<c->chunk; i++) {
+		out[2*i] = clamp(crealf(ctx->in[i]) / 16);
+		out[2*i+1] = clamp(cimagf(ctx->in[i]) / 16);
+	}
+	sink = out[c->chunk-1];
+}
+
+void
+run_wav_read(void *x, const Case *c)
+{
+	Ctx *ctx = x;
+
+	if (ctx->src->done(ctx->src) + c->chunk > WAV_SAMPLES) {
+		ctx->src->seek(ctx->src, 0);
+	}
+	ctx->src->read(ctx->src, c->chunk);
+	sink = crealf(ctx->src->data[0]);
+}
+
+void
+teardown(void *x)
+{
+	Ctx *ctx = x;
+
+	if (ctx->flt) {
+		filter_free(ctx->flt);
+	}
+	if (ctx->interp) {
+		ctx->interp->close(ctx->interp);
+	}
+	if (ctx->src) {
+		ctx->src->close(ctx->src);
+	}
+	if (ctx->agc) {
+		agc_free(ctx->agc);
+	}
+	if (ctx->cst) {
+		costas_free(ctx->cst);
+	}
+	if (ctx->fname[0]) {
+		unlink(ctx->fname);
+	}
+	free(ctx->in);
+	free(ctx->out);
+	free(ctx);
+}
+
+int
+cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+void
+print_json_str(FILE *fd, const char *str)
+{
+	fputc('"', fd);
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\') {
+			fputc('\\', fd);
+		}
+		if ((unsigned char)*str >= 0x20) {
+			fputc(*str, fd);
+		}
+	}
+	fputc('"', fd);
+}
+
+void
+print_usage(const char *pname)
+{
+	fprintf(stderr, "Usage: %s [options]\n", pname);
+	fprintf(stderr,
+	        "   -f <fmt>    Output format: csv or json (default: csv)\n"
+	        "   -o <file>   Write the results to <file> (default: stdout)\n"
+	        "   -k <name>   Only run the kernels whose name contains <name>\n"
+	        "   -r <n>      Timed repetitions per case (default: 100)\n"
+	        "   -w <n>      Untimed warmup repetitions per case (default: 10)\n"
+	        "   -l <label>  Label for the results (default: hostname)\n"
+	        "   -c <cpu>    Pin to <cpu>\n"
+	        );
+	exit(1);
+}
+/*}}}*/
@@ -0,0 +1,337 @@
+/**
+ * Synthetic LRPT signal generator. Builds a stream of CADUs (sync marker,
+ * random payload, Reed-Solomon parity, CCSDS randomization), convolutionally
+ * encodes it, maps it to QPSK at 72k symbols/s, shapes it with a root-raised
+ * cosine filter and adds a carrier offset with a linear Doppler ramp, a symbol
+ * clock error and white Gaussian noise at the requested Es/N0. The output is a
+ * .wav or raw 16-bit I/Q file that meteor_demod can read, and optionally the
+ * transmitted symbols as a .s file, to measure the symbol error rate against.
+ */
+#include <assert.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cadu.h"
+#include "correlator.h"
+#include "rs.h"
+#include "utils.h"
+#include "viterbi.h"
+#include "wavfile.h"
+
+#define RRC_SPAN 8              /* Symbols on each side of the pulse peak */
+#define RRC_RES 64              /* Pulse table entries per symbol */
+#define OUT_SCALE 3000          /* Sample value of a unit amplitude */
+#define OUT_CHUNK 4096
+
+typedef struct {
+	uint64_t state;
+} Rng;
+
+static void     print_usage(const char *pname);
+static int8_t*  gen_symbols(size_t nsyms, Rng *rng);
+static float*   gen_rrc_table(float alpha);
+static float    rrc(float t, float alpha);
+static uint64_t rng_next(Rng *self);
+static double   rng_gauss(Rng *self);
+static int16_t  to_s16(double x);
+static void     write_wav_header(FILE *fd, unsigned samplerate, uint64_t nsamples);
+
+int
+main(int argc, char *argv[])
+{
+	FILE *out, *ref;
+	int8_t *syms;
+	float *table;
+	int16_t buf[2*OUT_CHUNK];
+	Rng rng;
+	uint64_t nsamples, i;
+	size_t nsyms, k;
+	double duration, snr, freq, ramp, ppm, delay, alpha;
+	double t, u, phase, noise_sd, re, im, g, frac;
+	unsigned samplerate, sym_rate, n;
+	long k0, j;
+	int c, raw, idx;
+	char *out_fname, *ref_fname;
+
+	out_fname = NULL;
+	ref_fname = NULL;
+	duration = 60;
+	samplerate = 140000;
+	sym_rate = 72000;
+	snr = 15;
+	freq = 0;
+	ramp = 0;
+	ppm = 0;
+	delay = 0;
+	alpha = 0.6;
+	raw = 0;
+	rng.state = 1;
+
+	while ((c = getopt(argc, argv, "a:d:D:f:hn:o:p:rs:S:t:T:")) != -1) {
+		switch (c) {
+		case 'a':
+			alpha = atof(optarg);
+			break;
+		case 'd':
+			duration = atof(optarg);
+			break;
+		case 'D':
+			ramp = atof(optarg);
+			break;
+		case 'f':
+			freq = atof(optarg);
+			break;
+		case 'n':
+			snr = atof(optarg);
+			break;
+		case 'o':
+			out_fname = optarg;
+			break;
+		case 'p':
+			ref_fname = optarg;
+			break;
+		case 'r':
+			raw = 1;
+			break;
+		case 's':
+			samplerate = atoi(optarg);
+			break;
+		case 'S':
+			rng.state = strtoull(optarg, NULL, 10) | 1;
+			break;
+		case 't':
+			ppm = atof(optarg);
+			break;
+		case 'T':
+			delay = atof(optarg);
+			break;
+		default:
+			print_usage(argv[0]);
+		}
+	}
+	if (!out_fname || duration <= 0 || !samplerate || alpha <= 0 || alpha > 1) {
+		print_usage(argv[0]);
+	}
+
+	/* Enough symbols to cover the whole output, pulse tails included */
+	nsyms = (size_t)(duration * sym_rate * (1 + ppm*1e-6) + fabs(delay)) + 2*RRC_SPAN + 1;
+	syms = gen_symbols(nsyms, &rng);
+	table = gen_rrc_table(alpha);
+
+	if (ref_fname) {
+		if (!(ref = fopen(ref_fname, "w"))) {
+			fatal("Could not open reference file for writing");
+		}
+		for (k=0; k<nsyms; k++) {
+			fputc(syms[k] & 2 ? -127 : 127, ref);
+			fputc(syms[k] & 1 ? -127 : 127, ref);
+		}
+		fclose(ref);
+	}
+
+	if (!(out = fopen(out_fname, "w"))) {
+		fatal("Could not open file for writing");
+	}
+	nsamples = duration * samplerate;
+	if (!raw) {
+		write_wav_header(out, samplerate, nsamples);
+	}
+
+	/* With a unit energy pulse, each I/Q component carries 1/2 of Es = 1, and
+	 * the noise is spread over the whole sampled bandwidth */
+	noise_sd = sqrt(samplerate / (double)sym_rate / pow(10, snr/10));
+	phase = 0;
+	n = 0;
+	for (i=0; i<nsamples; i++) {
+		t = i / (double)samplerate;
+
+		/* Position of this sample in the symbol stream */
+		u = t * sym_rate * (1 + ppm*1e-6) - delay;
+		k0 = floor(u);
+		re = im = 0;
+		for (j=k0-RRC_SPAN+1; j<=k0+RRC_SPAN; j++) {
+			if (j < 0 || (size_t)j >= nsyms) {
+				continue;
+			}
+			/* Linear interpolation in the pulse table */
+			frac = (u - j + RRC_SPAN) * RRC_RES;
+			idx = frac;
+			g = table[idx] + (table[idx+1] - table[idx]) * (frac - idx);
+
+			re += g * (syms[j] & 2 ? -M_SQRT1_2 : M_SQRT1_2);
+			im += g * (syms[j] & 1 ? -M_SQRT1_2 : M_SQRT1_2);
+		}
+
+		buf[2*n]   = to_s16(re*cos(phase) - im*sin(phase) + noise_sd*M_SQRT1_2*rng_gauss(&rng));
+		buf[2*n+1] = to_s16(re*sin(phase) + im*cos(phase) + noise_sd*M_SQRT1_2*rng_gauss(&rng));
+		if (++n == OUT_CHUNK) {
+			fwrite(buf, sizeof(*buf), 2*n, out);
+			n = 0;
+		}
+
+		phase += 2*M_PI * (freq + ramp*t) / samplerate;
+		phase = fmod(phase, 2*M_PI);
+	}
+	fwrite(buf, sizeof(*buf), 2*n, out);
+	fclose(out);
+
+	free(syms);
+	free(table);
+	return 0;
+}
+
+/* Static functions {{{ */
+void
+print_usage(const char *pname)
+{
+	fprintf(stderr, "Usage: %s [options] -o <file>\n", pname);
+	fprintf(stderr,
+	        "   -o <file>   Write the samples to <file>\n"
+	        "   -p <file>   Write the transmitted symbols to <file>, in .s format\n"
+	        "   -r          Write raw 16-bit I/Q samples instead of a .wav file\n"
+	        "   -d <secs>   Duration (default: 60)\n"
+	        "   -s <rate>   Samplerate (default: 140000)\n"
+	        "   -n <dB>     Es/N0 (default: 15)\n"
+	        "   -f <Hz>     Carrier offset at the start (default: 0)\n"
+	        "   -D <Hz/s>   Carrier offset change rate, to simulate Doppler (default: 0)\n"
+	        "   -t <ppm>    Symbol clock error (default: 0)\n"
+	        "   -T <syms>   Delay of the first symbol, in symbols (default: 0)\n"
+	        "   -a <alpha>  RRC filter alpha (default: 0.6)\n"
+	        "   -S <seed>   Random seed for the payload and the noise (default: 1)\n"
+	        );
+	exit(1);
+}
+
+/* Encode a stream of random CADUs into $nsyms QPSK symbols, stored as 2-bit
+ * values (I in bit 1, Q in bit 0). A 1 is sent as a negative value */
+int8_t*
+gen_symbols(size_t nsyms, Rng *rng)
+{
+	uint8_t frame[CADU_LEN], pn[CADU_LEN-4];
+	uint64_t enc;
+	unsigned reg, i;
+	size_t k;
+	int8_t *ret;
+
+	ret = safealloc(nsyms);
+	cadu_gen_pn(pn, sizeof(pn));
+	reg = 0;
+
+	for (k=0; k<nsyms; ) {
+		frame[0] = (ASM_WORD >> 24) & 0xFF;
+		frame[1] = (ASM_WORD >> 16) & 0xFF;
+		frame[2] = (ASM_WORD >> 8) & 0xFF;
+		frame[3] = ASM_WORD & 0xFF;
+		for (i=4; i<CADU_LEN; i++) {
+			frame[i] = rng_next(rng);
+		}
+
+		/* Interleaved RS codewords, then randomization (the marker is left
+		 * as is) */
+		for (i=0; i<4; i++) {
+			rs_encode(frame + 4 + i, 4);
+		}
+		for (i=0; i<sizeof(pn); i++) {
+			frame[4+i] ^= pn[i];
+		}
+
+		for (i=0; i<CADU_SYMS && k<nsyms; i++, k++) {
+			ret[k] = conv_encode(&reg, frame[i/8] >> (7 - i%8));
+		}
+	}
+
+	/* The first marker is encoded from a cleared register, so it must come
+	 * out as the one other decoders look for */
+	enc = 0;
+	for (k=0; k<ASM_SYMS && k<nsyms; k++) {
+		enc = (enc << 2) | ret[k];
+	}
+	assert(nsyms < ASM_SYMS || enc == ~ASM_ENCODED);
+
+	return ret;
+}
+
+/* Unit energy RRC pulse, sampled RRC_RES times per symbol over
+ * [-RRC_SPAN, RRC_SPAN] symbols */
+float*
+gen_rrc_table(float alpha)
+{
+	float *ret;
+	unsigned i, len;
+
+	len = 2*RRC_SPAN*RRC_RES + 2;
+	ret = safealloc(sizeof(*ret) * len);
+	for (i=0; i<len; i++) {
+		ret[i] = rrc(i / (float)RRC_RES - RRC_SPAN, alpha);
+	}
+
+	return ret;
+}
+
+/* RRC impulse response at $t symbols from the peak */
+float
+rrc(float t, float alpha)
+{
+	if (fabsf(t) < 1e-6) {
+		return 1 - alpha + 4*alpha/M_PI;
+	}
+	if (fabsf(fabsf(4*alpha*t) - 1) < 1e-6) {
+		return alpha/M_SQRT2 * ((1 + 2/M_PI) * sin(M_PI/(4*alpha)) + (1 - 2/M_PI) * cos(M_PI/(4*alpha)));
+	}
+	return (sin(M_PI*t*(1-alpha)) + 4*alpha*t*cos(M_PI*t*(1+alpha))) /
+	       (M_PI*t*(1 - 16*alpha*alpha*t*t));
+}
+
+/* xorshift64*, so that the output only depends on the seed */
+uint64_t
+rng_next(Rng *self)
+{
+	self->state ^= self->state >> 12;
+	self->state ^= self->state << 25;
+	self->state ^= self->state >> 27;
+	return (self->state * 0x2545F4914F6CDD1DULL) >> 32;
+}
+
+/* Standard normal variate (Box-Muller) */
+double
+rng_gauss(Rng *self)
+{
+	double u, v;
+
+	u = (rng_next(self) + 1.0) / 4294967297.0;
+	v = (rng_next(self) + 1.0) / 4294967297.0;
+	return sqrt(-2*log(u)) * cos(2*M_PI*v);
+}
+
+int16_t
+to_s16(double x)
+{
+	x *= OUT_SCALE;
+	return x > 32767 ? 32767 : x < -32768 ? -32768 : (int16_t)x;
+}
+
+void
+write_wav_header(FILE *fd, unsigned samplerate, uint64_t nsamples)
+{
+	struct wave_header hdr;
+
+	memcpy(hdr._riff, "RIFF", 4);
+	memcpy(hdr._filetype, "WAVE", 4);
+	memcpy(hdr._fmt, "fmt ", 4);
+	memcpy(hdr._data, "data", 4);
+	hdr.subchunk_size = 16;
+	hdr.audio_format = 1;
+	hdr.num_channels = 2;
+	hdr.sample_rate = samplerate;
+	hdr.bits_per_sample = 16;
+	hdr.block_align = hdr.num_channels * hdr.bits_per_sample/8;
+	hdr.byte_rate = samplerate * hdr.block_align;
+	hdr.subchunk2_size = nsamples * hdr.block_align;
+	hdr.chunk_size = 36 + hdr.subchunk2_size;
+
+	fwrite(&hdr, sizeof(hdr), 1, fd);
+}
+/*}}}*/
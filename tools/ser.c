@@ -0,0 +1,187 @@
+/**
+ * Symbol error rate of a demodulated .s file against the transmitted symbols
+ * (e.g. the reference written by md_lrptgen -p). The output is compared one
+ * block at a time, each one aligned to the reference by searching the offset
+ * and the phase ambiguity of the QPSK constellation, so that symbol slips and
+ * phase jumps are counted as such instead of ruining the rest of the file.
+ * Also reports how long the demodulator took to lock, i.e. to produce the
+ * first block with a low error rate.
+ */
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "utils.h"
+
+#define BLOCK_SYMS 4096
+#define PROBE_SYMS 256          /* Symbols compared while searching the alignment */
+#define MAX_OFFSET 2048         /* Widest offset searched, in symbols */
+#define LOCK_SER 0.25           /* Blocks with fewer errors count as locked (random: 0.75) */
+#define NSTATES 8               /* 4 rotations, with and without I/Q swap */
+
+static uint8_t* read_hard(const char *fname, size_t *nsyms);
+static unsigned count_errors(const uint8_t *out, const uint8_t *ref, size_t len, unsigned state, unsigned max);
+static uint8_t  map_state(uint8_t sym, unsigned state);
+
+int
+main(int argc, char *argv[])
+{
+	uint8_t *out, *ref;
+	size_t out_len, ref_len, k, len, errors, total;
+	long offset, best_offset, off;
+	unsigned state, best_state, s, err, best, slips;
+	int c, aligned, locked;
+	unsigned sym_rate;
+	double lock_time;
+
+	sym_rate = 72000;
+	while ((c = getopt(argc, argv, "r:")) != -1) {
+		switch (c) {
+		case 'r':
+			sym_rate = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-r symrate] <demod.s> <reference.s>\n", argv[0]);
+			return 1;
+		}
+	}
+	if (argc - optind < 2) {
+		fprintf(stderr, "Usage: %s [-r symrate] <demod.s> <reference.s>\n", argv[0]);
+		return 1;
+	}
+
+	out = read_hard(argv[optind], &out_len);
+	ref = read_hard(argv[optind+1], &ref_len);
+
+	offset = 0;
+	state = 0;
+	aligned = 0;
+	locked = 0;
+	lock_time = -1;
+	errors = total = 0;
+	slips = 0;
+
+	for (k=0; k+BLOCK_SYMS <= out_len; k += BLOCK_SYMS) {
+		/* Start from the current alignment, so that a mismatch can be
+		 * rejected after a handful of errors */
+		best_offset = offset;
+		best_state = state;
+		best = (long)k + offset >= 0 && k + offset + PROBE_SYMS <= ref_len
+		     ? count_errors(out + k, ref + k + offset, PROBE_SYMS, state, PROBE_SYMS)
+		     : PROBE_SYMS;
+
+		if (best > PROBE_SYMS * LOCK_SER) {
+			for (off = -MAX_OFFSET; off <= MAX_OFFSET; off++) {
+				if ((long)k + off < 0 || k + off + PROBE_SYMS > ref_len) {
+					continue;
+				}
+				for (s=0; s<NSTATES; s++) {
+					err = count_errors(out + k, ref + k + off, PROBE_SYMS, s, best);
+					if (err < best) {
+						best = err;
+						best_offset = off;
+						best_state = s;
+					}
+				}
+			}
+		}
+
+		if (aligned && locked && (best_offset != offset || best_state != state)) {
+			slips++;
+		}
+		offset = best_offset;
+		state = best_state;
+		aligned = 1;
+
+		len = BLOCK_SYMS;
+		if (k + offset + len > ref_len) {
+			break;
+		}
+		err = count_errors(out + k, ref + k + offset, len, state, len);
+
+		/* Errors are only counted from the first locked block onwards */
+		if (!locked && err < len * LOCK_SER) {
+			locked = 1;
+			lock_time = k / (double)sym_rate;
+		}
+		if (locked) {
+			errors += err;
+			total += len;
+		}
+	}
+
+	if (locked) {
+		printf("symbols=%lu lock=%.3fs ser=%.3e errors=%lu/%lu slips=%u\n",
+		       (unsigned long)out_len, lock_time, (double)errors/total,
+		       (unsigned long)errors, (unsigned long)total, slips);
+	} else {
+		printf("symbols=%lu lock=never ser=- errors=-/- slips=-\n", (unsigned long)out_len);
+	}
+
+	free(out);
+	free(ref);
+	return locked ? 0 : 1;
+}
+
+/* Static functions {{{ */
+/* Read a .s file as 2-bit hard symbols, I in bit 1 and Q in bit 0 */
+uint8_t*
+read_hard(const char *fname, size_t *nsyms)
+{
+	FILE *fd;
+	uint8_t *ret;
+	int8_t pair[2];
+	size_t size, len;
+
+	if (!(fd = fopen(fname, "r"))) {
+		fatal("Could not open input file");
+	}
+
+	size = 1 << 20;
+	len = 0;
+	ret = safealloc(size);
+	while (fread(pair, sizeof(pair), 1, fd) == 1) {
+		if (len == size) {
+			size *= 2;
+			if (!(ret = realloc(ret, size))) {
+				fatal("Failed to allocate memory");
+			}
+		}
+		ret[len++] = (pair[0] >= 0) << 1 | (pair[1] >= 0);
+	}
+	fclose(fd);
+
+	*nsyms = len;
+	return ret;
+}
+
+/* Count the symbols of $out that differ from $ref once mapped through $state,
+ * stopping early once $max is reached */
+unsigned
+count_errors(const uint8_t *out, const uint8_t *ref, size_t len, unsigned state, unsigned max)
+{
+	unsigned ret;
+	size_t i;
+
+	ret = 0;
+	for (i=0; i<len && ret<max; i++) {
+		ret += map_state(out[i], state) != ref[i];
+	}
+
+	return ret;
+}
+
+/* Undo one of the 8 ambiguities of a QPSK symbol */
+uint8_t
+map_state(uint8_t sym, unsigned state)
+{
+	/* Constellation points in counterclockwise order: 11, 01, 00, 10 */
+	static const uint8_t to_idx[4] = {2, 1, 3, 0};
+	static const uint8_t from_idx[4] = {3, 1, 0, 2};
+
+	if (state & 4) {
+		sym = (sym >> 1) | (sym & 1) << 1;
+	}
+	return from_idx[(to_idx[sym] + state) & 3];
+}
+/*}}}*/
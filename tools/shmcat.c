@@ -0,0 +1,117 @@
+/**
+ * Reference consumer for the shared-memory ring output (meteor_demod -m).
+ * Reads the soft symbols in place, optionally writes them to a file, and
+ * prints the throughput, the delay between a write and the consumer waking
+ * up, and the number of bytes the producer had to drop.
+ */
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "shmring.h"
+#include "utils.h"
+
+#define WAIT_TIMEOUT_MS 100
+#define OPEN_RETRIES 100
+
+static void print_stats(const char *prefix, uint64_t bytes, uint64_t elapsed_ns, uint64_t lat_sum_ns,
+                        uint64_t lat_max_ns, unsigned long wakeups, uint64_t overruns);
+
+int
+main(int argc, char *argv[])
+{
+	ShmRing *ring;
+	FILE *out;
+	const int8_t *syms;
+	struct timespec retry;
+	uint64_t start_ns, report_ns, now, lat, lat_sum, lat_max, bytes, total;
+	unsigned long wakeups;
+	float interval;
+	size_t len;
+	int c, i;
+
+	out = NULL;
+	interval = 1;
+	while ((c = getopt(argc, argv, "i:o:")) != -1) {
+		switch (c) {
+		case 'i':
+			interval = atof(optarg);
+			break;
+		case 'o':
+			if (!(out = fopen(optarg, "w"))) {
+				fatal("Could not open file for writing");
+			}
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-o file] [-i interval] <name>\n", argv[0]);
+			return 1;
+		}
+	}
+	if (argc - optind < 1) {
+		fprintf(stderr, "Usage: %s [-o file] [-i interval] <name>\n", argv[0]);
+		return 1;
+	}
+
+	/* The producer may not have created the ring yet */
+	retry.tv_sec = 0;
+	retry.tv_nsec = 100L * 1000 * 1000;
+	for (i=0; !(ring = shmring_open(argv[optind])); i++) {
+		if (i == OPEN_RETRIES) {
+			fatal("Could not open the shared memory ring");
+		}
+		nanosleep(&retry, NULL);
+	}
+	fprintf(stderr, "Ring size: %lu bytes, symbol rate: %u\n", (unsigned long)ring->hdr->size, ring->hdr->sym_rate);
+
+	start_ns = report_ns = get_time_ns();
+	lat_sum = lat_max = bytes = total = 0;
+	wakeups = 0;
+
+	while (!shmring_eof(ring)) {
+		len = shmring_read_acquire(ring, &syms, WAIT_TIMEOUT_MS);
+		now = get_time_ns();
+
+		if (len > 0) {
+			/* Age of the newest symbols when they were picked up */
+			lat = now - __atomic_load_n(&ring->hdr->write_ns, __ATOMIC_RELAXED);
+			lat_sum += lat;
+			lat_max = MAX(lat_max, lat);
+			wakeups++;
+
+			if (out) {
+				fwrite(syms, len, 1, out);
+			}
+			shmring_read_release(ring, len);
+			bytes += len;
+			total += len;
+		}
+
+		if (now - report_ns >= interval * 1e9) {
+			print_stats("", bytes, now - report_ns, lat_sum, lat_max, wakeups,
+			            __atomic_load_n(&ring->hdr->overruns, __ATOMIC_RELAXED));
+			report_ns = now;
+			lat_sum = lat_max = bytes = 0;
+			wakeups = 0;
+		}
+	}
+
+	print_stats("Total: ", total, get_time_ns() - start_ns, 0, 0, 0, ring->hdr->overruns);
+
+	shmring_close(ring);
+	if (out) {
+		fclose(out);
+	}
+	return 0;
+}
+
+void
+print_stats(const char *prefix, uint64_t bytes, uint64_t elapsed_ns, uint64_t lat_sum_ns,
+            uint64_t lat_max_ns, unsigned long wakeups, uint64_t overruns)
+{
+	fprintf(stderr, "%s%.1f kB/s (%lu bytes)", prefix, bytes / (elapsed_ns * 1e-9) / 1000, (unsigned long)bytes);
+	if (wakeups) {
+		fprintf(stderr, ", %lu reads, latency avg %.1f us, max %.1f us",
+		        wakeups, lat_sum_ns / 1e3 / wakeups, lat_max_ns / 1e3);
+	}
+	fprintf(stderr, ", %lu bytes dropped\n", (unsigned long)overruns);
+}